@@ -1,72 +1,386 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "urest.h"
 
-int base32_encode(char *in, uint16_t len, char *out)
-{
-	char alphabet[] = {"ABCDEFGHIJKLMNOPQRSTUVWXYZ234567"};
-	int outlen = 0, count = 0, bufsize = 8, index = 0;
-	int buffer, next, left, pad;
-
-	if (len > 0) {
-		buffer = in[0];
-		next = 1;
-		left = 8;
-
-		while (count < bufsize && (left > 0 || next < len)) {
-			if (left < 5) {
-				if (next < len) {
-					buffer <<= 8;
-					buffer |= in[next] & 0xff;
-					next++;
-					left += 8;
-				} else {
-					pad = 5 - left;
-					buffer <<= pad;
-					left += pad;
-				}
-			}
-			index = 0x1f & (buffer >> (left - 5));
-
-			left -= 5;
-			out[outlen] = alphabet[index];
-			outlen++;
-		}
-		out[outlen] = '\0';
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BASE32_X86
+#endif
+
+/*
+ * RFC 4648 base32 without padding. five bytes are eight characters, so the bulk
+ * of a buffer goes by groups of five bytes (a 40 bit word) and only the last
+ * partial group is done bit by bit. on x86 the groups go 2 at a time (SSSE3) or
+ * 4 at a time (AVX2), chosen by base32_isa().
+ */
+
+static const char alphabet[] = {"ABCDEFGHIJKLMNOPQRSTUVWXYZ234567"};
+
+/* character values, B32_SKIP for what decoding ignores, B32_BAD for the rest */
+#define B32_SKIP	0x40
+#define B32_BAD		0x80
+
+static uint8_t value[256];
+
+static int (*encode_kernel)(const uint8_t *, uint32_t, char *);
+static int (*decode_kernel)(const char *, uint32_t, uint8_t *);
+static int isa;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+
+static void encode_group(const uint8_t *in, char *out)
+{
+	uint64_t word;
+	int i;
+	
+	word = (uint64_t)in[0] << 32 | (uint64_t)in[1] << 24 | (uint64_t)in[2] << 16 | (uint64_t)in[3] << 8 | in[4];
+	
+	for (i = 0; i < 8; i++)
+		out[i] = alphabet[(word >> (35 - i * 5)) & 0x1f];
+}
+
+/* eight characters, -1 if one is not in the alphabet */
+static int decode_group(const char *in, uint8_t *out)
+{
+	uint64_t word = 0;
+	uint8_t v, bad = 0;
+	int i;
+	
+	for (i = 0; i < 8; i++) {
+		v = value[(uint8_t)in[i]];
+		bad |= v;
+		word = word << 5 | (v & 0x1f);
 	}
-  
-	return outlen;
+	
+	if (bad & (B32_SKIP | B32_BAD))
+		return -1;
+	
+	out[0] = word >> 32;
+	out[1] = word >> 24;
+	out[2] = word >> 16;
+	out[3] = word >> 8;
+	out[4] = word;
+	
+	return 0;
+}
+
+/* kernels take whole groups and return the number of characters done */
+static int encode_scalar(const uint8_t *in, uint32_t groups, char *out)
+{
+	uint32_t i;
+	
+	for (i = 0; i < groups; i++)
+		encode_group(in + i * 5, out + i * 8);
+	
+	return groups * 8;
 }
 
-int base32_decode(char *in, uint16_t len, char *out)
+static int decode_scalar(const char *in, uint32_t groups, uint8_t *out)
 {
-	int i, outlen = 0, buffer = 0, left = 0;
-	char ch;
+	uint32_t i;
+	
+	for (i = 0; i < groups; i++)
+		if (decode_group(in + i * 8, out + i * 5))
+			break;
+	
+	return i * 8;
+}
 
-	for (i = 0; i < len; i++) {
-		ch = in[i];
+#ifdef BASE32_X86
+/*
+ * encoding: each character is made a 16 bit lane holding the two bytes it spans
+ * (big endian), shifted right by a multiply (mulhi by 2^(16 - shift)) and masked.
+ * values 0 - 25 are letters, 26 - 31 digits.
+ */
+#define ENC_SHUFFLE(o)	(char)(o + 1), (char)(o), (char)(o + 1), (char)(o), (char)(o + 2), (char)(o + 1), (char)(o + 2), (char)(o + 1), \
+			(char)(o + 3), (char)(o + 2), (char)(o + 4), (char)(o + 3), (char)(o + 4), (char)(o + 3), (char)(o + 5), (char)(o + 4)
+#define ENC_MULTIPLY	1 << 5, 1 << 10, 1 << 7, 1 << 12, 1 << 9, 1 << 6, 1 << 11, 1 << 8
 
-		if (ch == 0xa0 || ch == 0x09 || ch == 0x0a || ch == 0x0d || ch == 0x3d)
-			continue;
+/*
+ * decoding: letters (either case) and digits are mapped to their value, then
+ * pairs of characters are merged (maddubs), pairs of pairs (madd) and two of
+ * those make the 40 bit word of a group in a 64 bit lane. its bytes are taken
+ * most significant first.
+ */
+#define DEC_SHUFFLE	4, 3, 2, 1, 0, 12, 11, 10, 9, 8, -1, -1, -1, -1, -1, -1
 
-		if ((ch >= 0x41 && ch <= 0x5a) || (ch >= 0x61 && ch <= 0x7a)) {
-			ch = ((ch & 0x1f) - 1);
-		} else if (ch >= 0x32 && ch <= 0x37) {
-			ch -= (0x32 - 26);
-		} else {
-			return 0;
-		}
+__attribute__((target("ssse3")))
+static __m128i encode_chars_ssse3(__m128i values)
+{
+	__m128i digits = _mm_and_si128(_mm_cmpgt_epi8(values, _mm_set1_epi8(25)), _mm_set1_epi8('2' - 26 - 'A'));
+	
+	return _mm_add_epi8(_mm_add_epi8(values, _mm_set1_epi8('A')), digits);
+}
+
+__attribute__((target("ssse3")))
+static int encode_ssse3(const uint8_t *in, uint32_t groups, char *out)
+{
+	const __m128i shuffle_lo = _mm_setr_epi8(ENC_SHUFFLE(0));
+	const __m128i shuffle_hi = _mm_setr_epi8(ENC_SHUFFLE(5));
+	const __m128i multiply = _mm_setr_epi16(ENC_MULTIPLY);
+	const __m128i mask = _mm_set1_epi16(0x1f);
+	__m128i data, lo, hi;
+	uint32_t i;
+	
+	/* 16 bytes are loaded for 10, the last groups are left to the scalar code */
+	for (i = 0; i + 4 <= groups; i += 2) {
+		data = _mm_loadu_si128((const __m128i *)(in + i * 5));
+		lo = _mm_and_si128(_mm_mulhi_epu16(_mm_shuffle_epi8(data, shuffle_lo), multiply), mask);
+		hi = _mm_and_si128(_mm_mulhi_epu16(_mm_shuffle_epi8(data, shuffle_hi), multiply), mask);
+		_mm_storeu_si128((__m128i *)(out + i * 8), encode_chars_ssse3(_mm_packus_epi16(lo, hi)));
+	}
+	
+	return i * 8 + encode_scalar(in + i * 5, groups - i, out + i * 8);
+}
+
+/* character values, the mask of invalid characters in *bad */
+__attribute__((target("ssse3")))
+static __m128i decode_chars_ssse3(__m128i data, __m128i *bad)
+{
+	__m128i folded, letter, digit;
+	
+	folded = _mm_and_si128(data, _mm_set1_epi8((char)0xdf));
+	letter = _mm_and_si128(_mm_cmpgt_epi8(folded, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), folded));
+	digit = _mm_and_si128(_mm_cmpgt_epi8(data, _mm_set1_epi8('2' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('7' + 1), data));
+	*bad = _mm_cmpeq_epi8(_mm_or_si128(letter, digit), _mm_setzero_si128());
+	
+	return _mm_or_si128(_mm_and_si128(letter, _mm_sub_epi8(_mm_and_si128(data, _mm_set1_epi8(0x1f)), _mm_set1_epi8(1))),
+		_mm_and_si128(digit, _mm_sub_epi8(data, _mm_set1_epi8('2' - 26))));
+}
 
-		buffer <<= 5;    
-		buffer |= ch;
-		left += 5;
-		
-		if (left >= 8) {
-			out[outlen] = (buffer >> (left - 8)) & 0xff;
-			left -= 8;
-			outlen++;
+__attribute__((target("ssse3")))
+static __m128i decode_pack_ssse3(__m128i values)
+{
+	__m128i pairs, quads;
+	
+	pairs = _mm_maddubs_epi16(values, _mm_set1_epi16(0x0120));
+	quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00010400));
+	quads = _mm_or_si128(_mm_slli_epi64(_mm_and_si128(quads, _mm_set1_epi64x(0xffffffff)), 20), _mm_srli_epi64(quads, 32));
+	
+	return _mm_shuffle_epi8(quads, _mm_setr_epi8(DEC_SHUFFLE));
+}
+
+__attribute__((target("ssse3")))
+static int decode_ssse3(const char *in, uint32_t groups, uint8_t *out)
+{
+	__m128i data, values, bad;
+	uint32_t i;
+	
+	/* 16 bytes are stored for 10, the last groups are left to the scalar code */
+	for (i = 0; i + 4 <= groups; i += 2) {
+		data = _mm_loadu_si128((const __m128i *)(in + i * 8));
+		values = decode_chars_ssse3(data, &bad);
+	
+		if (_mm_movemask_epi8(bad))
+			break;
+	
+		_mm_storeu_si128((__m128i *)(out + i * 5), decode_pack_ssse3(values));
+	}
+	
+	return i * 8 + decode_scalar(in + i * 8, groups - i, out + i * 5);
+}
+
+/* the same, with the two 128 bit lanes taking 20 bytes or 32 characters */
+__attribute__((target("avx2")))
+static int encode_avx2(const uint8_t *in, uint32_t groups, char *out)
+{
+	const __m256i shuffle_lo = _mm256_setr_epi8(ENC_SHUFFLE(0), ENC_SHUFFLE(0));
+	const __m256i shuffle_hi = _mm256_setr_epi8(ENC_SHUFFLE(5), ENC_SHUFFLE(5));
+	const __m256i multiply = _mm256_setr_epi16(ENC_MULTIPLY, ENC_MULTIPLY);
+	const __m256i mask = _mm256_set1_epi16(0x1f);
+	__m256i data, lo, hi, values, digits;
+	uint32_t i;
+	
+	for (i = 0; i + 6 <= groups; i += 4) {
+		data = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + i * 5))),
+			_mm_loadu_si128((const __m128i *)(in + i * 5 + 10)), 1);
+		lo = _mm256_and_si256(_mm256_mulhi_epu16(_mm256_shuffle_epi8(data, shuffle_lo), multiply), mask);
+		hi = _mm256_and_si256(_mm256_mulhi_epu16(_mm256_shuffle_epi8(data, shuffle_hi), multiply), mask);
+		values = _mm256_packus_epi16(lo, hi);
+		digits = _mm256_and_si256(_mm256_cmpgt_epi8(values, _mm256_set1_epi8(25)), _mm256_set1_epi8('2' - 26 - 'A'));
+		_mm256_storeu_si256((__m256i *)(out + i * 8), _mm256_add_epi8(_mm256_add_epi8(values, _mm256_set1_epi8('A')), digits));
+	}
+	
+	/* the tail is SSE code, no penalty for mixing it with the upper lanes in use */
+	_mm256_zeroupper();
+	
+	return i * 8 + encode_ssse3(in + i * 5, groups - i, out + i * 8);
+}
+
+__attribute__((target("avx2")))
+static int decode_avx2(const char *in, uint32_t groups, uint8_t *out)
+{
+	__m256i data, folded, letter, digit, values, pairs, quads;
+	uint32_t i;
+	
+	for (i = 0; i + 6 <= groups; i += 4) {
+		data = _mm256_loadu_si256((const __m256i *)(in + i * 8));
+		folded = _mm256_and_si256(data, _mm256_set1_epi8((char)0xdf));
+		letter = _mm256_and_si256(_mm256_cmpgt_epi8(folded, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), folded));
+		digit = _mm256_and_si256(_mm256_cmpgt_epi8(data, _mm256_set1_epi8('2' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('7' + 1), data));
+	
+		if ((uint32_t)_mm256_movemask_epi8(_mm256_or_si256(letter, digit)) != 0xffffffff)
+			break;
+	
+		values = _mm256_or_si256(_mm256_and_si256(letter, _mm256_sub_epi8(_mm256_and_si256(data, _mm256_set1_epi8(0x1f)), _mm256_set1_epi8(1))),
+			_mm256_and_si256(digit, _mm256_sub_epi8(data, _mm256_set1_epi8('2' - 26))));
+		pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi16(0x0120));
+		quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00010400));
+		quads = _mm256_or_si256(_mm256_slli_epi64(_mm256_and_si256(quads, _mm256_set1_epi64x(0xffffffff)), 20), _mm256_srli_epi64(quads, 32));
+		quads = _mm256_shuffle_epi8(quads, _mm256_setr_epi8(DEC_SHUFFLE, DEC_SHUFFLE));
+	
+		/* 10 bytes in each lane, the second store covers the tail of the first */
+		_mm_storeu_si128((__m128i *)(out + i * 5), _mm256_castsi256_si128(quads));
+		_mm_storeu_si128((__m128i *)(out + i * 5 + 10), _mm256_extracti128_si256(quads, 1));
+	}
+	
+	_mm256_zeroupper();
+	
+	return i * 8 + decode_ssse3(in + i * 8, groups - i, out + i * 5);
+}
+#endif
+
+static int base32_select(int want)
+{
+	isa = BASE32_SCALAR;
+	encode_kernel = encode_scalar;
+	decode_kernel = decode_scalar;
+	
+#ifdef BASE32_X86
+	__builtin_cpu_init();
+	
+	if (want != BASE32_SCALAR && __builtin_cpu_supports("ssse3")) {
+		isa = BASE32_SSSE3;
+		encode_kernel = encode_ssse3;
+		decode_kernel = decode_ssse3;
+	}
+	
+	if ((want < 0 || want >= BASE32_AVX2) && __builtin_cpu_supports("avx2")) {
+		isa = BASE32_AVX2;
+		encode_kernel = encode_avx2;
+		decode_kernel = decode_avx2;
+	}
+#endif
+	
+	return isa;
+}
+
+static void base32_init(void)
+{
+	int i;
+	
+	for (i = 0; i < 256; i++)
+		value[i] = B32_BAD;
+	
+	for (i = 0; i < 32; i++) {
+		value[(uint8_t)alphabet[i]] = i;
+		value[(uint8_t)alphabet[i] | 0x20] = i;
+	}
+	
+	value['\t'] = value['\n'] = value['\r'] = value['='] = value[0xa0] = B32_SKIP;
+	base32_select(-1);
+}
+
+/*
+ * pick the kernels: BASE32_SCALAR, BASE32_SSSE3, BASE32_AVX2 or -1 for the best
+ * one the CPU has (the default). returns the one in use, which may be lower than
+ * asked for. not to be called while other threads encode or decode.
+ */
+int base32_isa(int want)
+{
+	pthread_once(&once, base32_init);
+	
+	return base32_select(want);
+}
+
+/*
+ * encode len bytes into out, of size bytes, and terminate it. returns the
+ * length encoded (BASE32_ENCODED(len) - 1) or -1 if out is too small.
+ */
+int base32_encode(char *in, uint32_t len, char *out, uint32_t size)
+{
+	const uint8_t *data = (const uint8_t *)in;
+	uint32_t outlen, left;
+	uint64_t buffer = 0;
+	int bits = 0;
+	
+	if (size < BASE32_ENCODED(len))
+		return -1;
+	
+	pthread_once(&once, base32_init);
+	
+	outlen = encode_kernel(data, len / 5, out);
+	data += len / 5 * 5;
+	
+	/* the last partial group, padded with zero bits */
+	for (left = len % 5; left; left--) {
+		buffer = buffer << 8 | *data++;
+		bits += 8;
+	
+		while (bits >= 5) {
+			out[outlen++] = alphabet[(buffer >> (bits - 5)) & 0x1f];
+			bits -= 5;
 		}
 	}
+	
+	if (bits)
+		out[outlen++] = alphabet[(buffer << (5 - bits)) & 0x1f];
+	
 	out[outlen] = '\0';
+	
+	return outlen;
+}
 
+/*
+ * decode len characters into out, of size bytes, and terminate it. whitespace
+ * and padding are skipped, lowercase is taken. returns the length decoded or -1
+ * on a character not in the alphabet or if out is too small (it needs
+ * BASE32_DECODED(len) bytes).
+ */
+int base32_decode(char *in, uint32_t len, char *out, uint32_t size)
+{
+	uint8_t *data = (uint8_t *)out;
+	uint32_t i = 0, outlen = 0, done;
+	uint32_t buffer = 0;
+	int bits = 0;
+	uint8_t v;
+	
+	if (size < BASE32_DECODED(len))
+		return -1;
+	
+	pthread_once(&once, base32_init);
+	
+	while (i < len) {
+		/* on a group boundary whole groups go to the kernel, up to a character it does not take */
+		if (bits == 0 && len - i >= 8) {
+			done = decode_kernel(in + i, (len - i) / 8, data + outlen);
+			i += done;
+			outlen += done / 8 * 5;
+		}
+	
+		if (i == len)
+			break;
+	
+		v = value[(uint8_t)in[i++]];
+	
+		if (v & B32_SKIP)
+			continue;
+	
+		if (v & B32_BAD)
+			return -1;
+	
+		buffer = buffer << 5 | v;
+		bits += 5;
+	
+		if (bits >= 8) {
+			data[outlen++] = buffer >> (bits - 8);
+			bits -= 8;
+		}
+	}
+	
+	data[outlen] = '\0';
+	
 	return outlen;
 }
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "urest.h"
+
+#define BENCH_BYTES		(64 * 1024 * 1024)	/* bytes encoded per run */
+
+/*
+ * base32 benchmark: encode and decode buffers of a few sizes (a small payload
+ * up to a large one) with each kernel the CPU has, in GB/s of binary data.
+ */
+
+static double now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	const char *name[] = {"scalar", "ssse3", "avx2"};
+	uint32_t sizes[] = {64, 1024, 65536};
+	char *bin, *enc, *dec;
+	uint32_t i, s, runs, enclen = 0;
+	int isa, check = 0;
+	double t, encode, decode;
+	
+	bin = malloc(65536);
+	enc = malloc(BASE32_ENCODED(65536));
+	dec = malloc(BASE32_DECODED(BASE32_ENCODED(65536)));
+	
+	if (!bin || !enc || !dec)
+		return 1;
+	
+	srand(1);
+	
+	for (i = 0; i < 65536; i++)
+		bin[i] = rand();
+	
+	printf("%-8s %8s %12s %12s\n", "kernel", "bytes", "encode GB/s", "decode GB/s");
+	
+	for (isa = BASE32_SCALAR; isa <= BASE32_AVX2; isa++) {
+		if (base32_isa(isa) != isa)
+			break;
+	
+		for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			runs = BENCH_BYTES / sizes[s];
+	
+			t = now();
+	
+			for (i = 0; i < runs; i++)
+				enclen = base32_encode(bin, sizes[s], enc, BASE32_ENCODED(sizes[s]));
+	
+			encode = (double)runs * sizes[s] / (now() - t) / 1e9;
+			t = now();
+	
+			for (i = 0; i < runs; i++)
+				check += base32_decode(enc, enclen, dec, BASE32_DECODED(enclen));
+	
+			decode = (double)runs * sizes[s] / (now() - t) / 1e9;
+	
+			if (memcmp(bin, dec, sizes[s]))
+				printf("%s: %u bytes do not decode back\n", name[isa], sizes[s]);
+	
+			printf("%-8s %8u %12.2f %12.2f\n", name[isa], sizes[s], encode, decode);
+		}
+	}
+	
+	free(bin);
+	free(enc);
+	free(dec);
+	
+	return check == 0;
+}
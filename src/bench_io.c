@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "urest.h"
+
+#define BUFLEN			1024
+#define BENCH_PORT		4699
+#define UDP_TIMEOUT_USEC	500000			/* socket timeout (in usec) */
+#define ASYNC_CALLS		64			/* transactions in flight per async client */
+
+/*
+ * transport benchmark: a responder with a trivial handler is driven by the plain
+ * recvfrom() driver, the epoll event loop or io_uring, while client threads run
+ * closed-loop GET transactions against it.
+ */
+
+struct socket_ctx_s {
+	struct sockaddr_in si_me, si_other;
+	int s, slen, recv_len;
+	struct timeval tv;
+};
+
+struct bench_clnt_s {
+	pthread_t thread;
+	long transactions;
+	long errors;
+};
+	
+/* one transaction of an async client, submitted again as soon as it completes */
+struct bench_call_s {
+	struct bench_clnt_s *clnt;
+	struct initiator_s *initiator;
+	struct peer_s *peer;
+	char req[16];
+	char resp[BUFLEN];
+};
+	
+static volatile int running = 1;
+static int use_uring_client;
+static int use_async_client;
+
+
+void bench_get(void *arg)
+{
+	strcpy((char *)arg, "value:1");
+}
+
+/* the blocking recvfrom() / sendto() driver of the original demo server */
+void serv_packet_recv(void *arg, char *data, uint16_t *size)
+{
+	struct socket_ctx_s *sock = (struct socket_ctx_s *)arg;
+	
+	memset(data, 0, BUFLEN);
+	
+	if ((sock->recv_len = recvfrom(sock->s, data, BUFLEN, 0, (struct sockaddr *)&sock->si_other, (socklen_t *)&sock->slen)) == -1)
+		*size = 0;
+	else
+		*size = sock->recv_len;
+}
+
+void serv_packet_sendto(void *arg, struct peer_s *peer, char *data, uint16_t size)
+{
+	struct socket_ctx_s *sock = (struct socket_ctx_s *)arg;
+	
+	sendto(sock->s, data, size, 0, (struct sockaddr *)peer->addr, peer->len);
+}
+
+static void *serv_recvfrom(void *arg)
+{
+	struct resource_list_s *list = (struct resource_list_s *)arg;
+	struct serv_packet_s drv;
+	struct socket_ctx_s sock;
+	struct responder_s *responder;
+	struct peer_s peer;
+	char packet[BUFLEN];
+	uint16_t size;
+	
+	sock.tv.tv_sec = 0;
+	sock.tv.tv_usec = 100000;
+	sock.s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	setsockopt(sock.s, SOL_SOCKET, SO_RCVTIMEO, &sock.tv, sizeof(sock.tv));
+	sock.slen = sizeof(sock.si_other);
+	memset((char *)&sock.si_me, 0, sizeof(sock.si_me));
+	sock.si_me.sin_family = AF_INET;
+	sock.si_me.sin_port = htons(BENCH_PORT);
+	sock.si_me.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	
+	if (bind(sock.s, (struct sockaddr *)&sock.si_me, sizeof(sock.si_me)) == -1) {
+		printf("error binding to socket.\n");
+		exit(-1);
+	}
+	
+	memset(&drv, 0, sizeof(drv));
+	drv.packet_arg = &sock;
+	drv.packet = packet;
+	drv.packet_handler_sendto = serv_packet_sendto;
+	
+	responder = urest_responder(&drv, list, UREST_TRANSACTIONS);
+	
+	while (running) {
+		serv_packet_recv(&sock, packet, &size);
+	
+		if (size == 0) {
+			urest_expire(responder);
+	
+			continue;
+		}
+	
+		peer.link = sock.s;
+		peer.len = sock.slen;
+		memcpy(peer.addr, &sock.si_other, sock.slen);
+		urest_process_packet(responder, packet, size, &peer);
+	}
+	
+	close(sock.s);
+	
+	return 0;
+}
+
+static void *serv_epoll(void *arg)
+{
+	struct event_loop_s *loop;
+	
+	loop = urest_event_loop((struct resource_list_s *)arg, UREST_TRANSACTIONS);
+	
+	if (!loop || urest_event_listen(loop, "127.0.0.1", BENCH_PORT) < 0) {
+		printf("error creating event loop.\n");
+		exit(-1);
+	}
+	
+	urest_event_run(loop);
+	
+	return 0;
+}
+
+static void *serv_uring(void *arg)
+{
+	struct uring_loop_s *loop;
+	
+	loop = urest_uring_loop((struct resource_list_s *)arg, UREST_TRANSACTIONS);
+	
+	if (!loop || urest_uring_listen(loop, "127.0.0.1", BENCH_PORT) < 0) {
+		printf("error creating io_uring loop.\n");
+		exit(-1);
+	}
+	
+	urest_uring_run(loop);
+	
+	return 0;
+}
+
+void clnt_packet_handler(void *arg, char *data, uint16_t send_size, uint16_t *recv_size)
+{
+	struct socket_ctx_s *sock = (struct socket_ctx_s *)arg;
+	
+	sendto(sock->s, data, send_size, 0, (struct sockaddr *)&sock->si_other, sizeof(struct sockaddr_in));
+	memset(data, '\0', BUFLEN);
+	
+	if ((sock->recv_len = recvfrom(sock->s, data, BUFLEN, 0, (struct sockaddr *)&sock->si_other, (socklen_t *)&sock->slen)) == -1)
+		*recv_size = 0;
+	else
+		*recv_size = sock->recv_len;
+}
+
+static void bench_done(void *arg, int status)
+{
+	struct bench_call_s *call = (struct bench_call_s *)arg;
+	
+	if (status == 200)
+		call->clnt->transactions++;
+	else
+		call->clnt->errors++;
+	
+	if (running)
+		urest_submit(call->initiator, call->peer, FRAG_SIZE_128, GET, call->req, call->resp, BUFLEN, bench_done, call);
+}
+	
+/* a single thread keeps ASYNC_CALLS transactions in flight on one socket */
+static void *clnt_async_thread(void *arg)
+{
+	struct bench_clnt_s *clnt = (struct bench_clnt_s *)arg;
+	struct bench_call_s call[ASYNC_CALLS];
+	struct initiator_s *initiator;
+	struct peer_s peer;
+	int i, s;
+	
+	s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+	initiator = urest_initiator(s, ASYNC_CALLS);
+	
+	if (!initiator || urest_peer(&peer, s, "127.0.0.1", BENCH_PORT) < 0) {
+		printf("error creating initiator.\n");
+		exit(-1);
+	}
+	
+	for (i = 0; i < ASYNC_CALLS; i++) {
+		call[i].clnt = clnt;
+		call[i].initiator = initiator;
+		call[i].peer = &peer;
+		strcpy(call[i].req, "/bench");
+		urest_submit(initiator, &peer, FRAG_SIZE_128, GET, call[i].req, call[i].resp, BUFLEN, bench_done, &call[i]);
+	}
+	
+	/* calls still in flight are left behind, the server may be gone already */
+	while (running)
+		urest_initiator_poll(initiator, 100);
+	
+	close(s);
+	
+	return 0;
+}
+	
+void clnt_packet_timeout(void *arg, uint32_t timeout)
+{
+	struct socket_ctx_s *sock = (struct socket_ctx_s *)arg;
+	
+	sock->tv.tv_sec = timeout / 1000;
+	sock->tv.tv_usec = (timeout % 1000) * 1000;
+	setsockopt(sock->s, SOL_SOCKET, SO_RCVTIMEO, &sock->tv, sizeof(sock->tv));
+}
+	
+static void *clnt_thread(void *arg)
+{
+	struct bench_clnt_s *clnt = (struct bench_clnt_s *)arg;
+	struct clnt_packet_s drv;
+	struct socket_ctx_s sock;
+	struct server_s *server;
+	char req[BUFLEN], resp[BUFLEN], packet[UREST_PACKET_SIZE];
+	
+	sock.tv.tv_sec = 0;
+	sock.tv.tv_usec = UDP_TIMEOUT_USEC;
+	sock.s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	setsockopt(sock.s, SOL_SOCKET, SO_RCVTIMEO, &sock.tv, sizeof(sock.tv));
+	sock.slen = sizeof(sock.si_other);
+	memset((char *)&sock.si_other, 0, sizeof(sock.si_other));
+	sock.si_other.sin_family = AF_INET;
+	sock.si_other.sin_port = htons(BENCH_PORT);
+	sock.si_other.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	
+	memset(&drv, 0, sizeof(drv));
+	drv.packet_arg = &sock;
+	drv.packet = packet;
+	drv.packet_handler = clnt_packet_handler;
+	drv.packet_timeout = clnt_packet_timeout;
+	
+	if (use_uring_client && urest_uring_client(&drv, sizeof(packet), sock.s, &sock.si_other, sizeof(sock.si_other), UDP_TIMEOUT_USEC / 1000) < 0) {
+		printf("error creating io_uring client.\n");
+		exit(-1);
+	}
+	
+	server = urest_link(&drv, "127.0.0.1", BENCH_PORT, FRAG_SIZE_128);
+	
+	while (running) {
+		strcpy(req, "/bench");
+	
+		if (urest_get(server, req, resp, BUFLEN) == 200)
+			clnt->transactions++;
+		else
+			clnt->errors++;
+	}
+	
+	close(sock.s);
+	
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct resource_list_s *list;
+	struct resource_s *resource;
+	struct bench_clnt_s *clnt;
+	pthread_t serv;
+	long total = 0, errors = 0;
+	int i, clients = 4, seconds = 3;
+	
+	if (argc < 2) {
+		printf("Usage: %s <recvfrom|epoll|uring> [clients] [seconds] [sync|uring|async client]\n", argv[0]);
+	
+		return -1;
+	}
+	
+	if (argc > 2)
+		clients = atoi(argv[2]);
+	
+	if (argc > 3)
+		seconds = atoi(argv[3]);
+	
+	if (argc > 4) {
+		use_uring_client = strcmp(argv[4], "uring") == 0;
+		use_async_client = strcmp(argv[4], "async") == 0;
+	}
+	
+	list = urest_resource_list();
+	resource = urest_resource_endpoint("bench", "/bench");
+	urest_resource_handler(resource, bench_get, GET);
+	urest_register_resource(list, resource);
+	
+	if (strcmp(argv[1], "recvfrom") == 0)
+		pthread_create(&serv, 0, serv_recvfrom, list);
+	else if (strcmp(argv[1], "epoll") == 0)
+		pthread_create(&serv, 0, serv_epoll, list);
+	else if (strcmp(argv[1], "uring") == 0)
+		pthread_create(&serv, 0, serv_uring, list);
+	else {
+		printf("unknown driver %s\n", argv[1]);
+	
+		return -1;
+	}
+	
+	usleep(100000);
+	
+	clnt = calloc(clients, sizeof(struct bench_clnt_s));
+	
+	for (i = 0; i < clients; i++)
+		pthread_create(&clnt[i].thread, 0, use_async_client ? clnt_async_thread : clnt_thread, &clnt[i]);
+	
+	sleep(seconds);
+	running = 0;
+	
+	for (i = 0; i < clients; i++) {
+		pthread_join(clnt[i].thread, 0);
+		total += clnt[i].transactions;
+		errors += clnt[i].errors;
+	}
+	
+	printf("%-8s clients %d: %ld transactions/s (%ld errors)\n", argv[1], clients, total / seconds, errors);
+	
+	/* the server thread may sit in a blocking wait, just leave */
+	return 0;
+}
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include "urest.h"
+
+#define BENCH_TIME		0.2			/* seconds per case */
+#define BENCH_TIMEOUT		500			/* ACK wait before an RTT sample (in ms) */
+
+/*
+ * hot path benchmark over the in-memory transport: no sockets and no sleeps, so
+ * what is measured is the library (fragmenting, reassembly, routing, handlers
+ * and the ACKs). transactions/s and the cost per datagram (both ways) for each
+ * fragment size and payload length, then for routers of a few sizes. the
+ * responder runs inline in the initiator thread, or on a thread of its own.
+ * loss, reordering and delay can be injected.
+ */
+
+struct bench_end_s {
+	struct loopback_s *lb;
+	struct responder_s *responder;
+	struct serv_packet_s serv;
+	struct clnt_packet_s clnt;
+	char packet[UREST_PACKET_SIZE];
+	pthread_t thread;
+	int running;
+};
+
+static int threaded;
+static uint16_t loss, reorder;
+static uint32_t delay;
+
+
+void bench_echo(void *arg)
+{
+	/* the request is left as the response */
+}
+
+void bench_get(void *arg)
+{
+	strcpy((char *)arg, "value:1");
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *serve(void *arg)
+{
+	struct bench_end_s *end = (struct bench_end_s *)arg;
+	
+	/* polled, the initiator thread spins for its ACKs too */
+	while (__atomic_load_n(&end->running, __ATOMIC_RELAXED))
+		if (!urest_loopback_poll(end->lb, end->responder))
+			sched_yield();
+	
+	return 0;
+}
+
+/* stop the responder thread if there is one, then free what end_new() built */
+static void end_free(struct bench_end_s *end)
+{
+	if (end->running) {
+		__atomic_store_n(&end->running, 0, __ATOMIC_RELAXED);
+		pthread_join(end->thread, 0);
+	}
+	
+	if (end->responder)
+		urest_responder_free(end->responder);
+	
+	if (end->lb)
+		urest_loopback_free(end->lb);
+	
+	free(end);
+}
+
+/* an initiator and a responder serving list, joined by a loopback */
+static struct bench_end_s *end_new(struct resource_list_s *list)
+{
+	struct bench_end_s *end;
+	
+	end = calloc(1, sizeof(struct bench_end_s));
+	
+	if (!end)
+		return 0;
+	
+	end->lb = urest_loopback();
+	
+	if (!end->lb) {
+		end_free(end);
+	
+		return 0;
+	}
+	
+	urest_loopback_faults(end->lb, loss, reorder, delay);
+	urest_loopback_server(&end->serv, end->lb);
+	end->responder = urest_responder(&end->serv, list, UREST_TRANSACTIONS);
+	
+	if (!end->responder || urest_loopback_client(&end->clnt, end->lb, BENCH_TIMEOUT) < 0) {
+		end_free(end);
+	
+		return 0;
+	}
+	
+	end->clnt.packet = end->packet;
+	
+	if (!threaded) {
+		urest_loopback_inline(end->lb, end->responder);
+	
+		return end;
+	}
+	
+	end->running = 1;
+	
+	if (pthread_create(&end->thread, 0, serve, end)) {
+		end->running = 0;
+		end_free(end);
+	
+		return 0;
+	}
+	
+	return end;
+}
+
+static uint32_t datagrams(struct bench_end_s *end)
+{
+	return end->lb->ring[0].sent + end->lb->ring[1].sent;
+}
+
+/* PUTs of len bytes echoed back, in frag_size fragments */
+static void bench_frag(struct bench_end_s *end, uint8_t frag_size, uint16_t len)
+{
+	struct server_s *server;
+	static char req[UREST_REQ_BUF_SIZE], resp[UREST_REQ_BUF_SIZE], payload[UREST_REQ_BUF_SIZE];
+	uint32_t sent, transactions = 0, errors = 0, i;
+	double t, elapsed;
+	
+	server = urest_link(&end->clnt, "loopback", 0, frag_size);
+	
+	if (!server)
+		return;
+	
+	i = sprintf(payload, "/bench?value:");
+	memset(payload + i, 'x', len - i);
+	payload[len] = '\0';
+	
+	sent = datagrams(end);
+	t = now();
+	
+	do {
+		for (i = 0; i < 16; i++) {
+			memcpy(req, payload, len + 1);
+	
+			if (urest_put(server, req, resp, sizeof(resp)) == 200)
+				transactions++;
+			else
+				errors++;
+		}
+	
+		elapsed = now() - t;
+	} while (elapsed < BENCH_TIME);
+	
+	sent = datagrams(end) - sent;
+	printf("%8u %8u %12.0f %10.1f %10.0f %8u\n", 8 << frag_size, len, transactions / elapsed,
+		transactions ? (double)sent / transactions : 0, sent ? elapsed * 1e9 / sent : 0, errors);
+	urest_unlink(server);
+}
+
+/* GETs spread over a router of size resources */
+static void bench_router(uint32_t size)
+{
+	struct resource_list_s *list;
+	struct resource_s *resource;
+	struct bench_end_s *end;
+	struct server_s *server;
+	char uri[32], req[64], resp[64];
+	uint32_t transactions = 0, errors = 0, i;
+	double t, elapsed;
+	
+	list = urest_resource_list();
+	
+	if (!list)
+		return;
+	
+	for (i = 0; i < size; i++) {
+		sprintf(uri, "/bench/r%u", i);
+		resource = urest_resource_endpoint("bench", uri);
+		urest_resource_handler(resource, bench_get, GET);
+		urest_register_resource(list, resource);
+	}
+	
+	end = end_new(list);
+	server = end ? urest_link(&end->clnt, "loopback", 0, FRAG_SIZE_1024) : 0;
+	
+	if (!server) {
+		printf("error creating loopback.\n");
+	
+		if (end)
+			end_free(end);
+	
+		urest_resource_list_free(list);
+	
+		return;
+	}
+	
+	t = now();
+	
+	do {
+		for (i = 0; i < 16; i++) {
+			sprintf(req, "/bench/r%u", (transactions + errors) * 7919 % size);
+	
+			if (urest_get(server, req, resp, sizeof(resp)) == 200)
+				transactions++;
+			else
+				errors++;
+		}
+	
+		elapsed = now() - t;
+	} while (elapsed < BENCH_TIME);
+	
+	printf("%8u %12.0f %10.0f %8u\n", size, transactions / elapsed, transactions ? elapsed * 1e9 / transactions : 0, errors);
+	urest_unlink(server);
+	end_free(end);
+	urest_resource_list_free(list);
+}
+
+int main(int argc, char **argv)
+{
+	struct resource_list_s *list;
+	struct resource_s *resource;
+	struct bench_end_s *end;
+	uint16_t lengths[] = {16, 256, 1024, 3000};
+	uint32_t routers[] = {1, 16, 256, 4096};
+	uint8_t frag_size;
+	uint32_t i;
+	
+	if (argc > 1 && strcmp(argv[1], "inline") && strcmp(argv[1], "thread")) {
+		printf("Usage: %s [inline|thread] [loss] [reorder] [delay]\n", argv[0]);
+		printf("loss and reorder in per mille of the datagrams, delay in us\n");
+	
+		return -1;
+	}
+	
+	threaded = argc > 1 && !strcmp(argv[1], "thread");
+	loss = argc > 2 ? atoi(argv[2]) : 0;
+	reorder = argc > 3 ? atoi(argv[3]) : 0;
+	delay = argc > 4 ? atoi(argv[4]) : 0;
+	
+	list = urest_resource_list();
+	resource = urest_resource_endpoint("bench", "/bench");
+	urest_resource_handler(resource, bench_echo, PUT);
+	urest_register_resource(list, resource);
+	end = end_new(list);
+	
+	if (!end) {
+		printf("error creating loopback.\n");
+		urest_resource_list_free(list);
+	
+		return -1;
+	}
+	
+	printf("%8s %8s %12s %10s %10s %8s\n", "frag", "bytes", "trans/s", "dgrams/tr", "ns/dgram", "errors");
+	
+	for (frag_size = FRAG_SIZE_16; frag_size <= FRAG_SIZE_1024; frag_size++)
+		for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+			bench_frag(end, frag_size, lengths[i]);
+	
+	end_free(end);
+	urest_resource_list_free(list);
+	
+	printf("\n%8s %12s %10s %8s\n", "routes", "trans/s", "ns/trans", "errors");
+	
+	for (i = 0; i < sizeof(routers) / sizeof(routers[0]); i++)
+		bench_router(routers[i]);
+	
+	return 0;
+}
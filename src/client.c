@@ -10,6 +10,9 @@
 #define UDP_TIMEOUT_SEC		0			/* socket timeout (in sec) */
 #define UDP_TIMEOUT_USEC	500000			/* socket timeout (in usec) */
 
+/* the uris and keys of the lights, shared with the server to pack payloads */
+#define DICTIONARY		"/lights/light1/lights/light2/lights/light3/lights/scene?value:on:off:status:updated:"
+
 struct socket_ctx_s {
 	struct sockaddr_in si_other;
 	int s, slen, recv_len;
@@ -24,9 +27,9 @@ void clnt_packet_handler(void *arg, char *data, uint16_t send_size, uint16_t *re
 	if (sendto(sock->s, data, send_size, 0, (struct sockaddr *)&sock->si_other, sizeof(struct sockaddr_in)) == -1)
 		printf("error sending data.\n");
 
-	memset(data,'\0', BUFLEN);
+	memset(data,'\0', UREST_PACKET_SIZE);
 	/* try to receive some data, this is a blocking call (with timeout!) */
-	if ((sock->recv_len = recvfrom(sock->s, data, BUFLEN, 0, (struct sockaddr *)&sock->si_other, (socklen_t *)&sock->slen)) == -1) {
+	if ((sock->recv_len = recvfrom(sock->s, data, UREST_PACKET_SIZE, 0, (struct sockaddr *)&sock->si_other, (socklen_t *)&sock->slen)) == -1) {
 		*recv_size = 0;
 		
 		return;
@@ -35,11 +38,42 @@ void clnt_packet_handler(void *arg, char *data, uint16_t send_size, uint16_t *re
 	}
 }
 
+/* windowed transfers send and receive on their own */
+void clnt_packet_send(void *arg, char *data, uint16_t size)
+{
+	struct socket_ctx_s *sock = (struct socket_ctx_s *)arg;
+	
+	if (sendto(sock->s, data, size, 0, (struct sockaddr *)&sock->si_other, sizeof(struct sockaddr_in)) == -1)
+		printf("error sending data.\n");
+}
+	
+void clnt_packet_recv(void *arg, char *data, uint16_t *size)
+{
+	struct socket_ctx_s *sock = (struct socket_ctx_s *)arg;
+	
+	if ((sock->recv_len = recvfrom(sock->s, data, UREST_PACKET_SIZE, 0, (struct sockaddr *)&sock->si_other, (socklen_t *)&sock->slen)) == -1)
+		*size = 0;
+	else
+		*size = sock->recv_len;
+}
+	
+/* the library picks the ACK wait from the RTT it measures */
+void clnt_packet_timeout(void *arg, uint32_t timeout)
+{
+	struct socket_ctx_s *sock = (struct socket_ctx_s *)arg;
+	
+	sock->tv.tv_sec = timeout / 1000;
+	sock->tv.tv_usec = (timeout % 1000) * 1000;
+	setsockopt(sock->s, SOL_SOCKET, SO_RCVTIMEO, &sock->tv, sizeof(sock->tv));
+}
+	
 int main(int argc, char **argv)
 {
 	struct socket_ctx_s sock;
 	char req[BUFLEN], resp[BUFLEN];
-	char packet[BUFLEN];
+	char packet[UREST_PACKET_SIZE];
+	struct dict_s dict;
+	uint16_t len, size, i;
 	int err;
 	
 	if (argc != 3) {
@@ -79,11 +113,32 @@ int main(int argc, char **argv)
 	socket.packet_arg = &sock;
 	socket.packet = packet;
 	socket.packet_handler = clnt_packet_handler;
+	socket.packet_send = clnt_packet_send;
+	socket.packet_recv = clnt_packet_recv;
+	socket.packet_timeout = clnt_packet_timeout;
 	
-	struct server_s *server1, *server2;
+	struct server_s *server1, *server2, *server3, *server4;
 	
 	server1 = urest_link(&socket, argv[1], atoi(argv[2]), FRAG_SIZE_128);
 	server2 = urest_link(&socket, argv[1], atoi(argv[2]), FRAG_SIZE_32);
+	server3 = urest_link(&socket, argv[1], atoi(argv[2]), FRAG_SIZE_64);
+	server4 = urest_link(&socket, argv[1], atoi(argv[2]), FRAG_SIZE_32);
+	
+	/* uREST encoded requests */
+	urest_content(server3, UREST_ENC);
+	
+	/* JSON requests, the uri goes in the document */
+	urest_content(server4, JSON_ENC);
+	
+	/* requests of 16 bytes and more packed, with the dictionary of the server */
+	urest_dict(&dict, DICTIONARY, strlen(DICTIONARY));
+	urest_compress(server1, &dict, 16);
+	
+	/* fragments grow while none are lost, up to jumbo ones on a LAN */
+	urest_adapt(server1, 64, UREST_PACKET_SIZE);
+	
+	/* small fragments, keep several in flight */
+	urest_window(server2, 8);
  
 	while (1) {
 		strcpy(req, "/lights/light1");
@@ -93,13 +148,21 @@ int main(int argc, char **argv)
 		}
 		sleep(1);
 		
-		strcpy(req, "/lights/light1");
+		strcpy(req, "/lights/light1?value:on");
 		err = urest_put(server1, req, resp, BUFLEN);
 		if (err) {
 			printf("status: %d, resp: %s\n", err, resp);
 		}
 		sleep(1);
-		
+	
+		/* packed, and polled while the slow sensor is read */
+		strcpy(req, "/lights/light2?value:packed");
+		err = urest_get(server1, req, resp, BUFLEN);
+		if (err) {
+			printf("status: %d, resp: %s\n", err, resp);
+		}
+		sleep(1);
+	
 		strcpy(req, "/lights/light2?value:1");
 		err = urest_get(server2, req, resp, BUFLEN);
 		if (err) {
@@ -120,6 +183,50 @@ int main(int argc, char **argv)
 			printf("status: %d, resp: %s\n", err, resp);
 		}
 		sleep(1);
+	
+		strcpy(req, "/lights/light3?{i:1,f:0.75,s:{warm white}}");
+		err = urest_put(server3, req, resp, BUFLEN);
+		if (err) {
+			printf("status: %d, resp: %s\n", err, resp);
+		}
+		sleep(1);
+	
+		strcpy(req, "{\"on\":true,\"uri\":\"/lights/light3\",\"level\":0.5,\"color\":\"amber\"}");
+		err = urest_put(server4, req, resp, BUFLEN);
+		if (err) {
+			printf("status: %d, resp: %s\n", err, resp);
+		}
+		sleep(1);
+	
+		/* raw levels, zeros among them, sent with their length */
+		len = sprintf(req, "/lights/scene?");
+		for (i = 0; i < 28; i++)
+			req[len++] = i * 9;
+		size = BUFLEN;
+		err = urest_binary(server2, PUT, req, len, resp, &size);
+		if (err) {
+			printf("status: %d, resp: %d bytes, last %d\n", err, size, (uint8_t)resp[size - 1]);
+		}
+		sleep(1);
+	
+		/* the slow sensor answers binary requests after its 2.02 polls too */
+		len = sprintf(req, "/lights/light2?");
+		for (i = 0; i < 12; i++)
+			req[len++] = 1 + i * 3;
+		size = BUFLEN;
+		err = urest_binary(server3, GET, req, len, resp, &size);
+		if (err) {
+			printf("status: %d, resp: %d bytes, last %d\n", err, size, size ? (uint8_t)resp[size - 1] : -1);
+		}
+		sleep(1);
+	
+		/* metrics of the server */
+		strcpy(req, UREST_STATS_URI);
+		err = urest_get(server3, req, resp, BUFLEN);
+		if (err) {
+			printf("status: %d, resp: %s\n", err, resp);
+		}
+		sleep(1);
 	}
 
 	close(sock.s);
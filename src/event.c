@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include "urest.h"
+
+
+static void event_sendto(void *arg, struct peer_s *peer, char *data, uint16_t size)
+{
+	sendto(peer->link, data, size, 0, (struct sockaddr *)peer->addr, peer->len);
+}
+
+static int event_send_batch(void *arg, struct datagram_s *dgram, int count)
+{
+	return urest_udp_send_batch(dgram, count);
+}
+
+/* drain a listening socket, a batch of datagrams per syscall */
+static void event_recv(void *arg, int fd, uint32_t events)
+{
+	struct event_loop_s *loop = (struct event_loop_s *)arg;
+	int n;
+	
+	do {
+		n = urest_udp_recv_batch(fd, loop->dgram, UREST_BATCH);
+		
+		if (n > 0)
+			urest_process_batch(loop->responder, loop->dgram, n);
+	} while (n == UREST_BATCH);
+}
+
+struct event_loop_s *urest_event_loop(struct resource_list_s *resource_list, uint16_t transactions)
+{
+	struct event_loop_s *loop;
+	int i;
+	
+	loop = malloc(sizeof(struct event_loop_s));
+	
+	if (!loop)
+		return 0;
+	
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	
+	if (loop->epfd < 0) {
+		free(loop);
+	
+		return 0;
+	}
+	
+	loop->packet_drv.packet_arg = loop;
+	loop->packet_drv.packet = 0;
+	loop->packet_drv.packet_handler_recv = 0;
+	loop->packet_drv.packet_handler_send = 0;
+	loop->packet_drv.packet_handler_sendto = event_sendto;
+	loop->packet_drv.packet_handler_recv_batch = 0;
+	loop->packet_drv.packet_handler_send_batch = event_send_batch;
+	
+	loop->responder = urest_responder(&loop->packet_drv, resource_list, transactions);
+	
+	if (!loop->responder) {
+		close(loop->epfd);
+		free(loop);
+	
+		return 0;
+	}
+	
+	/* datagrams are received straight into slabs, see urest_process_batch() */
+	for (i = 0; i < UREST_BATCH; i++)
+		loop->dgram[i].data = urest_pool_get(loop->responder->pool);
+	
+	loop->fds = 0;
+	loop->running = 0;
+	
+	return loop;
+}
+
+/*
+ * create a non-blocking UDP socket bound to ip:port (any address if ip is null)
+ * and serve uREST requests on it. returns the socket or -1 on failure.
+ */
+int urest_event_listen(struct event_loop_s *loop, char *ip, uint16_t port)
+{
+	struct sockaddr_in addr;
+	int s;
+	
+	memset((char *)&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	
+	if (ip && inet_aton(ip, &addr.sin_addr) == 0)
+		return -1;
+	
+	s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+	
+	if (s < 0)
+		return -1;
+	
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(s);
+	
+		return -1;
+	}
+	
+	if (urest_event_attach(loop, s) < 0) {
+		close(s);
+	
+		return -1;
+	}
+	
+	return s;
+}
+
+/* serve uREST requests on an already bound, non-blocking datagram socket */
+int urest_event_attach(struct event_loop_s *loop, int s)
+{
+	return urest_event_add(loop, s, EPOLLIN, event_recv, loop);
+}
+
+/* watch an application fd, handler is called with (arg, fd, epoll events) */
+int urest_event_add(struct event_loop_s *loop, int fd, uint32_t events, void (*handler)(void *, int, uint32_t), void *arg)
+{
+	struct event_fd_s *efd;
+	struct epoll_event ev;
+	
+	efd = malloc(sizeof(struct event_fd_s));
+	
+	if (!efd)
+		return -1;
+	
+	efd->fd = fd;
+	efd->handler = handler;
+	efd->arg = arg;
+	
+	ev.events = events;
+	ev.data.ptr = efd;
+	
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		free(efd);
+	
+		return -1;
+	}
+	
+	efd->next = loop->fds;
+	loop->fds = efd;
+	
+	return 0;
+}
+
+int urest_event_del(struct event_loop_s *loop, int fd)
+{
+	struct event_fd_s **node = &loop->fds, *efd;
+	
+	while (*node) {
+		if ((*node)->fd == fd) {
+			efd = *node;
+			*node = efd->next;
+			epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, 0);
+			free(efd);
+	
+			return 0;
+		}
+	
+		node = &(*node)->next;
+	}
+	
+	return -1;
+}
+
+int urest_event_run(struct event_loop_s *loop)
+{
+	struct epoll_event events[UREST_EVENTS];
+	struct event_fd_s *efd;
+	int i, n;
+	
+	loop->running = 1;
+	
+	/* epoll_wait() only times out when a transaction may have expired */
+	while (__atomic_load_n(&loop->running, __ATOMIC_RELAXED)) {
+		n = epoll_wait(loop->epfd, events, UREST_EVENTS, urest_timeout(loop->responder));
+	
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+	
+			return -1;
+		}
+	
+		for (i = 0; i < n; i++) {
+			efd = (struct event_fd_s *)events[i].data.ptr;
+			efd->handler(efd->arg, efd->fd, events[i].events);
+		}
+	}
+	
+	return 0;
+}
+
+void urest_event_stop(struct event_loop_s *loop)
+{
+	__atomic_store_n(&loop->running, 0, __ATOMIC_RELAXED);
+}
+
+/* free a loop that is not running, the fds it watched are left open */
+void urest_event_free(struct event_loop_s *loop)
+{
+	struct event_fd_s *efd;
+	
+	while ((efd = loop->fds)) {
+		loop->fds = efd->next;
+		free(efd);
+	}
+	
+	close(loop->epfd);
+	urest_responder_free(loop->responder);
+	free(loop);
+}
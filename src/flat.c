@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "urest.h"
+
+
+/*
+ * flat encoding (type 3): key:value:key:value, with '\' escaping the delimiter
+ * (and itself). fields are returned as views into the body, their escapes are
+ * only decoded when a field is compared or copied out. nothing is allocated.
+ */
+
+/* the end of the field starting at p, the first ':' not escaped */
+static char *field_end(char *p, char *end)
+{
+	char *colon, *q;
+	
+	while ((colon = memchr(p, ':', end - p))) {
+		/* escaped by an odd run of backslashes */
+		for (q = colon; q > p && q[-1] == '\\'; q--);
+	
+		if (((colon - q) & 1) == 0)
+			return colon;
+	
+		p = colon + 1;
+	}
+	
+	return end;
+}
+
+static char *field_next(char *p, char *end, struct flat_field_s *field)
+{
+	char *e = field_end(p, end);
+	
+	field->data = p;
+	field->len = e - p;
+	field->escaped = memchr(p, '\\', e - p) != 0;
+	
+	return e < end ? e + 1 : e;
+}
+
+/*
+ * start tokenizing len bytes of data. a request as handlers get it (with the
+ * uri) is taken from the '?' on, and a leading delimiter is skipped.
+ */
+void urest_flat(struct flat_s *flat, char *data, uint16_t len)
+{
+	char *query;
+	
+	flat->p = data;
+	flat->end = data + len;
+	
+	if (len && *data == '/') {
+		query = memchr(data, '?', len);
+		flat->p = query ? query + 1 : flat->end;
+	}
+	
+	if (flat->p < flat->end && *flat->p == ':')
+		flat->p++;
+}
+
+/* the next pair (a key without a value gets an empty one). returns 0 at the end */
+int urest_flat_next(struct flat_s *flat, struct flat_field_s *key, struct flat_field_s *value)
+{
+	if (flat->p >= flat->end)
+		return 0;
+	
+	flat->p = field_next(flat->p, flat->end, key);
+	flat->p = field_next(flat->p, flat->end, value);
+	
+	return 1;
+}
+
+/* 1 if the field, unescaped, is s */
+int urest_flat_match(struct flat_field_s *field, char *s)
+{
+	uint16_t i;
+	
+	if (!field->escaped)
+		return strlen(s) == field->len && memcmp(field->data, s, field->len) == 0;
+	
+	for (i = 0; i < field->len; i++, s++) {
+		if (field->data[i] == '\\' && i + 1 < field->len)
+			i++;
+	
+		if (*s != field->data[i])
+			return 0;
+	}
+	
+	return *s == '\0';
+}
+
+/* copy the field unescaped into out (null terminated). returns its length, or -1 if it does not fit */
+int urest_flat_copy(struct flat_field_s *field, char *out, uint16_t size)
+{
+	uint16_t i, len = 0;
+	
+	if (!field->escaped) {
+		if (field->len >= size)
+			return -1;
+	
+		memcpy(out, field->data, field->len);
+		out[field->len] = '\0';
+	
+		return field->len;
+	}
+	
+	for (i = 0; i < field->len; i++) {
+		if (field->data[i] == '\\' && i + 1 < field->len)
+			i++;
+	
+		if (len + 1 >= size)
+			return -1;
+	
+		out[len++] = field->data[i];
+	}
+	
+	out[len] = '\0';
+	
+	return len;
+}
+
+/*
+ * copy the value of key in a request or body (null terminated) into value.
+ * returns its length, or -1 if there is no such key or the value does not fit.
+ */
+int urest_flat_get(char *data, char *key, char *value, uint16_t size)
+{
+	struct flat_s flat;
+	struct flat_field_s k, v;
+	
+	urest_flat(&flat, data, strnlen(data, UREST_REQ_BUF_SIZE));
+	
+	while (urest_flat_next(&flat, &k, &v))
+		if (urest_flat_match(&k, key))
+			return urest_flat_copy(&v, value, size);
+	
+	return -1;
+}
+
+/*
+ * write pairs into a buffer of size bytes, kept null terminated. a handler may
+ * write its response over the request, once it is done reading the request.
+ */
+void urest_flat_writer(struct flat_writer_s *writer, char *buf, uint16_t size)
+{
+	writer->buf = buf;
+	writer->size = size;
+	writer->len = 0;
+	
+	if (size)
+		buf[0] = '\0';
+}
+
+static int put_char(struct flat_writer_s *writer, char c)
+{
+	if (writer->len + 1 >= writer->size)
+		return -1;
+	
+	writer->buf[writer->len++] = c;
+	
+	return 0;
+}
+
+static int put_field(struct flat_writer_s *writer, char *s)
+{
+	for (; *s; s++)
+		if (((*s == ':' || *s == '\\') && put_char(writer, '\\') < 0) || put_char(writer, *s) < 0)
+			return -1;
+	
+	return 0;
+}
+
+/* append a pair, escaped. returns -1 (and leaves the buffer as it was) if it does not fit */
+int urest_flat_put(struct flat_writer_s *writer, char *key, char *value)
+{
+	uint16_t len = writer->len;
+	
+	if ((len && put_char(writer, ':') < 0) || put_field(writer, key) < 0 || put_char(writer, ':') < 0 || put_field(writer, value) < 0) {
+		writer->len = len;
+	
+		if (writer->size)
+			writer->buf[len] = '\0';
+	
+		return -1;
+	}
+	
+	writer->buf[writer->len] = '\0';
+	
+	return 0;
+}
+
+int urest_flat_put_int(struct flat_writer_s *writer, char *key, long value)
+{
+	char num[24];
+	
+	snprintf(num, sizeof(num), "%ld", value);
+	
+	return urest_flat_put(writer, key, num);
+}
@@ -0,0 +1,701 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "urest.h"
+
+
+/*
+ * an initiator runs many transactions (calls) on one non-blocking socket. ACKs
+ * are matched to calls by (peer, token). a call has no token until its first
+ * fragment is acknowledged, so only one call per peer may be waiting for one,
+ * the others to the same peer are queued behind it.
+ */
+struct initiator_s *urest_initiator(int s, uint16_t calls)
+{
+	struct initiator_s *initiator;
+	char *buf;
+	uint16_t i;
+	uint32_t buckets;
+	
+	if (calls == 0)
+		return 0;
+	
+	initiator = malloc(sizeof(struct initiator_s));
+	
+	if (!initiator)
+		return 0;
+	
+	for (buckets = 1; buckets < 2 * (uint32_t)calls && buckets < 32768; buckets <<= 1);
+	
+	initiator->call = malloc(calls * sizeof(struct call_s));
+	initiator->free_slot = malloc(calls * sizeof(uint16_t));
+	initiator->bucket = calloc(buckets, sizeof(uint16_t));
+	initiator->rtt = calloc(buckets, sizeof(struct peer_rtt_s));
+	initiator->observe = malloc(calls * sizeof(struct observe_s));
+	buf = malloc(UREST_BATCH * UREST_PACKET_SIZE);
+	
+	if (!initiator->call || !initiator->free_slot || !initiator->bucket || !initiator->rtt || !initiator->observe || !buf) {
+		free(initiator->call);
+		free(initiator->free_slot);
+		free(initiator->bucket);
+		free(initiator->rtt);
+		free(initiator->observe);
+		free(buf);
+		free(initiator);
+		
+		return 0;
+	}
+	
+	for (i = 0; i < calls; i++) {
+		initiator->call[i].state = CALL_FREE;
+		initiator->call[i].timer.next = 0;
+		initiator->free_slot[i] = calls - i - 1;
+		initiator->observe[i].uri = 0;
+		initiator->observe[i].timer.next = 0;
+	}
+	
+	for (i = 0; i < UREST_BATCH; i++)
+		initiator->in[i].data = buf + i * UREST_PACKET_SIZE;
+	
+	initiator->s = s;
+	initiator->calls = calls;
+	initiator->active = 0;
+	initiator->mask = buckets - 1;
+	initiator->completed = 0;
+	initiator->out_count = 0;
+	urest_wheel_init(&initiator->wheel, urest_clock());
+	
+	return initiator;
+}
+
+/* fill in an IPv4 peer reached through socket s, returns 0 or -1 */
+int urest_peer(struct peer_s *peer, int s, char *ip, uint16_t port)
+{
+	struct sockaddr_in addr;
+	
+	memset((char *)&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	
+	if (inet_aton(ip, &addr.sin_addr) == 0)
+		return -1;
+	
+	peer->link = s;
+	peer->len = sizeof(addr);
+	memset(peer->addr, 0, UREST_PEER_SIZE);
+	memcpy(peer->addr, &addr, sizeof(addr));
+	
+	return 0;
+}
+
+static uint32_t peer_hash(struct peer_s *peer)
+{
+	uint32_t hash = 2166136261u;
+	uint8_t i;
+	
+	for (i = 0; i < peer->len; i++)
+		hash = (hash ^ peer->addr[i]) * 16777619;
+	
+	return hash;
+}
+	
+static uint16_t *bucket(struct initiator_s *initiator, struct peer_s *peer, uint16_t tkn)
+{
+	uint32_t hash = (peer_hash(peer) ^ tkn) * 16777619;
+	
+	return &initiator->bucket[(hash ^ (hash >> 16)) & initiator->mask];
+}
+	
+/* the RTT estimate of a peer, a peer taking the entry of another one starts over */
+static struct rtt_s *peer_rtt(struct initiator_s *initiator, struct peer_s *peer)
+{
+	uint32_t hash = peer_hash(peer);
+	struct peer_rtt_s *entry = &initiator->rtt[(hash ^ (hash >> 16)) & initiator->mask];
+	
+	if (entry->peer.len != peer->len || memcmp(entry->peer.addr, peer->addr, peer->len) != 0) {
+		entry->peer = *peer;
+		urest_rtt_init(&entry->rtt);
+	}
+	
+	return &entry->rtt;
+}
+
+static struct call_s *call_find(struct initiator_s *initiator, struct peer_s *peer, uint16_t tkn)
+{
+	struct call_s *call;
+	uint16_t slot;
+	
+	for (slot = *bucket(initiator, peer, tkn); slot; slot = call->next) {
+		call = &initiator->call[slot - 1];
+	
+		if (call->tkn == tkn && call->peer.len == peer->len && memcmp(call->peer.addr, peer->addr, peer->len) == 0)
+			return call;
+	}
+	
+	return 0;
+}
+
+static void call_insert(struct initiator_s *initiator, struct call_s *call)
+{
+	uint16_t *head = bucket(initiator, &call->peer, call->tkn);
+	
+	call->next = *head;
+	*head = call - initiator->call + 1;
+}
+
+static void call_remove(struct initiator_s *initiator, struct call_s *call)
+{
+	uint16_t *node = bucket(initiator, &call->peer, call->tkn);
+	uint16_t slot = call - initiator->call + 1;
+	
+	while (*node && *node != slot)
+		node = &initiator->call[*node - 1].next;
+	
+	if (*node)
+		*node = call->next;
+}
+
+static void flush(struct initiator_s *initiator)
+{
+	if (initiator->out_count)
+		urest_udp_send_batch(initiator->out, initiator->out_count);
+	
+	initiator->out_count = 0;
+}
+
+/* queue the fragment in flight, the request payload is gathered from the application buffer */
+static void call_send(struct initiator_s *initiator, struct call_s *call)
+{
+	struct datagram_s *dgram;
+	uint32_t offset;
+	uint16_t room;
+	
+	if (initiator->out_count == UREST_BATCH)
+		flush(initiator);
+	
+	call->header.tkn = call->tkn;
+	call->header.seq = htons(call->seq);
+	call->header.msg_type = call->seq == 0 && call->skew ? REQ | EXT : REQ;
+	
+	/* the options follow the header in the call */
+	dgram = &initiator->out[initiator->out_count++];
+	dgram->peer = call->peer;
+	dgram->data = (char *)&call->header;
+	dgram->size = sizeof(struct urest_s) + (call->seq == 0 ? call->skew : 0);
+	dgram->payload = 0;
+	dgram->payload_size = 0;
+	
+	if (call->state == CALL_SEND) {
+		offset = call->seq ? (uint32_t)call->seq * call->payload_size - call->skew : 0;
+		room = call->seq ? call->payload_size : call->payload_size - call->skew;
+		dgram->payload = call->data + offset;
+		dgram->payload_size = call->data_len - offset < room ? call->data_len - offset : room;
+	}
+	
+	/* the RTT is only sampled on fragments sent once */
+	call->sent = urest_clock();
+	urest_timer_set(&initiator->wheel, &call->timer, call->sent + urest_rtt_timeout(peer_rtt(initiator, &call->peer), call->retries));
+}
+
+/* the first call queued for the peer asks for its token */
+static void call_open(struct initiator_s *initiator, struct call_s *call)
+{
+	call->state = CALL_SEND;
+	call_insert(initiator, call);
+	call_send(initiator, call);
+}
+
+/*
+ * a GET renewing an observation is over. with a lease granted UNS messages with
+ * the new token are taken from now on, the next renewal is due in half a lease
+ * (granted or not, the value is polled then).
+ */
+static void observe_renewed(struct initiator_s *initiator, struct observe_s *observe, int status, uint16_t tkn, uint16_t lease, uint16_t len)
+{
+	observe->call = 0;
+	
+	if (status == SUCCESS * 100 + OK && lease) {
+		if (tkn != observe->tkn)
+			observe->seq = 0;
+	
+		observe->tkn = tkn;
+	} else {
+		observe->tkn = 0;
+		lease = observe->lease;
+	}
+	
+	urest_timer_set(&initiator->wheel, &observe->timer, urest_clock() + lease * 500);
+	observe->notify(observe->arg, status, observe->value, len);
+}
+	
+static void call_finish(struct initiator_s *initiator, struct call_s *call, int status)
+{
+	void (*done)(void *, int) = call->done;
+	void *arg = call->arg;
+	struct observe_s *observe = call->observe ? &initiator->observe[call->observe - 1] : 0;
+	uint16_t tkn = call->tkn, lease = call->lease, len = call->resp_len;
+	
+	/* the next call to the peer may ask for a token now */
+	if (call->tkn == 0 && call->wait)
+		call_open(initiator, &initiator->call[call->wait - 1]);
+	
+	call_remove(initiator, call);
+	urest_timer_cancel(&initiator->wheel, &call->timer);
+	call->state = CALL_FREE;
+	initiator->free_slot[initiator->calls - initiator->active] = call - initiator->call;
+	initiator->active--;
+	initiator->completed++;
+	
+	if (observe)
+		observe_renewed(initiator, observe, status, tkn, lease, len);
+	else if (done)
+		done(arg, status);
+}
+
+/* take a free call, null if all are in use */
+static struct call_s *call_new(struct initiator_s *initiator, struct peer_s *peer, uint8_t frag_size, uint8_t method, char *data, char *response, uint16_t buflen, void (*done)(void *, int), void *arg)
+{
+	struct call_s *call;
+	
+	if (initiator->active == initiator->calls || buflen == 0)
+		return 0;
+	
+	call = &initiator->call[initiator->free_slot[initiator->calls - initiator->active - 1]];
+	
+	switch (frag_size) {
+	case FRAG_SIZE_16: call->payload_size = 16 - sizeof(struct urest_s); break;
+	case FRAG_SIZE_32: call->payload_size = 32 - sizeof(struct urest_s); break;
+	case FRAG_SIZE_64: call->payload_size = 64 - sizeof(struct urest_s); break;
+	case FRAG_SIZE_128: call->payload_size = 128 - sizeof(struct urest_s); break;
+	case FRAG_SIZE_256: call->payload_size = 256 - sizeof(struct urest_s); break;
+	case FRAG_SIZE_512: call->payload_size = 512 - sizeof(struct urest_s); break;
+	case FRAG_SIZE_1024: call->payload_size = 1024 - sizeof(struct urest_s); break;
+	default:
+		return 0;
+	}
+	
+	initiator->active++;
+	
+	call->peer = *peer;
+	call->header.frag_size = frag_size;
+	call->header.msg_type = REQ;
+	call->header.cnt_type = FLAT_ENC;
+	call->header.mtd_major = VERB;
+	call->header.mtd_minor = method;
+	call->data = data;
+	call->data_len = strlen(data) + 1;
+	call->response = response;
+	call->response[0] = '\0';
+	call->buflen = buflen;
+	call->resp_len = 0;
+	call->seq = 0;
+	call->tkn = 0;
+	call->wait = 0;
+	call->retries = 0;
+	call->poll = 0;
+	call->skew = 0;
+	call->observe = 0;
+	call->lease = 0;
+	call->done = done;
+	call->arg = arg;
+	
+	return call;
+}
+	
+/* open the call, or queue it behind the one to the same peer getting its token */
+static int call_start(struct initiator_s *initiator, struct call_s *call)
+{
+	struct call_s *first;
+	
+	first = call_find(initiator, &call->peer, 0);
+	
+	if (first) {
+		while (first->wait)
+			first = &initiator->call[first->wait - 1];
+		
+		first->wait = call - initiator->call + 1;
+		call->state = CALL_WAIT;
+		
+		return call - initiator->call;
+	}
+	
+	call_open(initiator, call);
+	
+	return call - initiator->call;
+}
+	
+/*
+ * start a transaction. data (null terminated) and response must stay valid until
+ * done(arg, status) is called from urest_initiator_poll(). returns a call handle
+ * or -1 if all calls are in use.
+ */
+int urest_submit(struct initiator_s *initiator, struct peer_s *peer, uint8_t frag_size, uint8_t method, char *data, char *response, uint16_t buflen, void (*done)(void *, int), void *arg)
+{
+	struct call_s *call;
+	
+	call = call_new(initiator, peer, frag_size, method, data, response, buflen, done, arg);
+	
+	if (!call)
+		return -1;
+	
+	return call_start(initiator, call);
+}
+
+/* drop a call, done() is not called */
+int urest_cancel(struct initiator_s *initiator, int slot)
+{
+	struct call_s *call, *prev;
+	
+	if (slot < 0 || slot >= initiator->calls || initiator->call[slot].state == CALL_FREE)
+		return -1;
+	
+	call = &initiator->call[slot];
+	
+	if (call->state == CALL_WAIT) {
+		for (prev = call_find(initiator, &call->peer, 0); prev->wait != slot + 1; prev = &initiator->call[prev->wait - 1]);
+		
+		prev->wait = call->wait;
+		call->state = CALL_FREE;
+		initiator->free_slot[initiator->calls - initiator->active] = slot;
+		initiator->active--;
+		
+		return 0;
+	}
+	
+	call->done = 0;
+	call_finish(initiator, call, REQUEST_FAILED);
+	initiator->completed--;
+	
+	return 0;
+}
+
+/* move a call on after the ACK to its fragment in flight */
+static void call_ack(struct initiator_s *initiator, struct call_s *call, char *packet, uint16_t size)
+{
+	struct urest_s *header = (struct urest_s *)packet;
+	struct options_s options;
+	uint16_t len;
+	
+	if (call->state == CALL_SEND) {
+		if (header->mtd_major != INFO) {
+			call_finish(initiator, call, header->mtd_major * 100 + header->mtd_minor);
+		} else if (header->mtd_minor == PROCESSING) {
+			/* the lease granted to an observation */
+			if ((header->msg_type & EXT) && urest_options_parse(packet + sizeof(struct urest_s), size - sizeof(struct urest_s), &options) > 0 &&
+				(options.present & (1 << OPT_OBSERVE)))
+				call->lease = options.lease;
+	
+			call->state = CALL_RECV;
+			call->seq++;
+			call_send(initiator, call);
+		} else if ((uint32_t)(call->seq + 1) * call->payload_size - call->skew <= call->data_len) {
+			call->seq++;
+			call_send(initiator, call);
+		} else {
+			call_finish(initiator, call, header->mtd_major * 100 + header->mtd_minor);
+		}
+		
+		return;
+	}
+	
+	/* accepted, the handler still runs: wait from an RTO doubling up to UREST_POLL_INTERVAL */
+	if (header->mtd_major == SUCCESS && header->mtd_minor == ACCEPTED && size == sizeof(struct urest_s)) {
+		if (!call->poll)
+			call->poll = peer_rtt(initiator, &call->peer)->rto;
+	
+		if (call->poll > UREST_POLL_INTERVAL)
+			call->poll = UREST_POLL_INTERVAL;
+	
+		call->state = CALL_POLL;
+		urest_timer_set(&initiator->wheel, &call->timer, urest_clock() + call->poll);
+		call->poll *= 2;
+	
+		return;
+	}
+	
+	len = size - sizeof(struct urest_s);
+	
+	if (len > call->payload_size)
+		len = call->payload_size;
+	
+	/* responses that do not fit are truncated */
+	if (call->resp_len + len >= call->buflen)
+		len = call->buflen - call->resp_len - 1;
+	
+	memcpy(call->response + call->resp_len, packet + sizeof(struct urest_s), len);
+	call->resp_len += len;
+	call->response[call->resp_len] = '\0';
+	
+	if (header->mtd_major == INFO && size - sizeof(struct urest_s) == call->payload_size) {
+		call->seq++;
+		call_send(initiator, call);
+	} else {
+		call_finish(initiator, call, header->mtd_major * 100 + header->mtd_minor);
+	}
+}
+	
+/* a value pushed to an observation, taken if newer than the last one */
+static void process_uns(struct initiator_s *initiator, char *packet, uint16_t size, struct peer_s *peer)
+{
+	struct urest_s *header = (struct urest_s *)packet;
+	struct observe_s *observe;
+	uint16_t len;
+	int i;
+	
+	for (i = 0; i < initiator->calls; i++) {
+		observe = &initiator->observe[i];
+	
+		if (observe->uri && observe->tkn == header->tkn && observe->peer.len == peer->len &&
+			memcmp(observe->peer.addr, peer->addr, peer->len) == 0)
+			break;
+	}
+	
+	if (i == initiator->calls || (int16_t)(ntohs(header->seq) - observe->seq) <= 0)
+		return;
+	
+	observe->seq = ntohs(header->seq);
+	len = size - sizeof(struct urest_s);
+	
+	if (len >= observe->buflen)
+		len = observe->buflen - 1;
+	
+	memcpy(observe->value, packet + sizeof(struct urest_s), len);
+	observe->value[len] = '\0';
+	observe->notify(observe->arg, header->mtd_major * 100 + header->mtd_minor, observe->value, len);
+}
+	
+static void process_ack(struct initiator_s *initiator, char *packet, uint16_t size, struct peer_s *peer)
+{
+	struct urest_s *header = (struct urest_s *)packet;
+	struct call_s *call;
+	uint16_t next = 0;
+	
+	if (size < sizeof(struct urest_s))
+		return;
+	
+	if (header->msg_type == UNS) {
+		process_uns(initiator, packet, size, peer);
+	
+		return;
+	}
+	
+	if ((header->msg_type & ~EXT) != ACK)
+		return;
+	
+	call = call_find(initiator, peer, header->tkn);
+	
+	if (!call)
+		call = call_find(initiator, peer, 0);
+	
+	/* late or duplicated, the call moved on */
+	if (!call || ntohs(header->seq) != call->seq || header->frag_size != call->header.frag_size)
+		return;
+	
+	if (call->tkn == 0) {
+		call_remove(initiator, call);
+		call->tkn = header->tkn;
+		call_insert(initiator, call);
+		next = call->wait;
+		call->wait = 0;
+	}
+	
+	if (call->retries == 0)
+		urest_rtt_sample(peer_rtt(initiator, peer), urest_clock() - call->sent);
+	
+	call->retries = 0;
+	call_ack(initiator, call, packet, size);
+	
+	/*
+	 * the next call to the peer asks for a token after this one moved on: the
+	 * responder takes a first fragment like the last one for a retransmission
+	 * until the transaction it opened gets another fragment.
+	 */
+	if (next)
+		call_open(initiator, &initiator->call[next - 1]);
+}
+
+/* no ACK in time, send the fragment again after a longer wait or give up. a polling call asks again */
+static void call_expired(void *arg, struct timer_s *timer)
+{
+	struct initiator_s *initiator = (struct initiator_s *)arg;
+	struct call_s *call = (struct call_s *)((char *)timer - offsetof(struct call_s, timer));
+	
+	if (call->state == CALL_POLL) {
+		call->state = CALL_RECV;
+		call_send(initiator, call);
+	
+		return;
+	}
+	
+	if (++call->retries > UREST_RETRIES)
+		call_finish(initiator, call, REQUEST_FAILED);
+	else
+		call_send(initiator, call);
+}
+
+/* GET the value again, asking for the lease to go on */
+static int observe_renew(struct initiator_s *initiator, struct observe_s *observe)
+{
+	struct call_s *call;
+	struct options_s options;
+	
+	call = call_new(initiator, &observe->peer, observe->frag_size, GET, observe->uri, observe->value, observe->buflen, 0, 0);
+	
+	if (!call)
+		return -1;
+	
+	options.present = 1 << OPT_OBSERVE;
+	options.lease = observe->lease;
+	call->skew = urest_options_write(call->options, sizeof(call->options), &options);
+	call->observe = observe - initiator->observe + 1;
+	observe->call = call - initiator->call + 1;
+	
+	return call_start(initiator, call) < 0 ? -1 : 0;
+}
+	
+/* calls and observations share the wheel */
+static void timer_expired(void *arg, struct timer_s *timer)
+{
+	struct initiator_s *initiator = (struct initiator_s *)arg;
+	struct observe_s *observe = (struct observe_s *)timer;
+	
+	if (observe < initiator->observe || observe >= initiator->observe + initiator->calls) {
+		call_expired(arg, timer);
+	
+		return;
+	}
+	
+	/* all calls in use, try again later */
+	if (observe_renew(initiator, observe))
+		urest_timer_set(&initiator->wheel, &observe->timer, urest_clock() + UREST_RTO_INITIAL);
+}
+	
+/*
+ * observe a resource: GET uri now and every half lease (in s), asking the
+ * responder to push changes in between. notify(arg, status, value, len) is called
+ * from urest_initiator_poll() with each value, from a GET or a push. a responder
+ * that does not grant the lease is just polled. value must stay valid until
+ * urest_unobserve(). returns an observation handle or -1.
+ */
+int urest_observe(struct initiator_s *initiator, struct peer_s *peer, uint8_t frag_size, char *uri, uint16_t lease, char *value, uint16_t buflen, void (*notify)(void *, int, char *, uint16_t), void *arg)
+{
+	struct observe_s *observe;
+	int i;
+	
+	if (lease == 0 || buflen == 0 || !notify)
+		return -1;
+	
+	for (i = 0; i < initiator->calls && initiator->observe[i].uri; i++);
+	
+	if (i == initiator->calls)
+		return -1;
+	
+	observe = &initiator->observe[i];
+	observe->peer = *peer;
+	observe->uri = uri;
+	observe->value = value;
+	observe->buflen = buflen;
+	observe->lease = lease;
+	observe->tkn = 0;
+	observe->seq = 0;
+	observe->call = 0;
+	observe->frag_size = frag_size;
+	observe->notify = notify;
+	observe->arg = arg;
+	
+	if (observe_renew(initiator, observe)) {
+		observe->uri = 0;
+	
+		return -1;
+	}
+	
+	return i;
+}
+	
+/* stop observing, the responder drops the subscription on a RST with its token */
+int urest_unobserve(struct initiator_s *initiator, int slot)
+{
+	struct observe_s *observe;
+	struct urest_s header;
+	struct datagram_s dgram;
+	
+	if (slot < 0 || slot >= initiator->calls || !initiator->observe[slot].uri)
+		return -1;
+	
+	observe = &initiator->observe[slot];
+	
+	if (observe->call) {
+		initiator->call[observe->call - 1].observe = 0;
+		urest_cancel(initiator, observe->call - 1);
+	}
+	
+	urest_timer_cancel(&initiator->wheel, &observe->timer);
+	
+	if (observe->tkn) {
+		memset(&header, 0, sizeof(header));
+		header.frag_size = observe->frag_size;
+		header.msg_type = RST;
+		header.cnt_type = FLAT_ENC;
+		header.mtd_major = VERB;
+		header.mtd_minor = GET;
+		header.tkn = observe->tkn;
+		dgram.peer = observe->peer;
+		dgram.data = (char *)&header;
+		dgram.size = sizeof(struct urest_s);
+		dgram.payload = 0;
+		dgram.payload_size = 0;
+		urest_udp_send_batch(&dgram, 1);
+	}
+	
+	observe->uri = 0;
+	
+	return 0;
+}
+	
+/* ms until a fragment may be due to be sent again, -1 if there are no calls */
+int urest_initiator_timeout(struct initiator_s *initiator)
+{
+	return urest_wheel_next(&initiator->wheel, urest_clock());
+}
+
+/*
+ * drive the calls: wait up to timeout ms (-1 for as long as needed) for ACKs,
+ * handle them and send fragments again where due. completed calls get their
+ * done() called from here. returns the number of calls completed.
+ */
+int urest_initiator_poll(struct initiator_s *initiator, int timeout)
+{
+	struct pollfd pfd;
+	int i, n, next;
+	
+	flush(initiator);
+	initiator->completed = 0;
+	
+	next = urest_initiator_timeout(initiator);
+	
+	if (next >= 0 && (timeout < 0 || next < timeout))
+		timeout = next;
+	
+	pfd.fd = initiator->s;
+	pfd.events = POLLIN;
+	
+	if (timeout != 0)
+		poll(&pfd, 1, timeout);
+	
+	do {
+		n = urest_udp_recv_batch(initiator->s, initiator->in, UREST_BATCH);
+		
+		for (i = 0; i < n; i++)
+			process_ack(initiator, initiator->in[i].data, initiator->in[i].size, &initiator->in[i].peer);
+	} while (n == UREST_BATCH);
+	
+	urest_wheel_advance(&initiator->wheel, urest_clock(), timer_expired, initiator);
+	flush(initiator);
+	
+	return initiator->completed;
+}
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "urest.h"
+
+#define BLOB_CHUNK		64			/* base32 characters decoded at a time */
+
+enum json_state {
+	JS_VALUE = 0,					/* a value, also the document */
+	JS_FIRST_KEY,					/* a key or '}' */
+	JS_KEY,
+	JS_COLON,
+	JS_FIRST_VALUE,					/* a value or ']' */
+	JS_NEXT,					/* ',' or the end of the container */
+	JS_STRING,
+	JS_ESCAPE,
+	JS_UNICODE,
+	JS_NUMBER,
+	JS_LITERAL,
+	JS_DONE
+};
+
+#define JF_KEY			0x01			/* the string is a key */
+#define JF_BLOB			0x02			/* the string is base32, decoded */
+#define JF_TRUE			0x04			/* literal being matched */
+#define JF_FALSE		0x08
+#define JF_NULL			0x10
+
+
+/*
+ * incremental SAX style JSON parser. a document is fed in chunks as it arrives,
+ * the parser keeps a few bytes of state between them and never buffers a value:
+ * strings and numbers are passed on in pieces (JSON_PART set on all but the last
+ * one), most of them pointing into the chunk. nesting is limited to 32 levels.
+ */
+void urest_json(struct json_s *json, int (*event)(void *, uint8_t, char *, uint16_t), void *arg)
+{
+	memset(json, 0, sizeof(struct json_s));
+	json->event = event;
+	json->arg = arg;
+}
+
+/* called on a (last) JSON_KEY event: the value of the member is base32, passed on decoded as JSON_BLOB */
+void urest_json_blob(struct json_s *json)
+{
+	json->flags |= JF_BLOB;
+}
+
+static int emit(struct json_s *json, uint8_t event, char *data, uint16_t len)
+{
+	return json->event ? json->event(json->arg, event, data, len) : 0;
+}
+
+/* a value is over, back to its container */
+static void value_end(struct json_s *json)
+{
+	json->state = json->depth ? JS_NEXT : JS_DONE;
+	json->flags = 0;
+}
+
+static int open_container(struct json_s *json, int object)
+{
+	if (json->depth == 32)
+		return -1;
+	
+	json->stack = object ? json->stack | (1u << json->depth) : json->stack & ~(1u << json->depth);
+	json->depth++;
+	json->state = object ? JS_FIRST_KEY : JS_FIRST_VALUE;
+	json->flags = 0;
+	
+	return emit(json, object ? JSON_OBJECT : JSON_ARRAY, 0, 0);
+}
+
+static int close_container(struct json_s *json, int object)
+{
+	if (!json->depth || !(json->stack & (1u << (json->depth - 1))) != !object)
+		return -1;
+	
+	json->depth--;
+	value_end(json);
+	
+	return emit(json, object ? JSON_OBJECT_END : JSON_ARRAY_END, 0, 0);
+}
+
+/* base32 characters of a blob, decoded as they come */
+static int blob_chars(struct json_s *json, char *data, uint16_t len, uint8_t part)
+{
+	char out[BASE32_DECODED(BLOB_CHUNK)];
+	uint16_t n, i;
+	int v, status;
+	
+	while (len) {
+		n = 0;
+	
+		if (json->count == 0 && len >= 8) {
+			/* whole groups go through the codec */
+			i = len < BLOB_CHUNK ? len / 8 * 8 : BLOB_CHUNK;
+			v = base32_decode(data, i, out, sizeof(out));
+	
+			if (v < 0)
+				return -1;
+	
+			n = v;
+			data += i;
+			len -= i;
+		} else {
+			/* a character at a time, up to the end of a group */
+			do {
+				if ((*data | 0x20) >= 'a' && (*data | 0x20) <= 'z')
+					v = (*data & 0x1f) - 1;
+				else if (*data >= '2' && *data <= '7')
+					v = *data - '2' + 26;
+				else if (*data == '=')
+					v = -1;
+				else
+					return -1;
+	
+				data++;
+				len--;
+	
+				if (v < 0)
+					continue;
+	
+				json->bits = json->bits << 5 | v;
+				json->count += 5;
+	
+				if (json->count >= 8) {
+					json->count -= 8;
+					out[n++] = json->bits >> json->count;
+				}
+			} while (len && json->count);
+		}
+	
+		if (n) {
+			status = emit(json, JSON_BLOB | JSON_PART, out, n);
+	
+			if (status)
+				return status;
+		}
+	}
+	
+	return part ? 0 : emit(json, JSON_BLOB, 0, 0);
+}
+
+/* a run of string characters (or a decoded escape), part unless the string ends with it */
+static int string_chars(struct json_s *json, char *data, uint16_t len, uint8_t part)
+{
+	if ((json->flags & (JF_BLOB | JF_KEY)) == JF_BLOB)
+		return blob_chars(json, data, len, part);
+	
+	if (!len && part)
+		return 0;
+	
+	return emit(json, ((json->flags & JF_KEY) ? JSON_KEY : JSON_STRING) | part, data, len);
+}
+
+/* utf-8 of a \u escape, surrogate pairs joined */
+static int unicode(struct json_s *json)
+{
+	uint32_t c = json->bits & 0xffff;
+	char out[4];
+	uint16_t n;
+	
+	if (c >= 0xd800 && c < 0xdc00) {
+		/* the high half waits for the low one */
+		json->bits = c << 16;
+	
+		return 0;
+	}
+	
+	if (c >= 0xdc00 && c < 0xe000 && (json->bits >> 16))
+		c = 0x10000 + (((json->bits >> 16) - 0xd800) << 10) + (c - 0xdc00);
+	else if (c >= 0xd800 && c < 0xe000)
+		c = 0xfffd;
+	
+	json->bits = 0;
+	
+	if (c < 0x80) {
+		out[0] = c;
+		n = 1;
+	} else if (c < 0x800) {
+		out[0] = 0xc0 | c >> 6;
+		out[1] = 0x80 | (c & 0x3f);
+		n = 2;
+	} else if (c < 0x10000) {
+		out[0] = 0xe0 | c >> 12;
+		out[1] = 0x80 | ((c >> 6) & 0x3f);
+		out[2] = 0x80 | (c & 0x3f);
+		n = 3;
+	} else {
+		out[0] = 0xf0 | c >> 18;
+		out[1] = 0x80 | ((c >> 12) & 0x3f);
+		out[2] = 0x80 | ((c >> 6) & 0x3f);
+		out[3] = 0x80 | (c & 0x3f);
+		n = 4;
+	}
+	
+	return string_chars(json, out, n, JSON_PART);
+}
+
+static int escape(struct json_s *json, char c)
+{
+	static const char from[] = "\"\\/bfnrt", to[] = "\"\\/\b\f\n\r\t";
+	char *p;
+	
+	/* base32 has no use for escapes */
+	if ((json->flags & (JF_BLOB | JF_KEY)) == JF_BLOB)
+		return -1;
+	
+	if (c == 'u') {
+		json->state = JS_UNICODE;
+		json->count = 0;
+		json->bits &= 0xffff0000;
+	
+		return 0;
+	}
+	
+	p = c ? strchr(from, c) : 0;
+	
+	if (!p)
+		return -1;
+	
+	json->state = JS_STRING;
+	
+	return string_chars(json, (char *)&to[p - from], 1, JSON_PART);
+}
+
+/*
+ * parse len more bytes of the document. returns 0, -1 on a syntax error or the
+ * non zero value an event returned (parsing stops there, json->offset tells how
+ * far it got).
+ */
+int urest_json_parse(struct json_s *json, char *data, uint16_t len)
+{
+	char *p = data, *end = data + len, *run;
+	static const char *literal[] = {"true", "false", "null"};
+	int status = 0;
+	char c;
+	
+	while (p < end && !status) {
+		c = *p;
+	
+		switch (json->state) {
+		case JS_STRING:
+			/* plain characters go out as they are, up to a quote or an escape */
+			for (run = p; p < end && *p != '"' && *p != '\\'; p++)
+				if ((uint8_t)*p < 0x20)
+					return -1;
+	
+			if (p == end) {
+				status = string_chars(json, run, p - run, JSON_PART);
+				break;
+			}
+	
+			if (*p == '\\') {
+				status = string_chars(json, run, p - run, JSON_PART);
+				json->state = JS_ESCAPE;
+				p++;
+				break;
+			}
+	
+			p++;
+	
+			if (json->flags & JF_KEY) {
+				/* the event may ask for the value as a blob */
+				status = string_chars(json, run, p - 1 - run, 0);
+				json->flags &= ~JF_KEY;
+				json->state = JS_COLON;
+			} else {
+				status = string_chars(json, run, p - 1 - run, 0);
+				value_end(json);
+			}
+	
+			break;
+		case JS_ESCAPE:
+			status = escape(json, c);
+			p++;
+			break;
+		case JS_UNICODE:
+			if (c >= '0' && c <= '9')
+				json->bits = (json->bits & 0xffff0000) | ((json->bits << 4) & 0xffff) | (c - '0');
+			else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+				json->bits = (json->bits & 0xffff0000) | ((json->bits << 4) & 0xffff) | ((c | 0x20) - 'a' + 10);
+			else
+				return -1;
+	
+			p++;
+	
+			if (++json->count == 4) {
+				json->state = JS_STRING;
+				json->count = 0;
+				status = unicode(json);
+			}
+	
+			break;
+		case JS_NUMBER:
+			for (run = p; p < end && ((*p >= '0' && *p <= '9') || *p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-'); p++);
+	
+			if (p == end) {
+				status = emit(json, JSON_NUMBER | JSON_PART, run, p - run);
+				break;
+			}
+	
+			status = emit(json, JSON_NUMBER, run, p - run);
+			value_end(json);
+			break;
+		case JS_LITERAL:
+			run = (char *)literal[json->flags & JF_TRUE ? 0 : json->flags & JF_FALSE ? 1 : 2];
+	
+			if (c != run[json->count])
+				return -1;
+	
+			p++;
+	
+			if (!run[++json->count]) {
+				status = emit(json, json->flags & JF_TRUE ? JSON_TRUE : json->flags & JF_FALSE ? JSON_FALSE : JSON_NULL, 0, 0);
+				value_end(json);
+			}
+	
+			break;
+		default:
+			p++;
+	
+			if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
+				break;
+	
+			switch (json->state) {
+			case JS_FIRST_KEY:
+				if (c == '}') {
+					status = close_container(json, 1);
+					break;
+				}
+				/* fall through */
+			case JS_KEY:
+				if (c != '"')
+					return -1;
+	
+				json->state = JS_STRING;
+				json->flags = JF_KEY;
+				break;
+			case JS_COLON:
+				if (c != ':')
+					return -1;
+	
+				json->state = JS_VALUE;
+				break;
+			case JS_NEXT:
+				if (c == ',')
+					json->state = (json->stack & (1u << (json->depth - 1))) ? JS_KEY : JS_VALUE;
+				else if (c == '}' || c == ']')
+					status = close_container(json, c == '}');
+				else
+					return -1;
+	
+				break;
+			case JS_FIRST_VALUE:
+				if (c == ']') {
+					status = close_container(json, 0);
+					break;
+				}
+				/* fall through */
+			case JS_VALUE:
+				if (c == '{' || c == '[') {
+					status = open_container(json, c == '{');
+				} else if (c == '"') {
+					json->state = JS_STRING;
+				} else if (c == '-' || (c >= '0' && c <= '9')) {
+					json->state = JS_NUMBER;
+					p--;
+				} else if (c == 't' || c == 'f' || c == 'n') {
+					json->state = JS_LITERAL;
+					json->flags = c == 't' ? JF_TRUE : c == 'f' ? JF_FALSE : JF_NULL;
+					json->count = 1;
+				} else {
+					return -1;
+				}
+	
+				break;
+			default:
+				/* JS_DONE, only whitespace may follow the document */
+				return -1;
+			}
+		}
+	}
+	
+	json->offset += p - data;
+	
+	return status;
+}
+
+/* the document is over: returns 0 if it was complete, -1 if not */
+int urest_json_end(struct json_s *json)
+{
+	/* a number at the top level ends with the document */
+	if (json->state == JS_NUMBER && json->depth == 0) {
+		json->state = JS_DONE;
+	
+		if (emit(json, JSON_NUMBER, 0, 0))
+			return -1;
+	}
+	
+	return json->state == JS_DONE ? 0 : -1;
+}
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sched.h>
+#include "urest.h"
+
+#define LOOPBACK_TO_RESPONDER	0
+#define LOOPBACK_TO_INITIATOR	1
+
+
+/*
+ * in-memory transport for tests and benchmarks. datagrams go through a single
+ * producer, single consumer ring each way, so the initiator and the responder
+ * may run on two threads without locks, or on one: with a responder attached
+ * by urest_loopback_inline() the initiator processes what it sent while it waits
+ * for the ACK. faults (loss, reordering, delay) are injected on both rings.
+ */
+struct loopback_s *urest_loopback(void)
+{
+	struct loopback_s *lb;
+	int i;
+	
+	lb = calloc(1, sizeof(struct loopback_s));
+	
+	if (!lb)
+		return 0;
+	
+	for (i = 0; i < 2; i++) {
+		lb->ring[i].slot = calloc(UREST_LOOPBACK_SLOTS, sizeof(struct loopback_slot_s));
+	
+		if (!lb->ring[i].slot) {
+			free(lb->ring[0].slot);
+			free(lb);
+	
+			return 0;
+		}
+	
+		lb->ring[i].seed[0] = 2463534242u + i;
+		lb->ring[i].seed[1] = 88675123u + i;
+	}
+	
+	lb->peer.len = 4;
+	memcpy(lb->peer.addr, "loop", 4);
+	lb->timeout = UREST_RTO_INITIAL;
+	
+	return lb;
+}
+
+void urest_loopback_free(struct loopback_s *lb)
+{
+	free(lb->ring[0].slot);
+	free(lb->ring[1].slot);
+	free(lb);
+}
+
+/* loss and reorder in per mille of the datagrams each way, delay in us */
+void urest_loopback_faults(struct loopback_s *lb, uint16_t loss, uint16_t reorder, uint32_t delay)
+{
+	lb->loss = loss;
+	lb->reorder = reorder;
+	lb->delay = delay;
+}
+
+/* xorshift32, a fault happens per mille times out of 1000 */
+static int chance(uint32_t *seed, uint16_t per_mille)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+	
+	return *seed % 1000 < per_mille;
+}
+
+static void push(struct loopback_s *lb, struct loopback_ring_s *ring, char *data, uint16_t size)
+{
+	struct loopback_slot_s *slot;
+	
+	ring->sent++;
+	
+	/* lost on the way, or no room left as in a full socket buffer */
+	if ((lb->loss && chance(&ring->seed[0], lb->loss)) || ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == UREST_LOOPBACK_SLOTS) {
+		ring->lost++;
+	
+		return;
+	}
+	
+	slot = &ring->slot[ring->head & (UREST_LOOPBACK_SLOTS - 1)];
+	slot->due = lb->delay ? urest_stats_clock() + lb->delay : 0;
+	slot->size = size;
+	memcpy(slot->data, data, size);
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/* the next datagram due into data, its size or 0 if there is none yet */
+static uint16_t pop(struct loopback_s *lb, struct loopback_ring_s *ring, char *data)
+{
+	struct loopback_slot_s *slot, *next;
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), now = 0;
+	uint16_t size;
+	
+	if (head == ring->tail)
+		return 0;
+	
+	slot = &ring->slot[ring->tail & (UREST_LOOPBACK_SLOTS - 1)];
+	
+	if (lb->delay) {
+		now = urest_stats_clock();
+	
+		if ((int32_t)(now - slot->due) < 0)
+			return 0;
+	}
+	
+	next = &ring->slot[(ring->tail + 1) & (UREST_LOOPBACK_SLOTS - 1)];
+	
+	/* the next one overtakes it, both slots are the receiving side's until the tail moves */
+	if (lb->reorder && head - ring->tail >= 2 && (!lb->delay || (int32_t)(now - next->due) >= 0) &&
+		chance(&ring->seed[1], lb->reorder)) {
+		size = next->size;
+		memcpy(data, next->data, size);
+		next->due = slot->due;
+		next->size = slot->size;
+		memcpy(next->data, slot->data, slot->size);
+	} else {
+		size = slot->size;
+		memcpy(data, slot->data, size);
+	}
+	
+	/* drivers clear the buffer before receiving, text payloads end there */
+	if (size < UREST_PACKET_SIZE)
+		data[size] = '\0';
+	
+	__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+	
+	return size;
+}
+
+static void clnt_send(void *arg, char *data, uint16_t size)
+{
+	struct loopback_s *lb = (struct loopback_s *)arg;
+	
+	push(lb, &lb->ring[LOOPBACK_TO_RESPONDER], data, size);
+}
+
+/* wait up to the ACK timeout, running the responder meanwhile if it is inline */
+static void clnt_recv(void *arg, char *data, uint16_t *size)
+{
+	struct loopback_s *lb = (struct loopback_s *)arg;
+	uint32_t start = urest_clock();
+	
+	while (1) {
+		if (lb->responder)
+			urest_loopback_poll(lb, lb->responder);
+	
+		*size = pop(lb, &lb->ring[LOOPBACK_TO_INITIATOR], data);
+	
+		if (*size || urest_clock() - start >= lb->timeout)
+			return;
+	
+		if (!lb->responder)
+			sched_yield();
+	}
+}
+
+static void clnt_handler(void *arg, char *data, uint16_t send_size, uint16_t *recv_size)
+{
+	clnt_send(arg, data, send_size);
+	clnt_recv(arg, data, recv_size);
+}
+
+static void clnt_timeout(void *arg, uint32_t timeout)
+{
+	((struct loopback_s *)arg)->timeout = timeout;
+}
+
+/* set up clnt_packet to exchange fragments through lb, timeout is the ACK wait (in ms) until the library sets it from the RTT */
+int urest_loopback_client(struct clnt_packet_s *clnt_packet, struct loopback_s *lb, uint32_t timeout)
+{
+	if (!timeout)
+		return -1;
+	
+	lb->timeout = timeout;
+	clnt_packet->packet_arg = lb;
+	clnt_packet->packet_handler = clnt_handler;
+	clnt_packet->packet_send = clnt_send;
+	clnt_packet->packet_recv = clnt_recv;
+	clnt_packet->packet_timeout = clnt_timeout;
+	
+	return 0;
+}
+
+static void serv_sendto(void *arg, struct peer_s *peer, char *data, uint16_t size)
+{
+	struct loopback_s *lb = (struct loopback_s *)arg;
+	
+	push(lb, &lb->ring[LOOPBACK_TO_INITIATOR], data, size);
+}
+
+/* set up serv_packet for a responder on the other end of lb */
+void urest_loopback_server(struct serv_packet_s *serv_packet, struct loopback_s *lb)
+{
+	serv_packet->packet_arg = lb;
+	serv_packet->packet = lb->packet;
+	serv_packet->packet_handler_sendto = serv_sendto;
+}
+
+/* the initiator runs responder itself while it waits, no thread for it (null to stop) */
+void urest_loopback_inline(struct loopback_s *lb, struct responder_s *responder)
+{
+	lb->responder = responder;
+}
+
+/*
+ * pass the datagrams due to responder, on the thread serving it. with none, the
+ * transactions of responder are expired (once per ms). returns the number of
+ * datagrams passed.
+ */
+int urest_loopback_poll(struct loopback_s *lb, struct responder_s *responder)
+{
+	uint16_t size;
+	int n = 0;
+	
+	while ((size = pop(lb, &lb->ring[LOOPBACK_TO_RESPONDER], lb->packet))) {
+		urest_process_packet(responder, lb->packet, size, &lb->peer);
+		n++;
+	}
+	
+	if (!n && urest_clock() != lb->expired) {
+		lb->expired = urest_clock();
+		urest_expire(responder);
+	}
+	
+	return n;
+}
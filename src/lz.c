@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "urest.h"
+
+#define LZ_MIN			3			/* shortest match */
+#define LZ_MAX			(0x7f + LZ_MIN)		/* longest match */
+#define LZ_RUN			0x80			/* longest literal run */
+#define LZ_HASH_BITS		9
+#define LZ_WAYS			4			/* positions kept per hash, the newest first */
+#define LZ_DISTANCE		0xffff			/* furthest match */
+
+
+/*
+ * byte oriented LZ77 for payloads on slow links. the history a match can refer
+ * to starts with a preset dictionary shared by both ends (the URIs and keys of
+ * the deployment), so even short payloads find matches. the compressed stream is
+ * a sequence of:
+ *
+ *	0nnnnnnn		a run of n + 1 literal bytes, which follow
+ *	1mmmmmmm dd dd		m + 3 bytes copied from d bytes back (big endian)
+ *
+ * a payload coded for the wire starts with LZ_STORED or LZ_PACKED, the first
+ * when packing it would not save anything.
+ */
+
+/* the dictionary id tells both ends they share the same one, it is never 0 */
+void urest_dict(struct dict_s *dict, const char *data, uint16_t len)
+{
+	uint32_t hash = 2166136261u;
+	uint16_t i;
+	
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+	
+	dict->data = data;
+	dict->len = len;
+	dict->id = (hash ^ (hash >> 16)) & 0xffff;
+	
+	if (!dict->id)
+		dict->id = 1;
+}
+
+/* the dictionary followed by the input, as one history */
+static inline uint8_t at(const struct dict_s *dict, const char *in, uint32_t pos)
+{
+	return pos < dict->len ? dict->data[pos] : in[pos - dict->len];
+}
+
+static inline uint16_t hash(const struct dict_s *dict, const char *in, uint32_t pos)
+{
+	uint32_t v = at(dict, in, pos) | at(dict, in, pos + 1) << 8 | at(dict, in, pos + 2) << 16;
+	
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static void insert(uint16_t *bucket, uint32_t pos)
+{
+	memmove(bucket + 1, bucket, (LZ_WAYS - 1) * sizeof(uint16_t));
+	bucket[0] = pos + 1;
+}
+	
+static int literals(const char *run, uint16_t n, char *out, uint16_t size, uint16_t *len)
+{
+	uint16_t chunk;
+	
+	while (n) {
+		chunk = n < LZ_RUN ? n : LZ_RUN;
+	
+		if (*len + 1 + chunk > size)
+			return -1;
+	
+		out[(*len)++] = chunk - 1;
+		memcpy(out + *len, run, chunk);
+		*len += chunk;
+		run += chunk;
+		n -= chunk;
+	}
+	
+	return 0;
+}
+
+/* returns the compressed length, or -1 if it does not fit in size bytes */
+static int compress(const struct dict_s *dict, const char *in, uint16_t len, char *out, uint16_t size)
+{
+	uint16_t head[1 << LZ_HASH_BITS][LZ_WAYS], *bucket;
+	uint32_t end = dict->len + len, pos, cand = 0, run, m, n, i, w;
+	uint16_t olen = 0;
+	
+	/* positions are kept + 1 in 16 bits */
+	if (end >= 0xffff)
+		return -1;
+	
+	memset(head, 0, sizeof(head));
+	
+	for (pos = 0; pos + LZ_MIN <= dict->len; pos++)
+		insert(head[hash(dict, in, pos)], pos);
+	
+	pos = run = dict->len;
+	
+	while (pos + LZ_MIN <= end) {
+		bucket = head[hash(dict, in, pos)];
+		m = 0;
+	
+		/* the longest match among the positions with the same hash */
+		for (w = 0; w < LZ_WAYS && bucket[w] && pos - (bucket[w] - 1) <= LZ_DISTANCE; w++) {
+			for (n = 0; pos + n < end && n < LZ_MAX && at(dict, in, bucket[w] - 1 + n) == at(dict, in, pos + n); n++);
+	
+			if (n > m) {
+				m = n;
+				cand = bucket[w] - 1;
+			}
+		}
+	
+		insert(bucket, pos);
+	
+		if (m < LZ_MIN) {
+			pos++;
+	
+			continue;
+		}
+	
+		if (literals(in + run - dict->len, pos - run, out, size, &olen) < 0 || olen + 3 > size)
+			return -1;
+	
+		out[olen++] = 0x80 | (m - LZ_MIN);
+		out[olen++] = (pos - cand) >> 8;
+		out[olen++] = pos - cand;
+	
+		/* the bytes matched are history for later matches too */
+		for (i = pos + 1; i < pos + m && i + LZ_MIN <= end; i++)
+			insert(head[hash(dict, in, i)], i);
+	
+		pos += m;
+		run = pos;
+	}
+	
+	if (literals(in + run - dict->len, end - run, out, size, &olen) < 0)
+		return -1;
+	
+	return olen;
+}
+
+/* returns the decompressed length, or -1 if the stream is broken or does not fit in size bytes */
+static int decompress(const struct dict_s *dict, const char *in, uint16_t len, char *out, uint16_t size)
+{
+	uint16_t i = 0, olen = 0, n, d;
+	uint8_t t;
+	
+	while (i < len) {
+		t = in[i++];
+	
+		if (t < 0x80) {
+			n = t + 1;
+	
+			if (i + n > len || olen + n > size)
+				return -1;
+	
+			memcpy(out + olen, in + i, n);
+			i += n;
+			olen += n;
+	
+			continue;
+		}
+	
+		if (i + 2 > len)
+			return -1;
+	
+		n = (t & 0x7f) + LZ_MIN;
+		d = (uint8_t)in[i] << 8 | (uint8_t)in[i + 1];
+		i += 2;
+	
+		if (!d || d > olen + dict->len || olen + n > size)
+			return -1;
+	
+		/* a byte at a time, the copy may overlap what it writes */
+		for (; n; n--, olen++)
+			out[olen] = d > olen ? dict->data[dict->len + olen - d] : out[olen - d];
+	}
+	
+	return olen;
+}
+
+/*
+ * code len bytes of in for the wire into out, of size bytes. payloads shorter
+ * than threshold are stored as they are. returns the coded length, or -1 if it
+ * does not fit.
+ */
+int urest_lz_pack(const struct dict_s *dict, char *in, uint16_t len, char *out, uint16_t size, uint16_t threshold)
+{
+	int n = -1;
+	
+	if (!size)
+		return -1;
+	
+	/* packed only if it saves something */
+	if (len >= threshold && len > LZ_MIN)
+		n = compress(dict, in, len, out + 1, len - 1 < size - 1 ? len - 1 : size - 1);
+	
+	if (n >= 0) {
+		out[0] = LZ_PACKED;
+	
+		return n + 1;
+	}
+	
+	if (len + 1 > size)
+		return -1;
+	
+	out[0] = LZ_STORED;
+	memcpy(out + 1, in, len);
+	
+	return len + 1;
+}
+
+/* decode a payload coded by urest_lz_pack() into out, of size bytes. returns its length, or -1 */
+int urest_lz_unpack(const struct dict_s *dict, char *in, uint16_t len, char *out, uint16_t size)
+{
+	if (!len)
+		return -1;
+	
+	if (in[0] == LZ_PACKED)
+		return decompress(dict, in + 1, len - 1, out, size);
+	
+	if (in[0] != LZ_STORED || len - 1 > size)
+		return -1;
+	
+	memcpy(out, in + 1, len - 1);
+	
+	return len - 1;
+}
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "urest.h"
+
+
+/*
+ * a fixed set of threads running jobs from a bounded queue. responders hand
+ * slow handlers to it, so the I/O thread keeps answering other transactions
+ * (and polls for this one with 2.02) while a handler runs. one offload pool may
+ * be shared by several responders.
+ */
+static void *offload_thread(void *arg)
+{
+	struct offload_s *offload = (struct offload_s *)arg;
+	struct offload_job_s job;
+	
+	pthread_mutex_lock(&offload->lock);
+	
+	while (1) {
+		while (!offload->count && !offload->stop)
+			pthread_cond_wait(&offload->ready, &offload->lock);
+	
+		/* jobs queued before the stop are still run */
+		if (!offload->count)
+			break;
+	
+		job = offload->job[offload->head];
+		offload->head = (offload->head + 1) % offload->size;
+		offload->count--;
+		pthread_mutex_unlock(&offload->lock);
+	
+		job.run(job.arg);
+	
+		pthread_mutex_lock(&offload->lock);
+	}
+	
+	pthread_mutex_unlock(&offload->lock);
+	
+	return 0;
+}
+
+struct offload_s *urest_offload(uint8_t threads, uint16_t queue)
+{
+	struct offload_s *offload;
+	int i;
+	
+	if (threads == 0 || queue == 0)
+		return 0;
+	
+	offload = malloc(sizeof(struct offload_s));
+	
+	if (!offload)
+		return 0;
+	
+	offload->job = malloc(queue * sizeof(struct offload_job_s));
+	
+	if (!offload->job) {
+		free(offload);
+	
+		return 0;
+	}
+	
+	offload->thread = malloc(threads * sizeof(pthread_t));
+	
+	if (!offload->thread) {
+		free(offload->job);
+		free(offload);
+	
+		return 0;
+	}
+	
+	offload->size = queue;
+	offload->head = 0;
+	offload->count = 0;
+	offload->stop = 0;
+	pthread_mutex_init(&offload->lock, 0);
+	pthread_cond_init(&offload->ready, 0);
+	
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&offload->thread[i], 0, offload_thread, offload)) {
+			offload->threads = i;
+			urest_offload_stop(offload);
+	
+			return 0;
+		}
+	}
+	
+	offload->threads = threads;
+	
+	return offload;
+}
+
+/* queue run(arg) for a pool thread. returns -1 if the queue is full */
+int urest_offload_submit(struct offload_s *offload, void (*run)(void *), void *arg)
+{
+	pthread_mutex_lock(&offload->lock);
+	
+	if (offload->count == offload->size || offload->stop) {
+		pthread_mutex_unlock(&offload->lock);
+	
+		return -1;
+	}
+	
+	offload->job[(offload->head + offload->count) % offload->size].run = run;
+	offload->job[(offload->head + offload->count) % offload->size].arg = arg;
+	offload->count++;
+	pthread_cond_signal(&offload->ready);
+	pthread_mutex_unlock(&offload->lock);
+	
+	return 0;
+}
+
+/* run the jobs queued so far, then join the threads and free the pool */
+void urest_offload_stop(struct offload_s *offload)
+{
+	int i;
+	
+	pthread_mutex_lock(&offload->lock);
+	offload->stop = 1;
+	pthread_cond_broadcast(&offload->ready);
+	pthread_mutex_unlock(&offload->lock);
+	
+	for (i = 0; i < offload->threads; i++)
+		pthread_join(offload->thread[i], 0);
+	
+	pthread_cond_destroy(&offload->ready);
+	pthread_mutex_destroy(&offload->lock);
+	free(offload->thread);
+	free(offload->job);
+	free(offload);
+}
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "urest.h"
+
+
+/*
+ * options follow the header of a message flagged with EXT, as a list of
+ * (type, length, value) entries closed by OPT_END. multi byte values are in
+ * network byte order and unknown options are skipped.
+ */
+int urest_options_parse(char *data, uint16_t size, struct options_s *options)
+{
+	uint8_t *p = (uint8_t *)data;
+	uint16_t i = 0;
+	uint8_t type, len;
+	
+	options->present = 0;
+	
+	while (i < size) {
+		type = p[i++];
+	
+		if (type == OPT_END)
+			return i;
+	
+		if (i >= size)
+			return -1;
+	
+		len = p[i++];
+	
+		if (i + len > size)
+			return -1;
+	
+		switch (type) {
+		case OPT_WINDOW:
+			if (len != 1)
+				return -1;
+	
+			options->window = p[i];
+			break;
+		case OPT_SACK:
+			if (len != 4)
+				return -1;
+	
+			options->sack = ((uint32_t)p[i] << 24) | ((uint32_t)p[i + 1] << 16) | ((uint32_t)p[i + 2] << 8) | p[i + 3];
+			break;
+		case OPT_ACK:
+			if (len != 2)
+				return -1;
+	
+			options->ack = (p[i] << 8) | p[i + 1];
+			break;
+		case OPT_OBSERVE:
+			if (len != 2)
+				return -1;
+	
+			options->lease = (p[i] << 8) | p[i + 1];
+			break;
+		case OPT_LENGTH:
+			if (len != 4)
+				return -1;
+	
+			options->length = ((uint32_t)p[i] << 24) | ((uint32_t)p[i + 1] << 16) | ((uint32_t)p[i + 2] << 8) | p[i + 3];
+			break;
+		case OPT_COMPRESS:
+			if (len != 2)
+				return -1;
+	
+			options->dict = (p[i] << 8) | p[i + 1];
+			break;
+		case OPT_JUMBO:
+			if (len != 2)
+				return -1;
+	
+			options->jumbo = (p[i] << 8) | p[i + 1];
+			break;
+		default:
+			break;
+		}
+	
+		if (type < 32)
+			options->present |= 1 << type;
+	
+		i += len;
+	}
+	
+	/* no OPT_END */
+	return -1;
+}
+
+/* write the options flagged in options->present, returns the block length or -1 if size is too small */
+int urest_options_write(char *data, uint16_t size, struct options_s *options)
+{
+	uint8_t *p = (uint8_t *)data;
+	uint16_t i = 0;
+	
+	if (options->present & (1 << OPT_WINDOW)) {
+		if (i + 3 > size)
+			return -1;
+		
+		p[i++] = OPT_WINDOW;
+		p[i++] = 1;
+		p[i++] = options->window;
+	}
+	
+	if (options->present & (1 << OPT_SACK)) {
+		if (i + 6 > size)
+			return -1;
+		
+		p[i++] = OPT_SACK;
+		p[i++] = 4;
+		p[i++] = options->sack >> 24;
+		p[i++] = options->sack >> 16;
+		p[i++] = options->sack >> 8;
+		p[i++] = options->sack;
+	}
+	
+	if (options->present & (1 << OPT_ACK)) {
+		if (i + 4 > size)
+			return -1;
+		
+		p[i++] = OPT_ACK;
+		p[i++] = 2;
+		p[i++] = options->ack >> 8;
+		p[i++] = options->ack;
+	}
+	
+	if (options->present & (1 << OPT_OBSERVE)) {
+		if (i + 4 > size)
+			return -1;
+	
+		p[i++] = OPT_OBSERVE;
+		p[i++] = 2;
+		p[i++] = options->lease >> 8;
+		p[i++] = options->lease;
+	}
+	
+	if (options->present & (1 << OPT_LENGTH)) {
+		if (i + 6 > size)
+			return -1;
+	
+		p[i++] = OPT_LENGTH;
+		p[i++] = 4;
+		p[i++] = options->length >> 24;
+		p[i++] = options->length >> 16;
+		p[i++] = options->length >> 8;
+		p[i++] = options->length;
+	}
+	
+	if (options->present & (1 << OPT_COMPRESS)) {
+		if (i + 4 > size)
+			return -1;
+	
+		p[i++] = OPT_COMPRESS;
+		p[i++] = 2;
+		p[i++] = options->dict >> 8;
+		p[i++] = options->dict;
+	}
+	
+	if (options->present & (1 << OPT_JUMBO)) {
+		if (i + 4 > size)
+			return -1;
+	
+		p[i++] = OPT_JUMBO;
+		p[i++] = 2;
+		p[i++] = options->jumbo >> 8;
+		p[i++] = options->jumbo;
+	}
+	
+	if (i >= size)
+		return -1;
+	
+	p[i++] = OPT_END;
+	
+	return i;
+}
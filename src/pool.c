@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "urest.h"
+
+
+/*
+ * a pool of fixed size slabs carved out of a single preallocated arena. free
+ * slabs are kept on a stack, so taking and returning a slab is O(1) and never
+ * touches the allocator once the pool exists. a pool is owned by one thread.
+ */
+struct pool_s *urest_pool(uint32_t slabs, uint32_t slab_size)
+{
+	struct pool_s *pool;
+	uint32_t i;
+	
+	if (slabs == 0 || slab_size == 0)
+		return 0;
+	
+	pool = malloc(sizeof(struct pool_s));
+	
+	if (!pool)
+		return 0;
+	
+	pool->arena = malloc((size_t)slabs * slab_size);
+	
+	if (!pool->arena) {
+		free(pool);
+	
+		return 0;
+	}
+	
+	pool->free_slab = malloc(slabs * sizeof(char *));
+	
+	if (!pool->free_slab) {
+		free(pool->arena);
+		free(pool);
+	
+		return 0;
+	}
+	
+	/* hand out slabs from the start of the arena first */
+	for (i = 0; i < slabs; i++)
+		pool->free_slab[i] = pool->arena + (size_t)(slabs - i - 1) * slab_size;
+	
+	pool->slabs = slabs;
+	pool->slab_size = slab_size;
+	pool->free = slabs;
+	pool->peak = 0;
+	pool->exhausted = 0;
+	
+	return pool;
+}
+
+/* take a slab, returns null if the pool is empty */
+char *urest_pool_get(struct pool_s *pool)
+{
+	if (pool->free == 0) {
+		pool->exhausted++;
+	
+		return 0;
+	}
+	
+	pool->free--;
+	
+	if (pool->slabs - pool->free > pool->peak)
+		pool->peak = pool->slabs - pool->free;
+	
+	return pool->free_slab[pool->free];
+}
+
+void urest_pool_put(struct pool_s *pool, char *slab)
+{
+	pool->free_slab[pool->free++] = slab;
+}
+
+/* tell whether ptr is the start of a slab of this pool */
+int urest_pool_owns(struct pool_s *pool, char *ptr)
+{
+	if (ptr < pool->arena || ptr >= pool->arena + (size_t)pool->slabs * pool->slab_size)
+		return 0;
+	
+	return (ptr - pool->arena) % pool->slab_size == 0;
+}
+
+/* the slabs go with the pool, none may be in use */
+void urest_pool_free(struct pool_s *pool)
+{
+	free(pool->free_slab);
+	free(pool->arena);
+	free(pool);
+}
+	
+void urest_pool_stats(struct pool_s *pool, struct pool_stats_s *stats)
+{
+	stats->slabs = pool->slabs;
+	stats->in_use = pool->slabs - pool->free;
+	stats->peak = pool->peak;
+	stats->exhausted = pool->exhausted;
+}
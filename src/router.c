@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "urest.h"
+
+#define FNV_OFFSET		2166136261u
+#define FNV_PRIME		16777619u
+
+
+/*
+ * resources are kept in a prefix tree of URI path segments. each node holds its
+ * literal children in an open addressed hash table and at most one templated
+ * child ('{name}'), so a lookup is a single pass over the URI, hashing each
+ * segment as it is scanned.
+ *
+ * readers never take a lock: nodes are fully built before they are published
+ * with a release store, and a table that has to grow is copied and swapped in,
+ * with the old one kept alive for readers still walking it. registration must
+ * be done from a single thread at a time.
+ */
+
+static struct route_node_s *node_new(char *segment, uint16_t len, uint32_t hash)
+{
+	struct route_node_s *node;
+	
+	node = calloc(1, sizeof(struct route_node_s) + len + 1);
+	
+	if (!node)
+		return 0;
+	
+	node->segment = (char *)(node + 1);
+	memcpy(node->segment, segment, len);
+	node->len = len;
+	node->hash = hash;
+	
+	return node;
+}
+
+static int table_insert(struct route_node_s *node, struct route_node_s *child)
+{
+	struct route_table_s *table, *grown;
+	struct route_node_s *slot;
+	uint32_t i, j, size;
+	
+	table = node->children;
+	
+	if (!table || (table->count + 1) * 2 > table->size) {
+		size = table ? table->size * 2 : 4;
+		grown = calloc(1, sizeof(struct route_table_s) + size * sizeof(struct route_node_s *));
+		
+		if (!grown)
+			return -1;
+		
+		grown->size = size;
+		grown->retired = table;
+		
+		for (i = 0; table && i < table->size; i++) {
+			slot = table->slot[i];
+			
+			if (!slot)
+				continue;
+			
+			for (j = slot->hash & (size - 1); grown->slot[j]; j = (j + 1) & (size - 1));
+			
+			grown->slot[j] = slot;
+			grown->count++;
+		}
+		
+		__atomic_store_n(&node->children, grown, __ATOMIC_RELEASE);
+		table = grown;
+	}
+	
+	for (i = child->hash & (table->size - 1); table->slot[i]; i = (i + 1) & (table->size - 1));
+	
+	__atomic_store_n(&table->slot[i], child, __ATOMIC_RELEASE);
+	table->count++;
+	
+	return 0;
+}
+
+static struct route_node_s *table_find(struct route_node_s *node, char *segment, uint16_t len, uint32_t hash)
+{
+	struct route_table_s *table;
+	struct route_node_s *child;
+	uint32_t i;
+	
+	table = __atomic_load_n(&node->children, __ATOMIC_ACQUIRE);
+	
+	if (!table)
+		return 0;
+	
+	for (i = hash & (table->size - 1); (child = __atomic_load_n(&table->slot[i], __ATOMIC_ACQUIRE)); i = (i + 1) & (table->size - 1))
+		if (child->hash == hash && child->len == len && memcmp(child->segment, segment, len) == 0)
+			return child;
+	
+	return 0;
+}
+
+struct router_s *urest_router(void)
+{
+	return calloc(1, sizeof(struct router_s));
+}
+
+/* the children of node, with the tables they were kept in (retired ones too) */
+static void node_free(struct route_node_s *node)
+{
+	struct route_table_s *table, *retired;
+	uint32_t i;
+	
+	table = node->children;
+	
+	for (i = 0; table && i < table->size; i++)
+		if (table->slot[i]) {
+			node_free(table->slot[i]);
+			free(table->slot[i]);
+		}
+	
+	while (table) {
+		retired = table->retired;
+		free(table);
+		table = retired;
+	}
+	
+	if (node->param) {
+		node_free(node->param);
+		free(node->param);
+	}
+}
+
+/* free a router no one reads any more, the resources are left alone */
+void urest_router_free(struct router_s *router)
+{
+	node_free(&router->root);
+	free(router);
+}
+
+/*
+ * register a resource under uri. segments written as '{name}' match any non
+ * empty segment, which is captured as a parameter of the request.
+ */
+int urest_route_add(struct router_s *router, char *uri, struct resource_s *resource)
+{
+	struct route_node_s *node = &router->root, *child;
+	uint32_t hash;
+	uint16_t len;
+	char *p;
+	
+	if (*uri != '/')
+		return -1;
+	
+	do {
+		uri++;
+		hash = FNV_OFFSET;
+		
+		for (p = uri; *p && *p != '/' && *p != '?'; p++)
+			hash = (hash ^ (uint8_t)*p) * FNV_PRIME;
+		
+		len = p - uri;
+		
+		if (len > 2 && uri[0] == '{' && uri[len - 1] == '}') {
+			child = node->param;
+			
+			if (!child) {
+				child = node_new(uri + 1, len - 2, 0);
+				
+				if (!child)
+					return -1;
+				
+				__atomic_store_n(&node->param, child, __ATOMIC_RELEASE);
+			}
+		} else {
+			child = table_find(node, uri, len, hash);
+			
+			if (!child) {
+				child = node_new(uri, len, hash);
+				
+				if (!child || table_insert(node, child) < 0) {
+					free(child);
+					
+					return -1;
+				}
+			}
+		}
+		
+		node = child;
+		uri = p;
+	} while (*uri == '/');
+	
+	__atomic_store_n(&node->resource, resource, __ATOMIC_RELEASE);
+	
+	return 0;
+}
+
+static struct resource_s *match(struct route_node_s *node, char *uri, struct request_s *request)
+{
+	struct route_node_s *child;
+	struct resource_s *resource;
+	uint32_t hash = FNV_OFFSET;
+	uint16_t len;
+	char *p;
+	
+	for (p = uri; *p && *p != '/' && *p != '?' && *p != '"'; p++)
+		hash = (hash ^ (uint8_t)*p) * FNV_PRIME;
+	
+	len = p - uri;
+	
+	/* literal segments take precedence over parameters */
+	child = table_find(node, uri, len, hash);
+	
+	if (child) {
+		if (*p == '/')
+			resource = match(child, p + 1, request);
+		else
+			resource = __atomic_load_n(&child->resource, __ATOMIC_ACQUIRE);
+		
+		if (resource)
+			return resource;
+	}
+	
+	child = __atomic_load_n(&node->param, __ATOMIC_ACQUIRE);
+	
+	if (!child || len == 0 || request->params == UREST_MAX_PARAMS)
+		return 0;
+	
+	request->param[request->params].name = child->segment;
+	request->param[request->params].value = uri;
+	request->param[request->params].len = len;
+	request->params++;
+	
+	if (*p == '/')
+		resource = match(child, p + 1, request);
+	else
+		resource = __atomic_load_n(&child->resource, __ATOMIC_ACQUIRE);
+	
+	if (!resource)
+		request->params--;
+	
+	return resource;
+}
+
+/*
+ * find the resource for uri (terminated by '?', '\0' or the '"' closing it in
+ * a JSON request). captured parameters are appended to request, pointing into
+ * uri.
+ */
+struct resource_s *urest_route(struct router_s *router, char *uri, struct request_s *request)
+{
+	if (*uri != '/')
+		return 0;
+	
+	return match(&router->root, uri + 1, request);
+}
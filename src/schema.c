@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "urest.h"
+
+#define NUMBER_SIZE		40			/* longest number taken */
+
+static const char type[] = {'i', 'i', 'f', 's', 'b'};		/* of each field_type but FIELD_STRUCT */
+
+
+/*
+ * uREST encoding (type 1) of C structures. a schema lists the fields of a
+ * structure in order, and the encoding follows it:
+ *
+ *	{i:1234,f:55.123,s:{hello world},{f:75.5555,f:9.5},i:5093;-6467;253}
+ *
+ * integers (i), floats (f), strings (s, in braces) and blobs (b, base32) are a
+ * type, ':' and the values of an array separated by ';'. nested structures are
+ * in braces, arrays of them separated by ';' too. values are read and written
+ * straight from and to the structure, nothing is allocated. strings can not hold
+ * '}', as there are no escapes.
+ */
+
+static uint32_t stride(const struct field_s *field)
+{
+	return field->type == FIELD_INT || field->type == FIELD_UINT || field->type == FIELD_FLOAT ? field->size : field->length;
+}
+
+static int64_t int_get(const char *p, uint8_t size)
+{
+	int8_t i8;
+	int16_t i16;
+	int32_t i32;
+	int64_t i64;
+	
+	switch (size) {
+	case 1: memcpy(&i8, p, 1); return i8;
+	case 2: memcpy(&i16, p, 2); return i16;
+	case 4: memcpy(&i32, p, 4); return i32;
+	default: memcpy(&i64, p, 8); return i64;
+	}
+}
+
+static uint64_t uint_get(const char *p, uint8_t size)
+{
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+	
+	switch (size) {
+	case 1: memcpy(&u8, p, 1); return u8;
+	case 2: memcpy(&u16, p, 2); return u16;
+	case 4: memcpy(&u32, p, 4); return u32;
+	default: memcpy(&u64, p, 8); return u64;
+	}
+}
+
+/* little or big endian, the low size bytes of v are the value */
+static void uint_set(char *p, uint8_t size, uint64_t v)
+{
+	uint8_t u8 = v;
+	uint16_t u16 = v;
+	uint32_t u32 = v;
+	
+	switch (size) {
+	case 1: memcpy(p, &u8, 1); break;
+	case 2: memcpy(p, &u16, 2); break;
+	case 4: memcpy(p, &u32, 4); break;
+	default: memcpy(p, &v, 8); break;
+	}
+}
+
+static int put_char(char *out, uint16_t size, uint16_t *len, char c)
+{
+	if (*len + 1 >= size)
+		return -1;
+	
+	out[(*len)++] = c;
+	
+	return 0;
+}
+
+static int put_uint(char *out, uint16_t size, uint16_t *len, uint64_t v)
+{
+	char digits[20];
+	int n = 0;
+	
+	do {
+		digits[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	
+	while (n)
+		if (put_char(out, size, len, digits[--n]) < 0)
+			return -1;
+	
+	return 0;
+}
+
+static int encode_value(const struct field_s *field, const char *p, char *out, uint16_t size, uint16_t *len)
+{
+	int64_t i;
+	double d;
+	int n, digits;
+	
+	switch (field->type) {
+	case FIELD_INT:
+		i = int_get(p, field->size);
+	
+		if (i < 0 && put_char(out, size, len, '-') < 0)
+			return -1;
+	
+		return put_uint(out, size, len, i < 0 ? -(uint64_t)i : (uint64_t)i);
+	case FIELD_UINT:
+		return put_uint(out, size, len, uint_get(p, field->size));
+	case FIELD_FLOAT:
+		d = field->size == sizeof(float) ? *(const float *)p : *(const double *)p;
+	
+		/* the shortest that reads back the same */
+		for (digits = 6; ; digits++) {
+			n = snprintf(out + *len, size - *len, "%.*g", digits, d);
+	
+			if (n < 0 || n >= size - *len)
+				return -1;
+	
+			if (digits == (field->size == sizeof(float) ? 9 : 17) ||
+				(field->size == sizeof(float) ? (float)strtod(out + *len, 0) == (float)d : strtod(out + *len, 0) == d))
+				break;
+		}
+	
+		*len += n;
+	
+		return 0;
+	case FIELD_STRING:
+		if (put_char(out, size, len, '{') < 0)
+			return -1;
+	
+		for (n = 0; n < field->length && p[n]; n++)
+			if (p[n] == '}' || put_char(out, size, len, p[n]) < 0)
+				return -1;
+	
+		return put_char(out, size, len, '}');
+	case FIELD_BLOB:
+		n = base32_encode((char *)p, field->length, out + *len, size - *len);
+	
+		if (n < 0)
+			return -1;
+	
+		*len += n;
+	
+		return 0;
+	default:
+		n = urest_encode(field->schema, p, out + *len, size - *len);
+	
+		if (n < 0)
+			return -1;
+	
+		*len += n;
+	
+		return 0;
+	}
+}
+
+/*
+ * encode the structure at in into out, of size bytes (null terminated).
+ * returns the length encoded, or -1 if it does not fit.
+ */
+int urest_encode(const struct schema_s *schema, const void *in, char *out, uint16_t size)
+{
+	const struct field_s *field;
+	uint16_t len = 0, f, i;
+	const char *p;
+	
+	if (put_char(out, size, &len, '{') < 0)
+		return -1;
+	
+	for (f = 0; f < schema->fields; f++) {
+		field = &schema->field[f];
+	
+		if (f && put_char(out, size, &len, ',') < 0)
+			return -1;
+	
+		if (field->type != FIELD_STRUCT && (put_char(out, size, &len, type[field->type]) < 0 || put_char(out, size, &len, ':') < 0))
+			return -1;
+	
+		for (i = 0; i < field->count; i++) {
+			p = (const char *)in + field->offset + i * stride(field);
+	
+			if ((i && put_char(out, size, &len, ';') < 0) || encode_value(field, p, out, size, &len) < 0)
+				return -1;
+		}
+	}
+	
+	if (put_char(out, size, &len, '}') < 0)
+		return -1;
+	
+	out[len] = '\0';
+	
+	return len;
+}
+
+/* the end of a value, at the next delimiter */
+static const char *value_end(const char *p, const char *end)
+{
+	while (p < end && *p != ',' && *p != ';' && *p != '}')
+		p++;
+	
+	return p;
+}
+
+static const char *decode_int(const struct field_s *field, const char *p, const char *end, char *out)
+{
+	uint64_t v = 0, max;
+	int neg = 0;
+	const char *start;
+	
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	
+	max = field->type == FIELD_UINT ? (field->size == 8 ? UINT64_MAX : (1ull << field->size * 8) - 1) : (1ull << (field->size * 8 - 1)) - 1 + neg;
+	
+	for (start = p; p < end && *p >= '0' && *p <= '9'; p++) {
+		if (v > (max - (*p - '0')) / 10)
+			return 0;
+	
+		v = v * 10 + *p - '0';
+	}
+	
+	if (p == start || (neg && field->type == FIELD_UINT && v))
+		return 0;
+	
+	uint_set(out, field->size, neg ? -v : v);
+	
+	return p;
+}
+
+static const char *decode_float(const struct field_s *field, const char *p, const char *end, char *out)
+{
+	char number[NUMBER_SIZE], *e;
+	const char *q = value_end(p, end);
+	double d;
+	
+	if (q == p || q - p >= NUMBER_SIZE)
+		return 0;
+	
+	memcpy(number, p, q - p);
+	number[q - p] = '\0';
+	d = strtod(number, &e);
+	
+	if (*e)
+		return 0;
+	
+	if (field->size == sizeof(float))
+		*(float *)out = d;
+	else
+		*(double *)out = d;
+	
+	return q;
+}
+
+static const char *decode_string(const struct field_s *field, const char *p, const char *end, char *out)
+{
+	const char *q;
+	
+	if (p == end || *p++ != '{')
+		return 0;
+	
+	q = memchr(p, '}', end - p);
+	
+	if (!q || q - p >= field->length)
+		return 0;
+	
+	memcpy(out, p, q - p);
+	out[q - p] = '\0';
+	
+	return q + 1;
+}
+
+/*
+ * the bulk of a blob is decoded in place. base32_decode() terminates what it
+ * writes, so the last group goes through a few bytes on the stack.
+ */
+static const char *decode_blob(const struct field_s *field, const char *p, const char *end, char *out)
+{
+	const char *q = value_end(p, end);
+	uint32_t n = q - p, bulk = n ? (n - 1) / 8 * 8 : 0;
+	char last[8];
+	int len, tail;
+	
+	if (BASE32_DECODED(bulk) > field->length)
+		return 0;
+	
+	len = base32_decode((char *)p, bulk, out, field->length);
+	tail = len < 0 ? -1 : base32_decode((char *)p + bulk, n - bulk, last, sizeof(last));
+	
+	if (tail < 0 || len + tail > field->length)
+		return 0;
+	
+	memcpy(out + len, last, tail);
+	memset(out + len + tail, 0, field->length - len - tail);
+	
+	return q;
+}
+
+static const char *decode_struct(const struct schema_s *schema, const char *p, const char *end, char *out)
+{
+	const struct field_s *field;
+	uint16_t f, i;
+	char *v;
+	
+	if (p == end || *p++ != '{')
+		return 0;
+	
+	for (f = 0; f < schema->fields && p; f++) {
+		field = &schema->field[f];
+	
+		if (f && (p == end || *p++ != ','))
+			return 0;
+	
+		if (field->type != FIELD_STRUCT && (end - p < 2 || p[0] != type[field->type] || p[1] != ':'))
+			return 0;
+	
+		if (field->type != FIELD_STRUCT)
+			p += 2;
+	
+		/* an array may be shorter than the field, not longer */
+		for (i = 0; p && i < field->count; i++) {
+			if (i && (p == end || *p != ';'))
+				break;
+	
+			if (i)
+				p++;
+	
+			v = out + field->offset + i * stride(field);
+	
+			switch (field->type) {
+			case FIELD_INT:
+			case FIELD_UINT: p = decode_int(field, p, end, v); break;
+			case FIELD_FLOAT: p = decode_float(field, p, end, v); break;
+			case FIELD_STRING: p = decode_string(field, p, end, v); break;
+			case FIELD_BLOB: p = decode_blob(field, p, end, v); break;
+			default: p = decode_struct(field->schema, p, end, v); break;
+			}
+		}
+	}
+	
+	if (!p || p == end || *p != '}')
+		return 0;
+	
+	return p + 1;
+}
+
+/*
+ * decode len bytes of data into the structure at out. a request as handlers get
+ * it (with the uri) is taken from the '?' on. fields missing at the end of an
+ * array are left as they were. returns the length decoded, or -1 if the data
+ * does not follow the schema or a value does not fit.
+ */
+int urest_decode(const struct schema_s *schema, char *data, uint16_t len, void *out)
+{
+	const char *p = data, *end = data + len, *q;
+	
+	if (len && *data == '/') {
+		p = memchr(data, '?', len);
+	
+		if (!p)
+			return -1;
+	
+		p++;
+	}
+	
+	q = decode_struct(schema, p, end, (char *)out);
+	
+	return q ? q - data : -1;
+}
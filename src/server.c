@@ -4,46 +4,12 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <signal.h>
+#include <fcntl.h>
 #include "urest.h"
- 
-#define BUFLEN			1024
-#define UDP_TIMEOUT_SEC		0			/* socket timeout (in sec) */
-#define UDP_TIMEOUT_USEC	100000			/* socket timeout (in usec) */
-
-struct socket_ctx_s {
-	struct sockaddr_in si_me, si_other;
-	int s, slen, recv_len;
-	struct timeval tv;
-};
-
-void serv_packet_recv(void *arg, char *data, uint16_t *size)
-{
-	struct socket_ctx_s *sock = (struct socket_ctx_s *)arg;
-	
-	memset(data, 0, BUFLEN);
- 
-	/* try to receive some data, this is a blocking call */
-	if ((sock->recv_len = recvfrom(sock->s, data, BUFLEN, 0, (struct sockaddr *)&sock->si_other, (socklen_t *)&sock->slen)) == -1) {
-		*size = 0;
-		
-		return;
-	} else {
-		*size = sock->recv_len;
-	}
-
-	/* print details of the client/peer and the data received */
-/*	printf("Received data from %s:%d\n", inet_ntoa(sock->si_other.sin_addr), ntohs(sock->si_other.sin_port));*/
-}
-
-void serv_packet_send(void *arg, char *data, uint16_t size)
-{
-	struct socket_ctx_s *sock = (struct socket_ctx_s *)arg;
-	
-	if (sendto(sock->s, data, size, 0, (struct sockaddr *) &sock->si_other, sock->slen) == -1)
-		printf("error sending data.\n");
-		
-}
 
+/* the uris and keys of the lights, shared with the client to pack payloads */
+#define DICTIONARY		"/lights/light1/lights/light2/lights/light3/lights/scene?value:on:off:status:updated:"
 
 void light1_get(void *arg)
 {
@@ -56,12 +22,19 @@ void light1_get(void *arg)
 
 void light1_put(void *arg)
 {
+	struct flat_writer_s writer;
+	char value[32] = "";
 	int len;
 	
 	len = strlen((char *)arg);
 	
 	printf("light 1 PUT len %d: %s\n", len, (char *)arg);
-	strcpy((char *)arg, "value updated!");
+	
+	/* the response goes over the request, read first */
+	urest_flat_get((char *)arg, "value", value, sizeof(value));
+	urest_flat_writer(&writer, (char *)arg, UREST_REQ_BUF_SIZE);
+	urest_flat_put(&writer, "value", value);
+	urest_flat_put(&writer, "status", "updated");
 }
 
 void light2_get(void *arg)
@@ -71,97 +44,276 @@ void light2_get(void *arg)
 	len = strlen((char *)arg);
 	
 	printf("light 2 GET len %d: %s\n", len, (char *)arg);
+	
+	/* a slow sensor, read on an offload thread while polls get 2.02 */
+	usleep(200000);
 }
 
 void light2_put(void *arg)
 {
+	struct flat_s flat;
+	struct flat_field_s key, value;
+	char k[32], v[64];
 	int len;
 	
 	len = strlen((char *)arg);
 	
 	printf("light 2 PUT len %d: %s\n", len, (char *)arg);
+	
+	urest_flat(&flat, (char *)arg, len);
+	
+	while (urest_flat_next(&flat, &key, &value))
+		if (urest_flat_copy(&key, k, sizeof(k)) >= 0 && urest_flat_copy(&value, v, sizeof(v)) >= 0)
+			printf("  %s = %s\n", k, v);
 }
-
-
-int main(int argc, char **argv)
+	
+/* light 3 takes and returns its state uREST encoded, straight from the struct */
+struct light_s {
+	int on;
+	float level;
+	char color[16];
+};
+	
+static const struct field_s light_fields[] = {
+	UREST_INT(struct light_s, on),
+	UREST_FLOAT(struct light_s, level),
+	UREST_STRING(struct light_s, color)
+};
+	
+static const struct schema_s light_schema = UREST_SCHEMA(light_fields);
+static struct light_s light3 = {0, 0.0, "white"};
+	
+void light3_get(void *arg)
 {
-	struct socket_ctx_s sock;
-	char packet[BUFLEN];
-	int err;
+	urest_encode(&light_schema, &light3, (char *)arg, UREST_REQ_BUF_SIZE);
+}
 	
-	if (argc != 2) {
-		printf("Usage: %s <port>\n", argv[0]);
-		
-		return -1;
+/* members of a JSON request for light 3, the uri is one of them */
+struct light_json_s {
+	struct light_s light;
+	char key[8];
+	uint16_t len;					/* of the color so far */
+};
+	
+static int light3_member(void *arg, uint8_t event, char *data, uint16_t len)
+{
+	struct light_json_s *json = arg;
+	char number[24];
+	
+	switch (event & ~JSON_PART) {
+	case JSON_KEY:
+		snprintf(json->key, sizeof(json->key), "%.*s", len, data);
+		json->len = 0;
+		break;
+	case JSON_TRUE:
+	case JSON_FALSE:
+		if (!strcmp(json->key, "on"))
+			json->light.on = event == JSON_TRUE;
+	
+		break;
+	case JSON_NUMBER:
+		if (!strcmp(json->key, "level") && len < sizeof(number)) {
+			memcpy(number, data, len);
+			number[len] = '\0';
+			json->light.level = strtof(number, 0);
+		}
+	
+		break;
+	case JSON_STRING:
+		if (!strcmp(json->key, "color")) {
+			if (json->len + len >= sizeof(json->light.color))
+				return -1;
+	
+			memcpy(json->light.color + json->len, data, len);
+			json->len += len;
+			json->light.color[json->len] = '\0';
+		}
+	
+		break;
 	}
+	
+	return 0;
+}
+	
+void light3_put(void *arg)
+{
+	struct light_s light = light3;
+	struct light_json_s member;
+	struct json_s json;
+	
+	printf("light 3 PUT: %s\n", (char *)arg);
+	
+	/* a JSON request gets a JSON response */
+	if (urest_request()->content == JSON_ENC) {
+		member.light = light3;
+		member.key[0] = '\0';
+		member.len = 0;
+		urest_json(&json, light3_member, &member);
+	
+		if (urest_json_parse(&json, (char *)arg, strlen((char *)arg)) == 0 && urest_json_end(&json) == 0)
+			light3 = member.light;
+	
+		snprintf((char *)arg, UREST_REQ_BUF_SIZE, "{\"on\":%s,\"level\":%g,\"color\":\"%s\"}",
+			light3.on ? "true" : "false", light3.level, light3.color);
+	
+		return;
+	}
+	
+	if (urest_request()->content == UREST_ENC && urest_decode(&light_schema, (char *)arg, strlen((char *)arg), &light) >= 0)
+		light3 = light;
+	
+	urest_encode(&light_schema, &light3, (char *)arg, UREST_REQ_BUF_SIZE);
+}
 
-	sock.tv.tv_sec = UDP_TIMEOUT_SEC;
-	sock.tv.tv_usec = UDP_TIMEOUT_USEC;
-
-	/* create a UDP socket */
-	if ((sock.s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
-		printf("error creating socket.\n");
-		
-		return -1;
+	
+/* the scene takes raw levels, a byte per light, and answers them back inverted */
+void scene_put(void *arg)
+{
+	struct request_s *request = urest_request();
+	char *levels = memchr((char *)arg, '?', request->length);
+	uint16_t i, n;
+	
+	if (!request->binary || !levels) {
+		strcpy((char *)arg, "status:binary only");
+	
+		return;
 	}
 	
-	if (setsockopt(sock.s, SOL_SOCKET, SO_RCVTIMEO, &sock.tv, sizeof(sock.tv)) < 0) {
-		printf("error setting socket.\n");
-		
-		return -1;
+	levels++;
+	n = request->length - (levels - (char *)arg);
+	printf("scene PUT: %d levels\n", n);
+	
+	for (i = 0; i < n; i++)
+		((char *)arg)[i] = ~levels[i];
+	
+	request->length = n;
+}
+	
+#ifdef UREST_TRACE
+/* ^C leaves the events recorded in urest.trace, for trace_report */
+void trace_exit(int sig)
+{
+	int fd;
+	
+	fd = open("urest.trace", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	
+	if (fd >= 0) {
+		urest_trace_dump(fd);
+		close(fd);
 	}
+	
+	_exit(0);
+}
+#endif
+	
 
-	sock.slen = sizeof(sock.si_other);
-	
-	/* zero out the structure */
-	memset((char *) &sock.si_me, 0, sizeof(sock.si_me));
-     
-	sock.si_me.sin_family = AF_INET;
-	sock.si_me.sin_port = htons(atoi(argv[1]));
-	sock.si_me.sin_addr.s_addr = htonl(INADDR_ANY);
-     
-	/* bind socket to port */
-	if (bind(sock.s, (struct sockaddr *)&sock.si_me, sizeof(sock.si_me)) == -1) {
-		printf("error binding to socket.\n");
+int main(int argc, char **argv)
+{
+	struct event_loop_s *loop;
+	struct workers_s *workers;
+	struct offload_s *offload;
+	struct stats_s *stats;
+	struct dict_s dict;
+	
+	if (argc != 2 && argc != 3) {
+		printf("Usage: %s <port> [workers]\n", argv[0]);
 		
 		return -1;
 	}
 
-
-	struct serv_packet_s socket;
-	
-	socket.packet_arg = &sock;
-	socket.packet = packet;
-	socket.packet_handler_recv = serv_packet_recv;
-	socket.packet_handler_send = serv_packet_send;
-
-
 	struct resource_list_s *list;
 	
 	list = urest_resource_list();
 
 	
-	struct resource_s *resource1, *resource2;
+	struct resource_s *resource1, *resource2, *resource3, *resource4;
 	resource1 = urest_resource_endpoint("light 1", "/lights/light1");
 	resource2 = urest_resource_endpoint("light 2", "/lights/light2");
+	resource3 = urest_resource_endpoint("light 3", "/lights/light3");
+	resource4 = urest_resource_endpoint("scene", "/lights/scene");
 
 	urest_resource_handler(resource1, light1_get, GET);
 	urest_resource_handler(resource1, light1_put, PUT);
 	urest_resource_handler(resource2, light2_get, GET);
 	urest_resource_handler(resource2, light2_put, PUT);
+	urest_resource_handler(resource3, light3_get, GET);
+	urest_resource_handler(resource3, light3_put, PUT);
+	urest_resource_handler(resource4, scene_put, PUT);
+	urest_resource_slow(resource2, GET);
 	
 	urest_register_resource(list, resource1);
 	urest_register_resource(list, resource2);
+	urest_register_resource(list, resource3);
+	urest_register_resource(list, resource4);
+	
+	urest_dict(&dict, DICTIONARY, strlen(DICTIONARY));
 	
-	/* keep listening for data */
-	while (1) {
-		err = urest_handle_request(&socket, list);
-		if (err) {
-			printf("WARNING: urest_handle_request() exited with error code %d\n", err);
+#ifdef UREST_TRACE
+	signal(SIGINT, trace_exit);
+	signal(SIGTERM, trace_exit);
+#endif
+	
+	/* metrics, served at /.well-known/stats */
+	stats = urest_stats();
+	
+	if (!stats) {
+		printf("error creating stats.\n");
+	
+		return -1;
+	}
+	
+	/* threads for slow handlers */
+	offload = urest_offload(2, UREST_OFFLOAD_QUEUE);
+	
+	if (!offload) {
+		printf("error creating offload threads.\n");
+	
+		return -1;
+	}
+	
+	/* one event loop per core, sharing the port */
+	if (argc == 3) {
+		workers = urest_workers(list, UREST_TRANSACTIONS, atoi(argv[2]));
+		
+		if (!workers || urest_workers_listen(workers, 0, atoi(argv[1])) < 0) {
+			printf("error creating workers.\n");
+			
+			return -1;
 		}
+	
+		urest_workers_offload(workers, offload);
+		urest_workers_compress(workers, &dict, 16);
+		urest_workers_limit(workers, 256, 20, 40, UREST_TRANSACTIONS - 2);
+		urest_workers_stats(workers, stats);
+		urest_workers_run(workers);
+		
+		return 0;
 	}
-
-	close(sock.s);
+	
+	loop = urest_event_loop(list, UREST_TRANSACTIONS);
+	
+	if (!loop) {
+		printf("error creating event loop.\n");
+	
+		return -1;
+	}
+	
+	urest_responder_offload(loop->responder, offload);
+	urest_responder_compress(loop->responder, &dict, 16);
+	
+	/* 20 new transactions per second and peer (40 at once), and 14 in progress at most */
+	urest_responder_limit(loop->responder, 256, 20, 40, UREST_TRANSACTIONS - 2);
+	urest_responder_stats(loop->responder, stats);
+	
+	/* bind a non-blocking UDP socket to the port */
+	if (urest_event_listen(loop, 0, atoi(argv[1])) < 0) {
+		printf("error binding to socket.\n");
+		
+		return -1;
+	}
+	
+	/* keep serving requests, sleeping while idle */
+	urest_event_run(loop);
 	
 	return 0;
 }
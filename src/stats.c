@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "urest.h"
+
+static const char *phase_name[PHASES] = {"reassembly", "handler", "response"};
+static const char *error_name[UREST_ERRORS] = {"unknown_fragment_size", "fragment_size_mismatch", "sequence_mismatch", "wrong_token", "request_failed", "bad_options"};
+static const char *method_name[4] = {"get", "post", "put", "delete"};
+
+
+/*
+ * responder metrics. counters and histograms are shared by all responders they
+ * are attached to and updated with relaxed atomic adds, no locks: a scrape may
+ * see one counter a little ahead of another, never a torn value.
+ */
+struct stats_s *urest_stats(void)
+{
+	return calloc(1, sizeof(struct stats_s));
+}
+
+uint32_t urest_stats_clock(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* log-linear buckets: 0 and 1, then two per power of two, the upper half of it second */
+static uint8_t bucket(uint32_t us)
+{
+	uint8_t msb;
+	
+	if (us < 2)
+		return us;
+	
+	msb = 31 - __builtin_clz(us);
+	
+	return 2 * msb + ((us >> (msb - 1)) & 1);
+}
+
+/* the lowest time (us) in a bucket */
+static uint32_t bucket_floor(uint8_t b)
+{
+	if (b < 2)
+		return b;
+	
+	return (1u << (b / 2)) | ((uint32_t)(b & 1) << (b / 2 - 1));
+}
+
+void urest_stats_time(struct stats_s *stats, uint8_t phase, uint32_t us)
+{
+	__atomic_fetch_add(&stats->hist[phase][bucket(us)], 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t get(uint32_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/*
+ * write the metrics flat encoded into buf, of size bytes: totals, the error codes
+ * returned by urest_process_packet(), load shed, transactions by resource and
+ * method ("<uri>.get") and the histograms ("<phase>.<us>", the lowest time in the
+ * bucket). counters and buckets still at 0 are left out. returns 0, or -1 if it
+ * was cut short.
+ */
+int urest_stats_write(struct stats_s *stats, struct resource_list_s *resource_list, char *buf, uint16_t size)
+{
+	struct flat_writer_s writer;
+	struct resource_list_s *node;
+	char key[UREST_OBSERVE_URI + 16];
+	int status = 0, i, b;
+	
+	urest_flat_writer(&writer, buf, size);
+	status |= urest_flat_put_int(&writer, "transactions", get(&stats->transactions));
+	status |= urest_flat_put_int(&writer, "failed", get(&stats->failed));
+	status |= urest_flat_put_int(&writer, "retries", get(&stats->retries));
+	
+	for (i = 0; i < UREST_ERRORS; i++)
+		if (get(&stats->errors[i]))
+			status |= urest_flat_put_int(&writer, (char *)error_name[i], get(&stats->errors[i]));
+	
+	status |= urest_flat_put_int(&writer, "shed_busy", get(&stats->shed.busy));
+	status |= urest_flat_put_int(&writer, "shed_rate", get(&stats->shed.rate));
+	
+	for (node = resource_list; node && node->next; node = node->next) {
+		for (i = 0; i < 4; i++) {
+			if (!get(&node->resource->count[i]))
+				continue;
+	
+			snprintf(key, sizeof(key), "%s.%s", node->resource->endpoint_uri, method_name[i]);
+			status |= urest_flat_put_int(&writer, key, get(&node->resource->count[i]));
+		}
+	
+		if (get(&node->resource->failed)) {
+			snprintf(key, sizeof(key), "%s.failed", node->resource->endpoint_uri);
+			status |= urest_flat_put_int(&writer, key, get(&node->resource->failed));
+		}
+	}
+	
+	for (i = 0; i < PHASES; i++) {
+		for (b = 0; b < UREST_HIST_BUCKETS; b++) {
+			if (!get(&stats->hist[i][b]))
+				continue;
+	
+			snprintf(key, sizeof(key), "%s.%u", phase_name[i], bucket_floor(b));
+			status |= urest_flat_put_int(&writer, key, get(&stats->hist[i][b]));
+		}
+	}
+	
+	return status ? -1 : 0;
+}
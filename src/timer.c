@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "urest.h"
+
+
+/*
+ * retransmission timeout of a peer, estimated from the RTT of fragments that
+ * were not sent again (RFC 6298, with the clock granularity of urest_clock()).
+ */
+void urest_rtt_init(struct rtt_s *rtt)
+{
+	rtt->srtt = 0;
+	rtt->rttvar = 0;
+	rtt->rto = UREST_RTO_INITIAL;
+}
+
+void urest_rtt_sample(struct rtt_s *rtt, uint32_t sample)
+{
+	int32_t delta;
+	uint32_t rto;
+	
+	if (rtt->srtt == 0) {
+		rtt->srtt = (sample << 3) | 1;
+		rtt->rttvar = sample << 1;
+	} else {
+		delta = (sample << 3) - rtt->srtt;
+		rtt->srtt += delta >> 3;
+		
+		if (delta < 0)
+			delta = -delta;
+		
+		rtt->rttvar += ((delta >> 1) - (int32_t)rtt->rttvar) >> 2;
+	}
+	
+	/* srtt + 4 * rttvar, at least one clock tick of variation */
+	rto = (rtt->srtt >> 3) + (rtt->rttvar > 1 ? rtt->rttvar : 1);
+	
+	if (rto < UREST_RTO_MIN)
+		rto = UREST_RTO_MIN;
+	
+	if (rto > UREST_RTO_MAX)
+		rto = UREST_RTO_MAX;
+	
+	rtt->rto = rto;
+}
+
+/*
+ * the time to wait for an ACK, doubled for each retry. retries get up to a
+ * quarter more at random, so peers that lost fragments together do not send
+ * them again in lockstep.
+ */
+uint32_t urest_rtt_timeout(struct rtt_s *rtt, uint8_t retries)
+{
+	uint32_t timeout = rtt->rto;
+	
+	if (!retries)
+		return timeout;
+	
+	while (retries-- && timeout < UREST_RTO_MAX)
+		timeout <<= 1;
+	
+	if (timeout > UREST_RTO_MAX)
+		timeout = UREST_RTO_MAX;
+	
+	return timeout + random() % (timeout / 4 + 1);
+}
+
+/*
+ * a hashed timer wheel with one slot per ms. timers further away than a turn
+ * stay in their slot until it comes around with them due, so setting and
+ * cancelling a timer is O(1) and each tick only looks at one slot.
+ */
+void urest_wheel_init(struct wheel_s *wheel, uint32_t now)
+{
+	uint32_t i;
+	
+	for (i = 0; i < UREST_WHEEL_SLOTS; i++) {
+		wheel->slot[i].next = &wheel->slot[i];
+		wheel->slot[i].prev = &wheel->slot[i];
+	}
+	
+	wheel->now = now;
+	wheel->pending = 0;
+}
+
+void urest_timer_set(struct wheel_s *wheel, struct timer_s *timer, uint32_t expires)
+{
+	struct timer_s *head;
+	
+	if (timer->next)
+		urest_timer_cancel(wheel, timer);
+	
+	/* already due, handled on the next tick */
+	if ((int32_t)(expires - wheel->now) < 0)
+		expires = wheel->now;
+	
+	head = &wheel->slot[expires & (UREST_WHEEL_SLOTS - 1)];
+	timer->expires = expires;
+	timer->next = head->next;
+	timer->prev = head;
+	head->next->prev = timer;
+	head->next = timer;
+	wheel->pending++;
+}
+
+void urest_timer_cancel(struct wheel_s *wheel, struct timer_s *timer)
+{
+	if (!timer->next)
+		return;
+	
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = 0;
+	wheel->pending--;
+}
+
+/*
+ * handle the ticks up to now, handler(arg, timer) is called for each timer that
+ * expired, after it is taken off the wheel (it may be set again from there).
+ * returns the number of timers expired.
+ */
+int urest_wheel_advance(struct wheel_s *wheel, uint32_t now, void (*handler)(void *, struct timer_s *), void *arg)
+{
+	struct timer_s due, *head, *timer, *next;
+	uint32_t ticks;
+	int expired = 0;
+	
+	if ((int32_t)(now - wheel->now) < 0)
+		return 0;
+	
+	/* a whole turn or more visits every slot once */
+	ticks = now - wheel->now + 1;
+	
+	if (ticks > UREST_WHEEL_SLOTS)
+		ticks = UREST_WHEEL_SLOTS;
+	
+	due.next = &due;
+	due.prev = &due;
+	
+	while (ticks-- && wheel->pending) {
+		head = &wheel->slot[(now - ticks) & (UREST_WHEEL_SLOTS - 1)];
+	
+		for (timer = head->next; timer != head; timer = next) {
+			next = timer->next;
+	
+			if ((int32_t)(timer->expires - now) > 0)
+				continue;
+	
+			/* moved aside first, handlers may set or cancel any timer */
+			timer->prev->next = timer->next;
+			timer->next->prev = timer->prev;
+			timer->next = due.next;
+			timer->prev = &due;
+			due.next->prev = timer;
+			due.next = timer;
+		}
+	}
+	
+	wheel->now = now + 1;
+	
+	while (due.next != &due) {
+		timer = due.next;
+		urest_timer_cancel(wheel, timer);
+		handler(arg, timer);
+		expired++;
+	}
+	
+	return expired;
+}
+
+/* ms until the next slot holding a timer comes up, -1 if none are pending */
+int urest_wheel_next(struct wheel_s *wheel, uint32_t now)
+{
+	uint32_t i;
+	
+	if (!wheel->pending)
+		return -1;
+	
+	if ((int32_t)(wheel->now - now) <= 0)
+		return 0;
+	
+	for (i = 0; i < UREST_WHEEL_SLOTS; i++) {
+		if (wheel->slot[(wheel->now + i) & (UREST_WHEEL_SLOTS - 1)].next != &wheel->slot[(wheel->now + i) & (UREST_WHEEL_SLOTS - 1)])
+			return wheel->now + i - now;
+	}
+	
+	return UREST_WHEEL_SLOTS;
+}
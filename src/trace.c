@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "urest.h"
+
+struct trace_ring_s {
+	struct trace_event_s event[UREST_TRACE_EVENTS];
+	uint32_t head;					/* events recorded, ever */
+	uint8_t thread;
+	struct trace_ring_s *next;
+};
+
+static __thread struct trace_ring_s *ring;
+static struct trace_ring_s *rings;
+static uint8_t threads;
+
+
+/*
+ * transaction tracing. each thread records into a ring of its own, taken on its
+ * first event and never given back, so recording is a few stores and no locks.
+ * rings are linked in a list only ever pushed to, for urest_trace_dump() to walk.
+ * with tracing compiled out (no UREST_TRACE) the TRACE() calls are empty and
+ * dumps have no events.
+ */
+void urest_trace(uint8_t type, uint16_t tkn, uint16_t seq, int16_t code)
+{
+	struct trace_event_s *event;
+	
+	if (!ring) {
+		ring = calloc(1, sizeof(struct trace_ring_s));
+	
+		if (!ring)
+			return;
+	
+		ring->thread = __atomic_fetch_add(&threads, 1, __ATOMIC_RELAXED);
+		ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	
+		while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	
+	event = &ring->event[ring->head & (UREST_TRACE_EVENTS - 1)];
+	event->time = urest_stats_clock();
+	event->tkn = tkn;
+	event->seq = seq;
+	event->code = code;
+	event->type = type;
+	event->thread = ring->thread;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+	const char *p = data;
+	ssize_t n;
+	
+	while (size) {
+		n = write(fd, p, size);
+	
+		if (n <= 0)
+			return -1;
+	
+		p += n;
+		size -= n;
+	}
+	
+	return 0;
+}
+
+/*
+ * write what the rings hold to fd, for the trace_report tool. it only uses
+ * write(), so it may be called from a signal handler. rings are read while
+ * threads keep recording: a few of the oldest events may be overwritten as
+ * they are written out. returns the number of events, or -1.
+ */
+int urest_trace_dump(int fd)
+{
+	struct trace_dump_s dump;
+	struct trace_ring_s *node, *list = __atomic_load_n(&rings, __ATOMIC_ACQUIRE);
+	uint32_t head[256], first, start, n;
+	int i;
+	
+	memcpy(dump.magic, UREST_TRACE_MAGIC, sizeof(dump.magic));
+	dump.event_size = sizeof(struct trace_event_s);
+	dump.threads = 0;
+	dump.events = 0;
+	
+	for (node = list, i = 0; node && i < 256; node = node->next, i++) {
+		head[i] = __atomic_load_n(&node->head, __ATOMIC_ACQUIRE);
+		dump.events += head[i] < UREST_TRACE_EVENTS ? head[i] : UREST_TRACE_EVENTS;
+		dump.threads++;
+	}
+	
+	if (write_all(fd, &dump, sizeof(dump)) < 0)
+		return -1;
+	
+	/* the part of a ring up to its end, then the part from its start */
+	for (node = list, i = 0; node && i < 256; node = node->next, i++) {
+		n = head[i] < UREST_TRACE_EVENTS ? head[i] : UREST_TRACE_EVENTS;
+		first = head[i] - n;
+		start = first & (UREST_TRACE_EVENTS - 1);
+	
+		if (start + n > UREST_TRACE_EVENTS) {
+			if (write_all(fd, &node->event[start], (UREST_TRACE_EVENTS - start) * sizeof(struct trace_event_s)) < 0)
+				return -1;
+	
+			n -= UREST_TRACE_EVENTS - start;
+			start = 0;
+		}
+	
+		if (write_all(fd, &node->event[start], n * sizeof(struct trace_event_s)) < 0)
+			return -1;
+	}
+	
+	return dump.events;
+}
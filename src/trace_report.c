@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include "urest.h"
+
+#define SLOWEST			10			/* transactions listed with their breakdown */
+
+/*
+ * reads a dump written by urest_trace_dump() and rebuilds each transaction from
+ * its events: a TRACE_FIRST opens it under its token, later events with that
+ * token belong to it until another TRACE_FIRST takes the token. prints the time
+ * spent in reassembly, handler and response per transaction (with -v, every
+ * event of each one) and percentiles of them over the dump.
+ */
+
+struct tr_s {
+	uint16_t tkn;
+	uint32_t start, handler, handler_end, end;	/* us, 0 if not seen */
+	int16_t code;
+	uint16_t fragments, acks, retries, resets;
+	uint8_t ended;
+};
+
+static struct trace_event_s *event;
+static int *order, *owner;
+static struct tr_s *tr;
+static const char *type_name[] = {"", "first", "fragment", "ack", "retry", "handler", "handler end", "reset", "end"};
+
+
+static int by_time(const void *a, const void *b)
+{
+	const struct trace_event_s *x = &event[*(const int *)a], *y = &event[*(const int *)b];
+	
+	if (x->time != y->time)
+		return x->time < y->time ? -1 : 1;
+	
+	return *(const int *)a - *(const int *)b;
+}
+
+/* grouped by transaction, in time within each */
+static int by_owner(const void *a, const void *b)
+{
+	int x = owner[*(const int *)a], y = owner[*(const int *)b];
+	
+	if (x != y)
+		return x - y;
+	
+	return by_time(a, b);
+}
+
+static int by_value(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	
+	return x < y ? -1 : x > y;
+}
+
+static char *code_str(int16_t code, char *buf)
+{
+	if (code >= 0)
+		sprintf(buf, "%d.%02d", code / 100, code % 100);
+	else
+		sprintf(buf, "error %d", code);
+	
+	return buf;
+}
+
+static void percentiles(char *name, uint32_t *v, int n)
+{
+	if (!n) {
+		printf("%-12s %8d\n", name, 0);
+	
+		return;
+	}
+	
+	qsort(v, n, sizeof(uint32_t), by_value);
+	printf("%-12s %8d %10u %10u %10u %10u\n", name, n, v[n / 2], v[n * 90 / 100], v[n * 99 / 100], v[n - 1]);
+}
+
+static void breakdown(struct tr_s *t)
+{
+	char code[16];
+	
+	printf("token %04x: %s, total %u us", t->tkn, t->ended ? code_str(t->code, code) : "not ended",
+		t->ended ? t->end - t->start : 0);
+	
+	if (t->handler)
+		printf(", reassembly %u us, handler %u us", t->handler - t->start, t->handler_end ? t->handler_end - t->handler : 0);
+	
+	if (t->handler_end && t->ended)
+		printf(", response %u us", t->end - t->handler_end);
+	
+	printf(", %u fragments, %u acks, %u retries%s\n", t->fragments, t->acks, t->retries, t->resets ? ", reset" : "");
+}
+
+static int by_total(const void *a, const void *b)
+{
+	uint32_t x = tr[*(const int *)a].end - tr[*(const int *)a].start, y = tr[*(const int *)b].end - tr[*(const int *)b].start;
+	
+	return x > y ? -1 : x < y;
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_dump_s dump;
+	struct trace_event_s *e;
+	struct tr_s *t;
+	static int by_tkn[65536];
+	uint32_t *v;
+	int verbose, trs = 0, ended = 0, unmatched = 0, codes[1024] = {0}, *done, i, n;
+	char code[16];
+	FILE *f;
+	
+	verbose = argc == 3 && !strcmp(argv[2], "-v");
+	
+	if (argc != 2 && !verbose) {
+		printf("Usage: %s <dump> [-v]\n", argv[0]);
+	
+		return -1;
+	}
+	
+	f = fopen(argv[1], "rb");
+	
+	if (!f || fread(&dump, sizeof(dump), 1, f) != 1 || memcmp(dump.magic, UREST_TRACE_MAGIC, sizeof(dump.magic)) ||
+		dump.event_size != sizeof(struct trace_event_s)) {
+		printf("%s is not a trace dump.\n", argv[1]);
+	
+		return -1;
+	}
+	
+	event = malloc((dump.events + 1) * sizeof(struct trace_event_s));
+	order = malloc((dump.events + 1) * sizeof(int));
+	owner = malloc((dump.events + 1) * sizeof(int));
+	tr = malloc((dump.events + 1) * sizeof(struct tr_s));
+	v = malloc((dump.events + 1) * sizeof(uint32_t));
+	done = malloc((dump.events + 1) * sizeof(int));
+	
+	if (!event || !order || !owner || !tr || !v || !done || fread(event, sizeof(struct trace_event_s), dump.events, f) != dump.events) {
+		printf("error reading %s.\n", argv[1]);
+	
+		return -1;
+	}
+	
+	fclose(f);
+	
+	/* rings are merged by time */
+	for (i = 0; i < (int)dump.events; i++)
+		order[i] = i;
+	
+	qsort(order, dump.events, sizeof(int), by_time);
+	memset(by_tkn, 0xff, sizeof(by_tkn));
+	
+	for (i = 0; i < (int)dump.events; i++) {
+		e = &event[order[i]];
+	
+		if (e->type == TRACE_FIRST) {
+			t = &tr[trs];
+			memset(t, 0, sizeof(struct tr_s));
+			t->tkn = e->tkn;
+			t->start = e->time;
+			by_tkn[e->tkn] = trs++;
+		}
+	
+		/* events of a transaction opened before the oldest one kept, or refusals of new ones */
+		if (by_tkn[e->tkn] < 0) {
+			owner[order[i]] = -1;
+			unmatched++;
+	
+			continue;
+		}
+	
+		owner[order[i]] = by_tkn[e->tkn];
+		t = &tr[by_tkn[e->tkn]];
+	
+		switch (e->type) {
+		case TRACE_FIRST:
+		case TRACE_FRAGMENT: t->fragments++; break;
+		case TRACE_ACK: t->acks++; break;
+		case TRACE_RETRY: t->retries++; break;
+		case TRACE_HANDLER: t->handler = e->time; break;
+		case TRACE_HANDLER_END: t->handler_end = e->time; break;
+		case TRACE_RESET: t->resets++; break;
+		case TRACE_END:
+			if (!t->ended) {
+				t->end = e->time;
+				t->code = e->code;
+				t->ended = 1;
+				done[ended++] = by_tkn[e->tkn];
+			}
+	
+			break;
+		}
+	}
+	
+	if (verbose) {
+		qsort(order, dump.events, sizeof(int), by_owner);
+	
+		for (i = 0; i < (int)dump.events; i++) {
+			e = &event[order[i]];
+	
+			if (owner[order[i]] < 0)
+				continue;
+	
+			t = &tr[owner[order[i]]];
+	
+			if (!i || owner[order[i - 1]] != owner[order[i]]) {
+				printf("\n");
+				breakdown(t);
+			}
+	
+			printf("  +%8u us  thread %-3u %-12s seq %-5u", e->time - t->start, e->thread, type_name[e->type < 9 ? e->type : 0], e->seq);
+	
+			if (e->type == TRACE_ACK || e->type == TRACE_END)
+				printf(" %s", code_str(e->code, code));
+	
+			printf("\n");
+		}
+	
+		printf("\n");
+	}
+	
+	printf("%u events from %u threads, %d transactions (%d ended), %d events unmatched\n\n", dump.events, dump.threads, trs, ended, unmatched);
+	
+	for (i = 0; i < ended; i++)
+		if (tr[done[i]].code >= 0 && tr[done[i]].code < 1024)
+			codes[tr[done[i]].code]++;
+		else
+			codes[0]++;
+	
+	for (i = 0; i < 1024; i++)
+		if (codes[i])
+			printf("%-12s %8d\n", i ? code_str(i, code) : "errors", codes[i]);
+	
+	printf("\n%-12s %8s %10s %10s %10s %10s\n", "phase (us)", "count", "p50", "p90", "p99", "max");
+	
+	for (i = n = 0; i < ended; i++)
+		if (tr[done[i]].handler)
+			v[n++] = tr[done[i]].handler - tr[done[i]].start;
+	
+	percentiles("reassembly", v, n);
+	
+	for (i = n = 0; i < ended; i++)
+		if (tr[done[i]].handler_end)
+			v[n++] = tr[done[i]].handler_end - tr[done[i]].handler;
+	
+	percentiles("handler", v, n);
+	
+	for (i = n = 0; i < ended; i++)
+		if (tr[done[i]].handler_end)
+			v[n++] = tr[done[i]].end - tr[done[i]].handler_end;
+	
+	percentiles("response", v, n);
+	
+	for (i = 0; i < ended; i++)
+		v[i] = tr[done[i]].end - tr[done[i]].start;
+	
+	percentiles("total", v, ended);
+	
+	for (i = 0; i < ended; i++)
+		v[i] = tr[done[i]].fragments;
+	
+	percentiles("fragments", v, ended);
+	
+	for (i = 0; i < ended; i++)
+		v[i] = tr[done[i]].retries;
+	
+	percentiles("retries", v, ended);
+	
+	/* the slowest ones, where their time went */
+	qsort(done, ended, sizeof(int), by_total);
+	printf("\nslowest:\n");
+	
+	for (i = 0; i < ended && i < SLOWEST; i++)
+		breakdown(&tr[done[i]]);
+	
+	return 0;
+}
@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "urest.h"
+
+
+/*
+ * receive up to count datagrams from a non-blocking socket in a single syscall.
+ * each dgram[i].data must point to a buffer of UREST_PACKET_SIZE bytes. peer
+ * addresses are written straight into dgram[i].peer. returns the number of
+ * datagrams received (0 if none are pending).
+ */
+int urest_udp_recv_batch(int s, struct datagram_s *dgram, int count)
+{
+	struct mmsghdr msg[UREST_BATCH];
+	struct iovec iov[UREST_BATCH];
+	int i, n;
+	
+	if (count > UREST_BATCH)
+		count = UREST_BATCH;
+	
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = dgram[i].data;
+		iov[i].iov_len = UREST_PACKET_SIZE;
+		msg[i].msg_hdr.msg_name = dgram[i].peer.addr;
+		msg[i].msg_hdr.msg_namelen = UREST_PEER_SIZE;
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+		msg[i].msg_hdr.msg_control = 0;
+		msg[i].msg_hdr.msg_controllen = 0;
+		msg[i].msg_hdr.msg_flags = 0;
+	}
+	
+	n = recvmmsg(s, msg, count, MSG_DONTWAIT, 0);
+	
+	if (n < 0)
+		return 0;
+	
+	for (i = 0; i < n; i++) {
+		dgram[i].peer.link = s;
+		dgram[i].peer.len = msg[i].msg_hdr.msg_namelen;
+		dgram[i].size = msg[i].msg_len;
+	}
+	
+	return n;
+}
+
+/*
+ * send a vector of datagrams, each one from the socket in its peer.link. runs of
+ * datagrams leaving through the same socket go out in a single sendmmsg() call.
+ * a payload is gathered by the kernel, it is not copied behind the header.
+ * returns the number of datagrams sent.
+ */
+int urest_udp_send_batch(struct datagram_s *dgram, int count)
+{
+	struct mmsghdr msg[UREST_BATCH];
+	struct iovec iov[UREST_BATCH][2];
+	int i, first, n, sent = 0;
+	
+	if (count > UREST_BATCH)
+		count = UREST_BATCH;
+	
+	for (i = 0; i < count; i++) {
+		iov[i][0].iov_base = dgram[i].data;
+		iov[i][0].iov_len = dgram[i].size;
+		iov[i][1].iov_base = dgram[i].payload;
+		iov[i][1].iov_len = dgram[i].payload_size;
+		msg[i].msg_hdr.msg_name = dgram[i].peer.addr;
+		msg[i].msg_hdr.msg_namelen = dgram[i].peer.len;
+		msg[i].msg_hdr.msg_iov = iov[i];
+		msg[i].msg_hdr.msg_iovlen = dgram[i].payload_size ? 2 : 1;
+		msg[i].msg_hdr.msg_control = 0;
+		msg[i].msg_hdr.msg_controllen = 0;
+		msg[i].msg_hdr.msg_flags = 0;
+	}
+	
+	for (first = 0; first < count; first = i) {
+		for (i = first + 1; i < count && dgram[i].peer.link == dgram[first].peer.link; i++);
+	
+		n = sendmmsg(dgram[first].peer.link, &msg[first], i - first, 0);
+	
+		if (n > 0)
+			sent += n;
+	}
+	
+	return sent;
+}
@@ -3,6 +3,7 @@
 #include <string.h>
 #include <malloc.h>
 #include <stdlib.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include "urest.h"
 
@@ -16,11 +17,41 @@ struct resource_list_s *urest_resource_list(void)
 	if (!list)
 		return 0;
 		
+	list->router = urest_router();
+	
+	if (!list->router) {
+		free(list);
+		
+		return 0;
+	}
+	
 	list->next = 0;
 	
 	return list;
 }
 
+/* free a list no responder serves any more, with the resources registered in it */
+void urest_resource_list_free(struct resource_list_s *resource_list)
+{
+	struct resource_list_s *node;
+	
+	urest_router_free(resource_list->router);
+	
+	/* the last node holds no resource */
+	while (resource_list) {
+		node = resource_list->next;
+	
+		if (node) {
+			free(resource_list->resource->endpoint_name);
+			free(resource_list->resource->endpoint_uri);
+			free(resource_list->resource);
+		}
+	
+		free(resource_list);
+		resource_list = node;
+	}
+}
+
 struct resource_s *urest_resource_endpoint(char *name, char *uri)
 {
 	struct resource_s *resource;
@@ -53,6 +84,14 @@ struct resource_s *urest_resource_endpoint(char *name, char *uri)
 	resource->handler_post = 0;
 	resource->handler_put = 0;
 	resource->handler_delete = 0;
+	resource->stream_get = 0;
+	resource->stream_post = 0;
+	resource->stream_put = 0;
+	resource->stream_delete = 0;
+	resource->slow = 0;
+	resource->version = 0;
+	memset(resource->count, 0, sizeof(resource->count));
+	resource->failed = 0;
 	
 	return resource;
 }
@@ -79,6 +118,53 @@ int urest_resource_handler(struct resource_s *resource, void (*handler)(void *),
 	return 0;
 }
 
+/* stream handlers take precedence over a plain handler for the same method */
+int urest_resource_stream(struct resource_s *resource, struct stream_s *stream, uint8_t method)
+{
+	switch (method) {
+	case GET:
+		resource->stream_get = stream;
+		break;
+	case POST:
+		resource->stream_post = stream;
+		break;
+	case PUT:
+		resource->stream_put = stream;
+		break;
+	case DELETE:
+		resource->stream_delete = stream;
+		break;
+	default:
+		return -1;
+	}
+	
+	return 0;
+}
+	
+/*
+ * mark the handler of a method as slow (a sensor, a database). the responder
+ * runs it on its offload pool and answers polls with 2.02 until it returns.
+ */
+int urest_resource_slow(struct resource_s *resource, uint8_t method)
+{
+	if (method < GET || method > DELETE)
+		return -1;
+	
+	resource->slow |= 1 << method;
+	
+	return 0;
+}
+	
+/*
+ * tell the observers of a resource that it changed, from any thread. they get
+ * the result of its GET handler within UREST_NOTIFY_INTERVAL, changes made in
+ * the meantime are sent together.
+ */
+void urest_notify(struct resource_s *resource)
+{
+	__atomic_add_fetch(&resource->version, 1, __ATOMIC_RELEASE);
+}
+	
 int urest_register_resource(struct resource_list_s *resource_list, struct resource_s *resource)
 {
 	struct resource_list_s *node = resource_list, *new_node;
@@ -95,10 +181,25 @@ int urest_register_resource(struct resource_list_s *resource_list, struct resour
 	node->next = new_node;
 	node->next->next = 0;
 	
-	return 0;
+	return urest_route_add(resource_list->router, resource->endpoint_uri, resource);
 }
 
 
+static uint16_t frag_payload(uint8_t frag_size)
+{
+	switch (frag_size) {
+	case FRAG_SIZE_16: return 16 - sizeof(struct urest_s);
+	case FRAG_SIZE_32: return 32 - sizeof(struct urest_s);
+	case FRAG_SIZE_64: return 64 - sizeof(struct urest_s);
+	case FRAG_SIZE_128: return 128 - sizeof(struct urest_s);
+	case FRAG_SIZE_256: return 256 - sizeof(struct urest_s);
+	case FRAG_SIZE_512: return 512 - sizeof(struct urest_s);
+	case FRAG_SIZE_1024: return 1024 - sizeof(struct urest_s);
+	default:
+		return 0;
+	}
+}
+
 static void send_ack(struct serv_packet_s *serv_packet, uint8_t major, uint8_t minor, uint16_t size)
 {
 	struct urest_s *header = (struct urest_s *)serv_packet->packet;
@@ -109,14 +210,207 @@ static void send_ack(struct serv_packet_s *serv_packet, uint8_t major, uint8_t m
 	serv_packet->packet_handler_send(serv_packet->packet_arg, serv_packet->packet, sizeof(struct urest_s) + size);
 }
 
+static __thread struct request_s *current;
+
+/* the request being handled by the calling thread (valid inside a handler) */
+struct request_s *urest_request(void)
+{
+	return current;
+}
+
+/*
+ * copy the path parameter captured as name into value (null terminated).
+ * returns its length, or -1 if there is no such parameter.
+ */
+int urest_param(char *name, char *value, uint16_t size)
+{
+	int i;
+	
+	if (!current || size == 0)
+		return -1;
+	
+	for (i = 0; i < current->params; i++) {
+		if (strcmp(current->param[i].name, name) == 0) {
+			if (current->param[i].len < size)
+				size = current->param[i].len + 1;
+			
+			memcpy(value, current->param[i].value, size - 1);
+			value[size - 1] = '\0';
+			
+			return size - 1;
+		}
+	}
+	
+	return -1;
+}
+
+#define JU_VALUE		0xfe			/* the key was "uri", its value comes next */
+#define JU_SKIP			0xff			/* the key is not "uri" */
+	
+/*
+ * events of a JSON request until its uri is known: the string value of the "uri"
+ * member of the top level object. the router reads it in the document, so it
+ * can not have escapes. returns 1 once it is complete.
+ */
+static int json_uri(void *arg, uint8_t event, char *data, uint16_t len)
+{
+	struct json_uri_s *ju = arg;
+	
+	if (ju->match == JU_VALUE) {
+		if ((event & ~JSON_PART) != JSON_STRING)
+			return -1;
+	
+		if (!ju->len)
+			ju->uri = data - ju->doc;
+	
+		/* an escape, decoded out of the document */
+		if (data < ju->doc || data + len > ju->doc + UREST_REQ_BUF_SIZE || data != ju->doc + ju->uri + ju->len)
+			return -1;
+	
+		ju->len += len;
+	
+		return event & JSON_PART ? 0 : 1;
+	}
+	
+	if ((event & ~JSON_PART) != JSON_KEY || ju->json.depth != 1)
+		return 0;
+	
+	/* the key may come in pieces */
+	if (ju->match != JU_SKIP && ju->match + len <= 3 && memcmp(data, "uri" + ju->match, len) == 0)
+		ju->match += len;
+	else
+		ju->match = JU_SKIP;
+	
+	if (!(event & JSON_PART))
+		ju->match = ju->match == 3 ? JU_VALUE : 0;
+	
+	return 0;
+}
+	
+static void json_uri_init(struct json_uri_s *ju, char *doc)
+{
+	urest_json(&ju->json, json_uri, ju);
+	ju->doc = doc;
+	ju->uri = 0;
+	ju->len = 0;
+	ju->match = 0;
+}
+	
+/*
+ * resolve the resource and method handler for a request uri. returns 0 and the
+ * handler or stream handlers (both null for PINGREQ) or a status code (major *
+ * 100 + minor) to be sent back to the initiator.
+ */
+static int route(struct resource_list_s *resource_list, struct urest_s *header, char *uri, struct request_s *request, void (**handler)(void *), struct stream_s **stream)
+{
+	struct resource_s *resource;
+
+	/* status 400 */
+	if (header->msg_type != REQ)
+		return CLNT_ERROR * 100 + BAD_REQUEST;
+	
+	/* status 406, handlers take JSON, flat or uREST encoded requests */
+	if (header->mtd_major != VERB || header->cnt_type == URI_ENC)
+		return CLNT_ERROR * 100 + NOT_ACCEPTABLE;
+	
+	request->method = header->mtd_minor;
+	request->content = header->cnt_type;
+	request->params = 0;
+	request->ctx = 0;
+	request->offset = 0;
+	*handler = 0;
+	*stream = 0;
+	resource = urest_route(resource_list->router, uri, request);
+	request->resource = resource;
+	
+	/* status 404 */
+	if (!resource)
+		return CLNT_ERROR * 100 + NOT_FOUND;
+	
+	switch (header->mtd_minor) {
+	case GET:
+		*handler = resource->handler_get;
+		*stream = resource->stream_get;
+		break;
+	case POST:
+		*handler = resource->handler_post;
+		*stream = resource->stream_post;
+		break;
+	case PUT:
+		*handler = resource->handler_put;
+		*stream = resource->stream_put;
+		break;
+	case DELETE:
+		*handler = resource->handler_delete;
+		*stream = resource->stream_delete;
+		break;
+	case PINGREQ:
+		return 0;
+	default:
+		/* status 501 */
+		return CLNT_ERROR * 100 + NOT_ALLOWED;
+	}
+	
+	/* status 405 */
+	if (!*handler && !*stream)
+		return CLNT_ERROR * 100 + NOT_ALLOWED;
+	
+	return 0;
+}
+
+static void run_handler(void (*handler)(void *), struct request_s *request, char *data)
+{
+	current = request;
+	handler(data);
+	current = 0;
+}
+
+static int stream_recv(struct transaction_s *tr, char *data, uint16_t len)
+{
+	int status = 0;
+	
+	if (tr->stream->recv && len) {
+		current = &tr->request;
+		status = tr->stream->recv(&tr->request, data, len);
+		current = 0;
+	}
+	
+	tr->request.offset += len;
+	
+	return status;
+}
+	
+static int stream_send(struct transaction_s *tr, char *data, uint16_t size)
+{
+	int len = 0;
+	
+	if (tr->stream->send) {
+		current = &tr->request;
+		len = tr->stream->send(&tr->request, data, size);
+		current = 0;
+	}
+	
+	if (len > size)
+		len = size;
+	
+	if (len > 0)
+		tr->request.offset += len;
+	
+	return len;
+}
+	
 int urest_handle_request(struct serv_packet_s *serv_packet, struct resource_list_s *resource_list)
 {
 	char buf[sizeof(struct urest_s) + UREST_REQ_BUF_SIZE];
 	struct urest_s *header = (struct urest_s *)serv_packet->packet;
 	struct urest_s *request = (struct urest_s *)buf;
-	struct resource_list_s *node = resource_list;
+	struct request_s req;
+	struct stream_s *stream;
+	struct json_uri_s json;
+	void (*handler)(void *);
+	char *uri;
 	uint16_t pkt_len, data_len, payload_size, seq = 0, seq_ack = 0, retries = 0;
-	char *uri_param;
+	int status;
 	
 	do {
 		/* try to receive some data, this is a blocking call */
@@ -129,17 +423,10 @@ int urest_handle_request(struct serv_packet_s *serv_packet, struct resource_list
 
 		/* decode payload size for fragments in this message */
 		if (seq == 0) {
-			switch (header->frag_size) {
-			case FRAG_SIZE_16: payload_size = 16 - sizeof(struct urest_s); break;
-			case FRAG_SIZE_32: payload_size = 32 - sizeof(struct urest_s); break;
-			case FRAG_SIZE_64: payload_size = 64 - sizeof(struct urest_s); break;
-			case FRAG_SIZE_128: payload_size = 128 - sizeof(struct urest_s); break;
-			case FRAG_SIZE_256: payload_size = 256 - sizeof(struct urest_s); break;
-			case FRAG_SIZE_512: payload_size = 512 - sizeof(struct urest_s); break;
-			case FRAG_SIZE_1024: payload_size = 1024 - sizeof(struct urest_s); break;
-			default:
+			payload_size = frag_payload(header->frag_size);
+			
+			if (!payload_size)
 				return UNKNOWN_FRAGMENT_SIZE;
-			}
 		}
 			
 		if (ntohs(header->seq) != seq) {
@@ -181,101 +468,40 @@ int urest_handle_request(struct serv_packet_s *serv_packet, struct resource_list
 
 		seq++;
 	} while (data_len == payload_size);
-		
-	if (request->msg_type == REQ) {
-		if (request->mtd_major == VERB && request->cnt_type == FLAT_ENC) {
-			while (node->next) {
-				uri_param = strstr((const char *)request + sizeof(struct urest_s), "?");
-				if (uri_param) {
-					*uri_param = '\0';
-					if (strcmp(node->resource->endpoint_uri, (const char *)request + sizeof(struct urest_s)) == 0) {
-						*uri_param = '?';
-						
-						break;
-					}
-					*uri_param = '?';
-				} else {
-					if (strcmp(node->resource->endpoint_uri, (const char *)request + sizeof(struct urest_s)) == 0)
-						break;
-				}
-				
-				node = node->next;
-			}
-			
-			/* status 404 */
-			if (!node->next) {
-				send_ack(serv_packet, CLNT_ERROR, NOT_FOUND, 0);
-			
-				return 0;
-			}
-			
-			switch (request->mtd_minor) {
-			case GET:
-				if (node->resource->handler_get) {
-					send_ack(serv_packet, INFO, PROCESSING, 0);
-					node->resource->handler_get((char *)request + sizeof(struct urest_s));
-					break;
-				} else {
-					/* status 405 */
-					send_ack(serv_packet, CLNT_ERROR, NOT_ALLOWED, 0);
-			
-					return 0;
-				}
-			case POST:
-				if (node->resource->handler_post) {
-					send_ack(serv_packet, INFO, PROCESSING, 0);
-					node->resource->handler_post((char *)request + sizeof(struct urest_s));
-					break;
-				} else {
-					/* status 405 */
-					send_ack(serv_packet, CLNT_ERROR, NOT_ALLOWED, 0);
-			
-					return 0;
-				}
-			case PUT:
-				if (node->resource->handler_put) {
-					send_ack(serv_packet, INFO, PROCESSING, 0);
-					node->resource->handler_put((char *)request + sizeof(struct urest_s));
-					break;
-				} else {
-					/* status 405 */
-					send_ack(serv_packet, CLNT_ERROR, NOT_ALLOWED, 0);
-			
-					return 0;
-				}
-			case DELETE:
-				if (node->resource->handler_get) {
-					send_ack(serv_packet, INFO, PROCESSING, 0);
-					node->resource->handler_delete((char *)request + sizeof(struct urest_s));
-					break;
-				} else {
-					/* status 405 */
-					send_ack(serv_packet, CLNT_ERROR, NOT_ALLOWED, 0);
-			
-					return 0;
-				}
-			case PINGREQ:
-				break;
-			default:
-				/* status 501 */
-				send_ack(serv_packet, CLNT_ERROR, NOT_ALLOWED, 0);
-			
-				return 0;
-			}
-		} else {
-			/* status 406 */
-			send_ack(serv_packet, CLNT_ERROR, NOT_ACCEPTABLE, 0);
-		
+	
+	uri = buf + sizeof(struct urest_s);
+	
+	/* status 400, the uri of a JSON request is a member of it */
+	if (request->cnt_type == JSON_ENC) {
+		json_uri_init(&json, uri);
+	
+		if (urest_json_parse(&json.json, uri, strnlen(uri, UREST_REQ_BUF_SIZE)) != 1) {
+			send_ack(serv_packet, CLNT_ERROR, BAD_REQUEST, 0);
+	
 			return 0;
 		}
-	} else {
-		/* status 400 */
-		send_ack(serv_packet, CLNT_ERROR, BAD_REQUEST, 0);
-			
+	
+		uri += json.uri;
+	}
+	
+	status = route(resource_list, request, uri, &req, &handler, &stream);
+	
+	/* status 501, streams need the non-blocking responder */
+	if (!status && !handler && stream)
+		status = SERV_ERROR * 100 + NOT_IMPLEMENTED;
+	
+	if (status) {
+		send_ack(serv_packet, status / 100, status % 100, 0);
+		
 		return 0;
 	}
 	
-	data_len = strnlen(buf + sizeof(struct urest_s), sizeof(struct urest_s) + UREST_REQ_BUF_SIZE);
+	if (handler) {
+		send_ack(serv_packet, INFO, PROCESSING, 0);
+		run_handler(handler, &req, (char *)request + sizeof(struct urest_s));
+	}
+	
+	data_len = strnlen(buf + sizeof(struct urest_s), UREST_REQ_BUF_SIZE);
 	
 	do {
 		/* try to receive some data, this is a blocking call */
@@ -314,231 +540,2767 @@ int urest_handle_request(struct serv_packet_s *serv_packet, struct resource_list
 }
 
 
+/* non-blocking responder */
 
-struct server_s *urest_link(struct clnt_packet_s *clnt_packet, char *ip, uint16_t port, uint8_t frag_size)
+uint32_t urest_clock(void)
 {
-	struct server_s *server;
+	struct timespec ts;
 	
-	server = malloc(sizeof(struct server_s));
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 	
-	if (!server)
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct responder_s *urest_responder(struct serv_packet_s *serv_packet, struct resource_list_s *resource_list, uint16_t transactions)
+{
+	struct responder_s *responder;
+	uint16_t i;
+	
+	if (transactions == 0 || transactions > 4096)
+		return 0;
+	
+	responder = malloc(sizeof(struct responder_s));
+	
+	if (!responder)
 		return 0;
+	
+	responder->transaction = calloc(transactions, sizeof(struct transaction_s));
+	
+	if (!responder->transaction) {
+		free(responder);
 		
-	server->ip = malloc(strlen(ip) + 2);
+		return 0;
+	}
 	
-	if (!server->ip) {
-		free(server);
+	responder->free_slot = malloc(transactions * sizeof(uint16_t));
+	
+	if (!responder->free_slot) {
+		free(responder->transaction);
+		free(responder);
 		
 		return 0;
 	}
-
-	strcpy(server->ip, ip);
-	server->port = port;
-	server->packet_drv = clnt_packet;
-	server->frag_size = frag_size;
 	
-	return server;
+	/* the low bits of a token carry the transaction slot, the rest is random */
+	for (responder->slot_bits = 0; (1 << responder->slot_bits) < transactions; responder->slot_bits++);
+	
+	responder->opening = calloc(1 << responder->slot_bits, sizeof(uint16_t));
+	
+	if (!responder->opening) {
+		free(responder->free_slot);
+		free(responder->transaction);
+		free(responder);
+	
+		return 0;
+	}
+	
+	responder->subscription = malloc(UREST_SUBSCRIPTIONS * sizeof(struct subscription_s));
+	
+	if (!responder->subscription) {
+		free(responder->opening);
+		free(responder->free_slot);
+		free(responder->transaction);
+		free(responder);
+	
+		return 0;
+	}
+	
+	/* a slab per transaction, plus receive buffers and slabs retired in a batch */
+	responder->pool = urest_pool(transactions + 2 * UREST_BATCH, UREST_SLAB_SIZE);
+	
+	if (!responder->pool) {
+		free(responder->subscription);
+		free(responder->opening);
+		free(responder->free_slot);
+		free(responder->transaction);
+		free(responder);
+		
+		return 0;
+	}
+	
+	for (i = 0; i < transactions; i++)
+		responder->free_slot[i] = transactions - i - 1;
+	
+	responder->packet_drv = serv_packet;
+	responder->resource_list = resource_list;
+	responder->out = 0;
+	responder->out_count = 0;
+	responder->retired_count = 0;
+	responder->swap = 0;
+	responder->deadline = 0;
+	responder->subscribed = 0;
+	responder->push_at = 0;
+	responder->transactions = transactions;
+	responder->active = 0;
+	responder->reap = 0;
+	responder->shard = 0;
+	responder->shard_bits = 0;
+	responder->handoff = 0;
+	responder->handoff_arg = 0;
+	responder->offload = 0;
+	responder->dict = 0;
+	responder->threshold = 0;
+	responder->limit = 0;
+	responder->limit_mask = 0;
+	responder->rate = 0;
+	responder->burst = 0;
+	responder->admit = 0;
+	responder->waiting = 0;
+	responder->shed.busy = 0;
+	responder->shed.rate = 0;
+	responder->stats = 0;
+	
+	return responder;
 }
 
+/*
+ * free a responder that no longer serves: no handler of it may still run on an
+ * offload pool. the resource list, offload pool, dictionary and stats are the
+ * application's and are left alone.
+ */
+void urest_responder_free(struct responder_s *responder)
+{
+	free(responder->limit);
+	urest_pool_free(responder->pool);
+	free(responder->subscription);
+	free(responder->opening);
+	free(responder->free_slot);
+	free(responder->transaction);
+	free(responder);
+}
 
-static int send_data(struct server_s *server, uint8_t method, char *data, uint16_t *seq_val, uint16_t *token)
+/*
+ * make this responder one shard out of (1 << shard_bits). the shard number is
+ * encoded in the top bits of every token it hands out, and fragments carrying
+ * a token from another shard are passed to handoff() instead of being rejected.
+ */
+int urest_responder_shard(struct responder_s *responder, uint8_t shard, uint8_t shard_bits, void (*handoff)(void *, uint8_t, char *, uint16_t, struct peer_s *), void *arg)
 {
-	char buf[sizeof(struct urest_s)];
-	struct urest_s *header = (struct urest_s *)server->packet_drv->packet;
-	struct urest_s *request = (struct urest_s *)buf;
-	uint16_t seq = 0;
-	uint16_t pkt_len, data_len, payload_size, size;
+	/* keep at least two random bits in each token */
+	if (shard_bits + responder->slot_bits > 14 || shard >= (1 << shard_bits))
+		return -1;
 	
-	data_len = strlen(data) + 1;
-	*token = 0;
+	responder->shard = shard;
+	responder->shard_bits = shard_bits;
+	responder->handoff = handoff;
+	responder->handoff_arg = arg;
 	
-	switch (server->frag_size) {
-	case FRAG_SIZE_16: payload_size = 16 - sizeof(struct urest_s); break;
-	case FRAG_SIZE_32: payload_size = 32 - sizeof(struct urest_s); break;
-	case FRAG_SIZE_64: payload_size = 64 - sizeof(struct urest_s); break;
-	case FRAG_SIZE_128: payload_size = 128 - sizeof(struct urest_s); break;
-	case FRAG_SIZE_256: payload_size = 256 - sizeof(struct urest_s); break;
-	case FRAG_SIZE_512: payload_size = 512 - sizeof(struct urest_s); break;
-	case FRAG_SIZE_1024: payload_size = 1024 - sizeof(struct urest_s); break;
-	default:
-		return UNKNOWN_FRAGMENT_SIZE;
-	}
+	return 0;
+}
 	
-	do {
-		header->frag_size = server->frag_size;
-		header->msg_type = REQ;
-		header->cnt_type = FLAT_ENC;
-		header->mtd_major = VERB;
-		header->mtd_minor = method;
-		header->seq = htons(seq);
-
-		if (seq == 0) {
-			header->tkn = htons(0);
-			*request = *header;
-		}
-		
-		if (seq == 1) {
-			request->tkn = header->tkn;
-		}
-
-		if (seq == data_len / payload_size)
-			size = data_len % payload_size;
-		else
-			size = payload_size;
+/* run handlers of slow resources on offload, without it they run on the I/O thread */
+void urest_responder_offload(struct responder_s *responder, struct offload_s *offload)
+{
+	responder->offload = offload;
+}
+	
+/* take requests packed with dict (null for none), and pack responses from threshold bytes on */
+void urest_responder_compress(struct responder_s *responder, const struct dict_s *dict, uint16_t threshold)
+{
+	responder->dict = dict;
+	responder->threshold = threshold;
+}
+	
+/*
+ * shed load before it takes a slab: a peer opens up to rate new transactions per
+ * second (burst at once) or gets 4.29, and with admit transactions in progress
+ * new ones get 5.03. buckets are kept for about peers peers, the least recently
+ * seen one in a set goes to a newcomer. rate 0 turns the limit off, admit 0 the
+ * cap. returns 0 or -1 if out of memory.
+ */
+int urest_responder_limit(struct responder_s *responder, uint16_t peers, uint16_t rate, uint16_t burst, uint16_t admit)
+{
+	uint16_t sets;
+	
+	free(responder->limit);
+	responder->limit = 0;
+	responder->rate = 0;
+	responder->admit = admit;
+	
+	if (!rate)
+		return 0;
+	
+	for (sets = 1; sets * UREST_LIMIT_WAYS < peers && sets < 0x8000; sets *= 2);
+	
+	responder->limit = calloc(sets * UREST_LIMIT_WAYS, sizeof(struct limit_s));
+	
+	if (!responder->limit)
+		return -1;
+	
+	responder->limit_mask = sets - 1;
+	responder->rate = rate;
+	responder->burst = burst ? burst : 1;
+	
+	return 0;
+}
 
-		memcpy(server->packet_drv->packet + sizeof(struct urest_s), data + seq * payload_size, size);
+/* count transactions and time their phases in stats (null for none), GETs of UREST_STATS_URI are answered from them */
+void urest_responder_stats(struct responder_s *responder, struct stats_s *stats)
+{
+	responder->stats = stats;
+}
+	
+static inline void stat_inc(uint32_t *counter)
+{
+	__atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+	
+/* the phase in progress is over, the next one starts */
+static void stats_phase(struct responder_s *responder, struct transaction_s *tr, uint8_t phase)
+{
+	uint32_t now;
+	
+	if (!responder->stats)
+		return;
+	
+	now = urest_stats_clock();
+	urest_stats_time(responder->stats, phase, now - tr->stamp);
+	tr->stamp = now;
+}
+	
+static void stats_end(struct responder_s *responder, struct transaction_s *tr, int status)
+{
+	struct stats_s *stats = responder->stats;
+	struct resource_s *resource = tr->request.resource;
+	int ok = status / 100 == SUCCESS;
+	
+	if (!stats)
+		return;
+	
+	if (ok && tr->state == TR_SEND)
+		stats_phase(responder, tr, PHASE_RESPONSE);
+	
+	stat_inc(&stats->transactions);
+	
+	if (!ok)
+		stat_inc(&stats->failed);
+	
+	if (!resource || tr->request.method < GET || tr->request.method > DELETE)
+		return;
+	
+	stat_inc(&resource->count[tr->request.method - GET]);
+	
+	if (!ok)
+		stat_inc(&resource->failed);
+}
+	
+/* tell a stream how its transaction ended */
+static void transaction_end(struct transaction_s *tr, int status)
+{
+	if (tr->stream && tr->stream->end) {
+		current = &tr->request;
+		tr->stream->end(&tr->request, status);
+		current = 0;
+	}
+}
+	
+static void transaction_release(struct responder_s *responder, struct transaction_s *tr)
+{
+	if (tr->state == TR_WAIT)
+		responder->waiting--;
+	
+	/* queued ACKs may still point into the slab, keep it until the batch is sent */
+	if (responder->out && responder->retired_count < UREST_BATCH)
+		responder->retired[responder->retired_count++] = tr->buf;
+	else
+		urest_pool_put(responder->pool, tr->buf);
+	
+	tr->buf = 0;
+	tr->state = TR_FREE;
+	responder->free_slot[responder->transactions - responder->active] = tr - responder->transaction;
+	responder->active--;
+}
+	
+static void transaction_free(struct responder_s *responder, struct transaction_s *tr, int status)
+{
+	TRACE(TRACE_END, tr->tkn, tr->seq, status);
+	stats_end(responder, tr, status);
+	transaction_end(tr, status);
+	transaction_release(responder, tr);
+}
+	
+/*
+ * a finished transaction keeps its slot and slab for UREST_TIME_WAIT, so a
+ * fragment sent again after its last ACK got lost gets the same ACK back
+ * instead of being taken for a new request.
+ */
+static void transaction_close(struct responder_s *responder, struct transaction_s *tr, int status)
+{
+	TRACE(TRACE_END, tr->tkn, tr->seq, status);
+	stats_end(responder, tr, status);
+	transaction_end(tr, status);
+	
+	if (tr->state != TR_WAIT)
+		responder->waiting++;
+	
+	tr->state = TR_WAIT;
+	tr->last = urest_clock();
+	
+	/* it goes after UREST_TIME_WAIT, maybe before the next expiry urest_timeout() waits for */
+	if (!responder->deadline || (int32_t)(tr->last + UREST_TIME_WAIT - responder->deadline) < 0)
+		responder->deadline = tr->last + UREST_TIME_WAIT;
+}
+	
+/* make room by dropping a finished transaction, the first found after the last one dropped */
+static int transaction_reap(struct responder_s *responder)
+{
+	uint16_t i, slot;
+	
+	for (i = 0; i < responder->transactions; i++) {
+		slot = (responder->reap + i) % responder->transactions;
+	
+		if (responder->transaction[slot].state == TR_WAIT) {
+			transaction_release(responder, &responder->transaction[slot]);
+			responder->reap = slot + 1;
+	
+			return 0;
+		}
+	}
+	
+	return -1;
+}
+	
+/*
+ * a request that arrives in a slab of our own pool during a batch is reassembled
+ * in place: the transaction keeps the receive slab and the caller gets a fresh one
+ * through responder->swap. otherwise a new slab is taken from the pool.
+ */
+static struct transaction_s *transaction_new(struct responder_s *responder, struct peer_s *peer, char *packet, int adopt)
+{
+	struct transaction_s *tr;
+	uint16_t slot;
+	char *buf = 0;
+	
+	if (responder->active == responder->transactions && transaction_reap(responder))
+		return 0;
+	
+	if (adopt && responder->out && urest_pool_owns(responder->pool, packet)) {
+		responder->swap = urest_pool_get(responder->pool);
+		
+		if (responder->swap)
+			buf = packet;
+	}
+	
+	if (!buf) {
+		buf = urest_pool_get(responder->pool);
+	
+		if (!buf)
+			return 0;
+	}
+	
+	slot = responder->free_slot[responder->transactions - responder->active - 1];
+	responder->active++;
+	
+	tr = &responder->transaction[slot];
+	tr->buf = buf;
+	
+	/* the header room in buf is reused for ACKs, keep the request header apart */
+	memcpy(&tr->header, packet, sizeof(struct urest_s));
+	
+	/* token layout: shard (high bits), random, slot (low bits) */
+	do {
+		tr->tkn = (responder->shard << (16 - responder->shard_bits)) |
+			(((random() << responder->slot_bits) | slot) & ((1 << (16 - responder->shard_bits)) - 1));
+	} while (tr->tkn == 0);
+	
+	tr->peer = *peer;
+	tr->state = TR_RECV;
+	tr->seq = 0;
+	tr->frag = 0;
+	tr->retries = 0;
+	tr->data_len = 0;
+	tr->handler = 0;
+	tr->stream = 0;
+	tr->window = 0;
+	tr->skew = 0;
+	tr->flags = 0;
+	tr->sack = 0;
+	tr->ring = 0;
+	tr->hash = 0;
+	tr->ack_seq = 0;
+	tr->ack_len = 0;
+	tr->running = 0;
+	tr->lease = 0;
+	tr->length = 0;
+	tr->request.resource = 0;
+	tr->stamp = responder->stats ? urest_stats_clock() : 0;
+	json_uri_init(&tr->json, buf + sizeof(struct urest_s));
+	
+	return tr;
+}
+
+/* the uri ends where the router stops, at a '?', a null or the quote closing a JSON string */
+static int stats_uri(char *uri)
+{
+	uint16_t len = strlen(UREST_STATS_URI);
+	
+	return !strncmp(uri, UREST_STATS_URI, len) && (!uri[len] || uri[len] == '?' || uri[len] == '"');
+}
+	
+/* route a transaction once its uri is complete, len bytes are buffered so far */
+static int transaction_route(struct responder_s *responder, struct transaction_s *tr, uint16_t len)
+{
+	char *uri = tr->buf + sizeof(struct urest_s), *path, *body;
+	int status;
+	
+	path = tr->header.cnt_type == JSON_ENC ? uri + tr->json.uri : uri;
+	status = route(responder->resource_list, &tr->header, path, &tr->request, &tr->handler, &tr->stream);
+	
+	/* the stats of the responder, unless a resource of the application has the uri */
+	if (status == CLNT_ERROR * 100 + NOT_FOUND && responder->stats && tr->request.method == GET && stats_uri(path)) {
+		tr->flags |= TR_STATS;
+		status = 0;
+	}
+	
+	if (status)
+		return status;
+	
+	tr->state = TR_BODY;
+	
+	/* status 414, a binary request is known not to fit before it is all in */
+	if (!tr->stream && (tr->flags & (TR_LENGTH | TR_COMPRESS)) == TR_LENGTH && tr->length >= UREST_REQ_BUF_SIZE)
+		return CLNT_ERROR * 100 + TOO_LONG;
+	
+	/* status 415, streams are not packed: the response is not known as a whole */
+	if (tr->stream && (tr->flags & TR_COMPRESS))
+		return CLNT_ERROR * 100 + UNSUPPORTED;
+	
+	/* pass what came after the uri, it stays in the buffer with the parameters */
+	if (tr->stream) {
+		/* a JSON document is passed from its start, the uri is in it */
+		if (tr->header.cnt_type == JSON_ENC) {
+			tr->ring = len;
+	
+			return stream_recv(tr, uri, len);
+		}
+	
+		body = memchr(uri, '?', len);
+		tr->ring = body ? body + 1 - uri : len;
+	
+		if (body)
+			return stream_recv(tr, body + 1, len - (body + 1 - uri));
+	}
+	
+	return 0;
+}
+	
+static struct transaction_s *transaction_find(struct responder_s *responder, struct peer_s *peer, uint16_t tkn)
+{
+	struct transaction_s *tr;
+	uint16_t slot;
+	
+	slot = tkn & ((1 << responder->slot_bits) - 1);
+	
+	if (slot >= responder->transactions)
+		return 0;
+	
+	tr = &responder->transaction[slot];
+	
+	if (tr->state == TR_FREE || tr->tkn != tkn)
+		return 0;
+	
+	if (tr->peer.len != peer->len || memcmp(tr->peer.addr, peer->addr, peer->len))
+		return 0;
+	
+	/* the peer may show up on a different local endpoint */
+	tr->peer.link = peer->link;
+	
+	return tr;
+}
+
+/*
+ * send an ACK built in place of the received header, followed by size bytes of
+ * data (may be null when size is 0).
+ */
+static void reply(struct responder_s *responder, struct peer_s *peer, char *packet, uint8_t major, uint8_t minor, char *data, uint16_t size)
+{
+	struct urest_s *header = (struct urest_s *)packet;
+	struct datagram_s *out;
+	
+	header->msg_type = ACK | (header->msg_type & EXT);
+	header->mtd_major = major;
+	header->mtd_minor = minor;
+	TRACE(TRACE_ACK, ntohs(header->tkn), ntohs(header->seq), major * 100 + minor);
+	
+	/*
+	 * inside a batch the ACK header stays in the received datagram until the
+	 * flush and the data is gathered straight from the transaction slab.
+	 */
+	if (responder->out) {
+		out = &responder->out[responder->out_count++];
+		out->peer = *peer;
+		out->data = packet;
+		out->size = sizeof(struct urest_s);
+		out->payload = data;
+		out->payload_size = size;
+	
+		if (data == packet + sizeof(struct urest_s)) {
+			out->size += size;
+			out->payload_size = 0;
+		}
+	
+		return;
+	}
+	
+	if (size && data != packet + sizeof(struct urest_s))
+		memcpy(packet + sizeof(struct urest_s), data, size);
+	
+	responder->packet_drv->packet_handler_sendto(responder->packet_drv->packet_arg, peer, packet, sizeof(struct urest_s) + size);
+}
+	
+/*
+ * keep the ACK just built in packet to send it again if it gets lost. data in
+ * the transaction slab is referenced, short inline data is copied.
+ */
+static void replay_keep(struct transaction_s *tr, char *packet, char *data, uint16_t size)
+{
+	struct urest_s *header = (struct urest_s *)packet;
+	
+	tr->ack_seq = ntohs(header->seq);
+	tr->ack_data = 0;
+	tr->ack_size = 0;
+	tr->ack_len = 0;
+	
+	if (data != packet + sizeof(struct urest_s)) {
+		tr->ack_data = data;
+		tr->ack_size = size;
+		size = 0;
+	}
+	
+	if (sizeof(struct urest_s) + size > sizeof(tr->ack))
+		return;
+	
+	memcpy(tr->ack, packet, sizeof(struct urest_s) + size);
+	tr->ack_len = sizeof(struct urest_s) + size;
+}
+	
+/* send the last ACK of a transaction again, the handler is not run twice */
+static void replay(struct responder_s *responder, struct transaction_s *tr, struct peer_s *peer, char *packet)
+{
+	struct urest_s *header = (struct urest_s *)packet;
+	
+	if (responder->stats)
+		stat_inc(&responder->stats->retries);
+	
+	TRACE(TRACE_RETRY, tr->tkn, tr->ack_seq, 0);
+	memcpy(packet, tr->ack, tr->ack_len);
+	
+	if (tr->ack_data)
+		reply(responder, peer, packet, header->mtd_major, header->mtd_minor, tr->ack_data, tr->ack_size);
+	else
+		reply(responder, peer, packet, header->mtd_major, header->mtd_minor, packet + sizeof(struct urest_s), tr->ack_len - sizeof(struct urest_s));
+}
+
+/* request bytes carried by the fragments before frag, the first one may also carry options */
+static uint16_t frag_offset(struct transaction_s *tr, uint16_t frag)
+{
+	return frag ? frag * tr->payload_size - tr->skew : 0;
+}
+
+/* the response a handler left in the buffer, up to its null or as long as it says for a binary request */
+static uint16_t response_len(struct transaction_s *tr)
+{
+	if (tr->request.binary)
+		return tr->request.length < UREST_REQ_BUF_SIZE ? tr->request.length : UREST_REQ_BUF_SIZE;
+	
+	return strnlen(tr->buf + sizeof(struct urest_s), UREST_REQ_BUF_SIZE);
+}
+	
+/* the response to a packed request is packed too, or stored if that does not pay */
+static void pack_response(struct responder_s *responder, struct transaction_s *tr)
+{
+	char buf[UREST_REQ_BUF_SIZE];
+	int n;
+	
+	if (!(tr->flags & TR_COMPRESS))
+		return;
+	
+	n = urest_lz_pack(responder->dict, tr->buf + sizeof(struct urest_s), tr->data_len < UREST_REQ_BUF_SIZE ? tr->data_len : UREST_REQ_BUF_SIZE - 1,
+		buf, UREST_REQ_BUF_SIZE, responder->threshold);
+	memcpy(tr->buf + sizeof(struct urest_s), buf, n);
+	tr->data_len = n;
+}
+	
+static uint16_t frag_len(struct transaction_s *tr, uint16_t frag)
+{
+	if ((tr->flags & TR_LAST) && frag == tr->last_frag)
+		return tr->last_len;
+	
+	return frag ? tr->payload_size : tr->payload_size - tr->skew;
+}
+
+/*
+ * acknowledge the request fragments received in order so far. in a windowed
+ * transfer the ones received past them go in OPT_SACK, and the window granted
+ * is confirmed while the first fragment is acknowledged.
+ */
+static void reply_recv(struct responder_s *responder, struct transaction_s *tr, struct peer_s *peer, char *packet, uint8_t major, uint8_t minor)
+{
+	struct urest_s *header = (struct urest_s *)packet;
+	struct options_s options;
+	int len = 0;
+	
+	header->seq = htons(tr->seq - 1);
+	options.present = 0;
+	
+	if (tr->window) {
+		options.present = 1 << OPT_SACK;
+		options.sack = tr->sack;
+	
+		/* the window granted, and the one for polls once the request is complete */
+		if (tr->seq == 1 || minor == PROCESSING) {
+			options.present |= 1 << OPT_WINDOW;
+			options.window = tr->window;
+		}
+	}
+	
+	/* the lease granted to an observer */
+	if (minor == PROCESSING && (tr->flags & TR_OBSERVE) && tr->lease) {
+		options.present |= 1 << OPT_OBSERVE;
+		options.lease = tr->lease;
+	}
+	
+	if (options.present) {
+		len = urest_options_write(packet + sizeof(struct urest_s), tr->payload_size, &options);
+		header->msg_type = EXT;
+	}
+	
+	reply(responder, peer, packet, major, minor, packet + sizeof(struct urest_s), len);
+	replay_keep(tr, packet, packet + sizeof(struct urest_s), len);
+}
+
+/* unpack a request in place, through the stack. returns its length, or -1 */
+static int unpack_request(struct responder_s *responder, struct transaction_s *tr, uint16_t len)
+{
+	char buf[UREST_REQ_BUF_SIZE];
+	char *data = tr->buf + sizeof(struct urest_s);
+	int n;
+	
+	n = urest_lz_unpack(responder->dict, data, len, buf, UREST_REQ_BUF_SIZE - 1);
+	
+	if (n < 0)
+		return -1;
+	
+	memcpy(data, buf, n);
+	data[n] = '\0';
+	tr->length = n;
+	
+	return n;
+}
+	
+/* take request fragment frag, next in order. data is null if it is in the buffer already */
+static int fragment_in(struct responder_s *responder, struct transaction_s *tr, uint16_t frag, char *data, uint16_t len)
+{
+	uint16_t offset = frag_offset(tr, frag);
+	int status;
+	
+	if (tr->state == TR_BODY && tr->stream)
+		return stream_recv(tr, data ? data : tr->buf + sizeof(struct urest_s) + offset, len);
+	
+	/* status 400, a packed request is unpacked once it is all in, then taken as any other */
+	if (tr->state == TR_RECV && (tr->flags & TR_COMPRESS)) {
+		if (!((tr->flags & TR_LAST) && frag == tr->last_frag))
+			return 0;
+	
+		status = unpack_request(responder, tr, offset + len);
+	
+		if (status < 0)
+			return CLNT_ERROR * 100 + BAD_REQUEST;
+	
+		offset = 0;
+		len = status;
+	}
+	
+	/* status 400, a JSON request is parsed as it comes until its uri is found */
+	if (tr->state == TR_RECV && tr->header.cnt_type == JSON_ENC) {
+		status = urest_json_parse(&tr->json.json, tr->buf + sizeof(struct urest_s) + offset, len);
+	
+		if (status == 1)
+			return transaction_route(responder, tr, offset + len);
+	
+		if (status || ((tr->flags & TR_LAST) && frag == tr->last_frag))
+			return CLNT_ERROR * 100 + BAD_REQUEST;
+	
+		return 0;
+	}
+	
+	/* route as soon as the whole uri is in, a stream takes over from there */
+	if (tr->state == TR_RECV && (((tr->flags & TR_LAST) && frag == tr->last_frag) || memchr(tr->buf + sizeof(struct urest_s) + offset, '?', len)))
+		return transaction_route(responder, tr, offset + len);
+	
+	return 0;
+}
+
+/*
+ * answer a poll for response fragment frag. buffered responses are served in any
+ * order. in a windowed transfer streamed responses are generated ahead into a
+ * ring in the transaction slab, as far as the initiator has room (OPT_ACK).
+ * polls past the end of the response are dropped.
+ */
+static int transaction_send(struct responder_s *responder, struct transaction_s *tr, struct peer_s *peer, char *packet, uint16_t frag, struct options_s *options)
+{
+	uint16_t payload_size = tr->payload_size, cap, limit;
+	uint32_t offset;
+	uint8_t end = 0;
+	char *data;
+	int len;
+	
+	if (!tr->stream) {
+		offset = (uint32_t)frag * payload_size;
+	
+		if (offset > tr->data_len || ((tr->flags & TR_LENGTH) && offset && offset == tr->data_len))
+			return 0;
+	
+		len = tr->data_len - offset;
+	
+		if (len > payload_size)
+			len = payload_size;
+	
+		/* a binary response ends with its length, the last fragment may be full */
+		end = (tr->flags & TR_LENGTH) && offset + len == tr->data_len;
+		data = tr->buf + sizeof(struct urest_s) + offset;
+	} else if (!tr->window || (UREST_REQ_BUF_SIZE - tr->ring) < payload_size) {
+		/* generated in order, into the slab if there is room so a lost ACK can be sent again */
+		if (frag != tr->frag || (tr->flags & TR_LAST))
+			return 0;
+	
+		if (UREST_REQ_BUF_SIZE - tr->ring < payload_size)
+			data = packet + sizeof(struct urest_s);
+		else
+			data = tr->buf + sizeof(struct urest_s) + tr->ring;
+	
+		len = stream_send(tr, data, payload_size);
+		
+		if (len < payload_size)
+			tr->flags |= TR_LAST;
+	} else {
+		for (cap = 1; cap * 2 * payload_size <= UREST_REQ_BUF_SIZE - tr->ring; cap *= 2);
+		
+		/* evicted from the ring, the initiator has it */
+		if ((int16_t)(frag - tr->frag) < 0 && (uint16_t)(tr->frag - frag) > cap)
+			return 0;
+		
+		limit = (options->present & (1 << OPT_ACK)) ? (uint16_t)(options->ack - tr->resp_seq) + cap : tr->frag + 1;
+		
+		if ((int16_t)(frag - limit) >= 0)
+			return 0;
+		
+		len = 0;
+		
+		while ((int16_t)(frag - tr->frag) >= 0 && !(tr->flags & TR_LAST)) {
+			len = stream_send(tr, tr->buf + sizeof(struct urest_s) + tr->ring + (tr->frag & (cap - 1)) * payload_size, payload_size);
+			
+			if (len < 0)
+				break;
+			
+			if (len < payload_size) {
+				tr->flags |= TR_LAST;
+				tr->last_frag = tr->frag;
+				tr->last_len = len;
+			}
+			
+			tr->frag++;
+		}
+		
+		if (len >= 0) {
+			if ((tr->flags & TR_LAST) && (int16_t)(frag - tr->last_frag) > 0)
+				return 0;
+			
+			len = (tr->flags & TR_LAST) && frag == tr->last_frag ? tr->last_len : payload_size;
+		}
+		
+		data = tr->buf + sizeof(struct urest_s) + tr->ring + (frag & (cap - 1)) * payload_size;
+	}
+	
+	if (len < 0) {
+		reply(responder, peer, packet, SERV_ERROR, INTERNAL_ERROR, 0, 0);
+		replay_keep(tr, packet, 0, 0);
+		transaction_close(responder, tr, SERV_ERROR * 100 + INTERNAL_ERROR);
+		
+		return 0;
+	}
+	
+	/* windowed transactions stay until the initiator resets them, it may still miss fragments */
+	if (!tr->window) {
+		tr->frag += tr->stream ? 0 : 1;
+		tr->seq++;
+	}
+	
+	if (len == payload_size && !end) {
+		reply(responder, peer, packet, INFO, CONTINUE, data, len);
+		replay_keep(tr, packet, data, len);
+	} else {
+		reply(responder, peer, packet, SUCCESS, OK, data, len);
+		replay_keep(tr, packet, data, len);
+		tr->flags |= TR_DONE;
+	
+		if (!tr->window)
+			transaction_close(responder, tr, SUCCESS * 100 + OK);
+	}
+	
+	return 0;
+}
+
+/* on an offload thread. the transaction is left alone by the I/O thread until running is clear */
+static void offload_run(void *arg)
+{
+	struct transaction_s *tr = (struct transaction_s *)arg;
+	uint32_t start = urest_stats_clock();
+	
+	TRACE(TRACE_HANDLER, tr->tkn, tr->seq, 0);
+	run_handler(tr->handler, &tr->request, tr->buf + sizeof(struct urest_s));
+	tr->handled = urest_stats_clock() - start;
+	TRACE(TRACE_HANDLER_END, tr->tkn, tr->seq, 0);
+	__atomic_store_n(&tr->running, 0, __ATOMIC_RELEASE);
+}
+	
+/*
+ * while its handler runs on an offload thread a transaction only answers: polls
+ * get 2.02 (no data) and the last request fragment sent again gets its 1.02 back.
+ * nothing else can end it then. once the handler is done the response is sent as
+ * usual, returns 1 until then.
+ */
+static int offload_poll(struct responder_s *responder, struct transaction_s *tr, struct peer_s *peer, char *packet, uint16_t seq)
+{
+	struct urest_s *header = (struct urest_s *)packet;
+	
+	if (__atomic_load_n(&tr->running, __ATOMIC_ACQUIRE)) {
+		tr->last = urest_clock();
+	
+		if ((header->msg_type & ~EXT) != REQ)
+			return 1;
+	
+		header->tkn = htons(tr->tkn);
+	
+		if ((int16_t)(seq - tr->resp_seq) < 0) {
+			if ((uint16_t)(tr->resp_seq - seq) == 1 || tr->window)
+				reply_recv(responder, tr, peer, packet, INFO, PROCESSING);
+	
+			return 1;
+		}
+	
+		header->msg_type = REQ;
+		reply(responder, peer, packet, SUCCESS, ACCEPTED, 0, 0);
+	
+		return 1;
+	}
+	
+	tr->flags &= ~TR_OFFLOAD;
+	tr->data_len = response_len(tr);
+	pack_response(responder, tr);
+	
+	if (responder->stats) {
+		urest_stats_time(responder->stats, PHASE_HANDLER, tr->handled);
+		tr->stamp = urest_stats_clock();
+	}
+	
+	return 0;
+}
+	
+static struct subscription_s *observe_find(struct responder_s *responder, struct peer_s *peer, struct resource_s *resource, char *uri)
+{
+	struct subscription_s *sub;
+	uint16_t i;
+	
+	for (i = 0; i < responder->subscribed; i++) {
+		sub = &responder->subscription[i];
+	
+		if (sub->resource == resource && sub->peer.len == peer->len && !memcmp(sub->peer.addr, peer->addr, peer->len) && !strcmp(sub->uri, uri))
+			return sub;
+	}
+	
+	return 0;
+}
+	
+static void observe_remove(struct responder_s *responder, struct subscription_s *sub)
+{
+	*sub = responder->subscription[--responder->subscribed];
+}
+	
+/*
+ * subscribe the initiator of a GET with OPT_OBSERVE to changes of the resource,
+ * or renew its lease (0 cancels it). tr->lease is left with the lease granted,
+ * 0 if the resource can not be observed: the uri does not fit, the handler is
+ * slow or the 1.02 has no room for the option.
+ */
+static void observe_add(struct responder_s *responder, struct transaction_s *tr)
+{
+	struct subscription_s *sub;
+	char *uri = tr->buf + sizeof(struct urest_s);
+	uint16_t len;
+	
+	len = strnlen(uri, UREST_OBSERVE_URI);
+	
+	if (tr->request.method != GET || tr->request.content == JSON_ENC || (tr->flags & TR_COMPRESS) || tr->frag_size == FRAG_SIZE_JUMBO || !tr->handler || len == UREST_OBSERVE_URI || tr->payload_size <= (tr->window ? 14 : 5) ||
+		(tr->request.resource->slow & (1 << GET))) {
+		tr->lease = 0;
+	
+		return;
+	}
+	
+	sub = observe_find(responder, &tr->peer, tr->request.resource, uri);
+	
+	if (!tr->lease) {
+		if (sub)
+			observe_remove(responder, sub);
+	
+		return;
+	}
+	
+	if (!sub) {
+		if (responder->subscribed == UREST_SUBSCRIPTIONS) {
+			tr->lease = 0;
+	
+			return;
+		}
+	
+		sub = &responder->subscription[responder->subscribed++];
+		sub->peer = tr->peer;
+		sub->resource = tr->request.resource;
+		sub->seq = 0;
+		memcpy(sub->uri, uri, len + 1);
+	}
+	
+	if (tr->lease > UREST_LEASE_MAX)
+		tr->lease = UREST_LEASE_MAX;
+	
+	/* the GET answers with the value as of now */
+	sub->version = __atomic_load_n(&tr->request.resource->version, __ATOMIC_ACQUIRE);
+	sub->sent = urest_clock();
+	sub->expires = sub->sent + tr->lease * 1000;
+	sub->tkn = tr->tkn;
+	sub->frag_size = tr->frag_size;
+	sub->content = tr->request.content;
+}
+	
+/* a RST with the token of a subscription cancels it */
+static void observe_cancel(struct responder_s *responder, struct peer_s *peer, uint16_t tkn)
+{
+	struct subscription_s *sub;
+	uint16_t i;
+	
+	for (i = 0; i < responder->subscribed; i++) {
+		sub = &responder->subscription[i];
+	
+		if (sub->tkn == tkn && sub->peer.len == peer->len && !memcmp(sub->peer.addr, peer->addr, peer->len)) {
+			observe_remove(responder, sub);
+	
+			return;
+		}
+	}
+}
+	
+/*
+ * push the value of an observed resource in a UNS message. the GET handler runs
+ * on the uri subscribed to, into a slab. a value longer than a fragment is cut
+ * and sent with 1.00 (continue), the observer may GET the rest.
+ */
+static void observe_send(struct responder_s *responder, struct subscription_s *sub)
+{
+	struct urest_s *header;
+	struct request_s request;
+	struct stream_s *stream;
+	void (*handler)(void *);
+	uint16_t payload_size = frag_payload(sub->frag_size);
+	uint32_t len;
+	char *buf;
+	
+	buf = urest_pool_get(responder->pool);
+	
+	if (!buf)
+		return;
+	
+	header = (struct urest_s *)buf;
+	header->frag_size = sub->frag_size;
+	header->msg_type = REQ;
+	header->cnt_type = sub->content;
+	header->mtd_major = VERB;
+	header->mtd_minor = GET;
+	strcpy(buf + sizeof(struct urest_s), sub->uri);
+	
+	/* routed again for the path parameters */
+	if (route(responder->resource_list, header, buf + sizeof(struct urest_s), &request, &handler, &stream) || !handler) {
+		urest_pool_put(responder->pool, buf);
+	
+		return;
+	}
+	
+	run_handler(handler, &request, buf + sizeof(struct urest_s));
+	len = strnlen(buf + sizeof(struct urest_s), UREST_REQ_BUF_SIZE);
+	
+	header->msg_type = UNS;
+	header->mtd_major = len > payload_size ? INFO : SUCCESS;
+	header->mtd_minor = len > payload_size ? CONTINUE : OK;
+	header->tkn = htons(sub->tkn);
+	header->seq = htons(++sub->seq);
+	
+	if (len > payload_size)
+		len = payload_size;
+	
+	responder->packet_drv->packet_handler_sendto(responder->packet_drv->packet_arg, &sub->peer, buf, sizeof(struct urest_s) + len);
+	urest_pool_put(responder->pool, buf);
+}
+	
+/*
+ * push the resources changed since their last UNS to the observers, at most one
+ * per UREST_NOTIFY_INTERVAL each, and drop expired leases. returns the time (in
+ * ms) until the next check, or -1 without observers.
+ */
+static int observe_push(struct responder_s *responder, uint32_t now)
+{
+	struct subscription_s *sub;
+	uint32_t version;
+	uint16_t i = 0;
+	int next = UREST_NOTIFY_INTERVAL;
+	
+	while (i < responder->subscribed) {
+		sub = &responder->subscription[i];
+	
+		if ((int32_t)(now - sub->expires) >= 0) {
+			observe_remove(responder, sub);
+	
+			continue;
+		}
+	
+		version = __atomic_load_n(&sub->resource->version, __ATOMIC_ACQUIRE);
+	
+		if (version != sub->version) {
+			if (now - sub->sent >= UREST_NOTIFY_INTERVAL) {
+				sub->version = version;
+				sub->sent = now;
+				observe_send(responder, sub);
+			} else if ((int)(UREST_NOTIFY_INTERVAL - (now - sub->sent)) < next) {
+				next = UREST_NOTIFY_INTERVAL - (now - sub->sent);
+			}
+		}
+	
+		i++;
+	}
+	
+	return responder->subscribed ? next : -1;
+}
+	
+/*
+ * take a request fragment. fragments ahead of the next one expected are stored
+ * and selectively acknowledged, up to the window. returns 0 or a status to abort
+ * the transaction with.
+ */
+static int transaction_recv(struct responder_s *responder, struct transaction_s *tr, struct peer_s *peer, char *packet, uint16_t seq, char *data, uint16_t data_len, uint16_t room)
+{
+	uint16_t ahead = seq - tr->seq, offset, cap;
+	uint32_t start;
+	uint8_t last;
+	int status;
+	
+	/* acknowledged already, the ACK got lost */
+	if ((int16_t)ahead < 0) {
+		reply_recv(responder, tr, peer, packet, INFO, CONTINUE);
+		
+		return 0;
+	}
+	
+	if (ahead >= tr->window && ahead)
+		return 0;
+	
+	/* a duplicate, or a stream body fragment out of order (those are not kept) */
+	if (ahead && (((tr->sack >> (ahead - 1)) & 1) || (tr->state == TR_BODY && tr->stream))) {
+		reply_recv(responder, tr, peer, packet, INFO, CONTINUE);
+		
+		return 0;
+	}
+	
+	/* a binary request ends with its length, maybe with a full fragment */
+	if (tr->flags & TR_LENGTH) {
+		start = seq ? (uint32_t)seq * tr->payload_size - tr->skew : 0;
+	
+		if (start + data_len >= tr->length)
+			data_len = start < tr->length ? tr->length - start : 0;
+	}
+	
+	last = data_len < room || ((tr->flags & TR_LENGTH) && start + data_len == tr->length);
+	
+	if (tr->state != TR_BODY || !tr->stream) {
+		offset = frag_offset(tr, seq);
+	
+		/* status 414 */
+		if (offset + tr->payload_size >= UREST_REQ_BUF_SIZE)
+			return CLNT_ERROR * 100 + TOO_LONG;
+		
+		/* the first fragment of a request reassembled in place is already there */
+		if (tr->buf != packet)
+			memcpy(tr->buf + sizeof(struct urest_s) + offset, data, data_len);
+		
+		if (last)
+			tr->buf[sizeof(struct urest_s) + offset + data_len] = '\0';
+	
+		data = 0;
+	}
+	
+	if (last) {
+		tr->flags |= TR_LAST;
+		tr->last_frag = seq;
+		tr->last_len = data_len;
+	}
+	
+	if (ahead) {
+		tr->sack |= 1 << (ahead - 1);
+		reply_recv(responder, tr, peer, packet, INFO, CONTINUE);
+		
+		return 0;
+	}
+	
+	/* take this fragment and the stored ones it makes contiguous */
+	status = fragment_in(responder, tr, seq, data, data_len);
+	tr->seq++;
+	
+	while (!status && (tr->sack & 1)) {
+		tr->sack >>= 1;
+		status = fragment_in(responder, tr, tr->seq, 0, frag_len(tr, tr->seq));
+		tr->seq++;
+	}
+	
+	tr->sack >>= 1;
+	
+	if (status)
+		return status;
+	
+	if (!(tr->flags & TR_LAST) || (int16_t)(tr->seq - tr->last_frag) <= 0) {
+		reply_recv(responder, tr, peer, packet, INFO, CONTINUE);
+		
+		return 0;
+	}
+	
+	tr->request.length = (tr->flags & TR_COMPRESS) ? tr->length : frag_offset(tr, tr->last_frag) + tr->last_len;
+	tr->request.binary = (tr->flags & (TR_LENGTH | TR_COMPRESS)) == TR_LENGTH;
+	tr->frag = 0;
+	tr->flags &= ~TR_LAST;
+	tr->resp_seq = tr->seq;
+	tr->state = TR_SEND;
+	stats_phase(responder, tr, PHASE_REASSEMBLY);
+	
+	if (tr->stream) {
+		tr->request.offset = 0;
+	
+		/* polls are not answered past the ring the response is generated into */
+		if (tr->window) {
+			for (cap = 1; cap * 2 * tr->payload_size <= UREST_REQ_BUF_SIZE - tr->ring; cap *= 2);
+	
+			if (cap < tr->window)
+				tr->window = cap;
+		}
+	
+		reply_recv(responder, tr, peer, packet, INFO, PROCESSING);
+		
+		return 0;
+	}
+	
+	/* before the handler turns the uri into the response */
+	if (tr->flags & TR_OBSERVE)
+		observe_add(responder, tr);
+	
+	if (tr->handler && responder->offload && (tr->request.resource->slow & (1 << tr->request.method))) {
+		tr->running = 1;
+	
+		/* status 503 */
+		if (urest_offload_submit(responder->offload, offload_run, tr)) {
+			tr->running = 0;
+	
+			return SERV_ERROR * 100 + SERVICE_UNAVAILABLE;
+		}
+	
+		tr->flags |= TR_OFFLOAD;
+		reply_recv(responder, tr, peer, packet, INFO, PROCESSING);
+	
+		return 0;
+	}
+	
+	if (tr->handler) {
+		reply_recv(responder, tr, peer, packet, INFO, PROCESSING);
+		TRACE(TRACE_HANDLER, tr->tkn, tr->seq, 0);
+		run_handler(tr->handler, &tr->request, tr->buf + sizeof(struct urest_s));
+		TRACE(TRACE_HANDLER_END, tr->tkn, tr->seq, 0);
+		stats_phase(responder, tr, PHASE_HANDLER);
+	} else if (tr->flags & TR_STATS) {
+		/* polled for like the response of a handler */
+		reply_recv(responder, tr, peer, packet, INFO, PROCESSING);
+		urest_stats_write(responder->stats, responder->resource_list, tr->buf + sizeof(struct urest_s), UREST_REQ_BUF_SIZE);
+	}
+	
+	/* the response length is computed once, not per fragment */
+	tr->data_len = response_len(tr);
+	pack_response(responder, tr);
+	
+	/* PINGREQ is answered right away */
+	if (!tr->handler && !(tr->flags & TR_STATS))
+		return transaction_send(responder, tr, peer, packet, 0, 0);
+	
+	return 0;
+}
+
+/* FNV-1a over the peer address and the whole first fragment */
+static uint32_t opening_hash(struct peer_s *peer, char *packet, uint16_t size)
+{
+	uint32_t hash = 2166136261u;
+	uint16_t i;
+	
+	for (i = 0; i < peer->len; i++)
+		hash = (hash ^ (uint8_t)peer->addr[i]) * 16777619;
+	
+	for (i = 0; i < size; i++)
+		hash = (hash ^ (uint8_t)packet[i]) * 16777619;
+	
+	return hash ? hash : 1;
+}
+	
+/* a token from the bucket of the peer, refilled for the time since it was last seen. returns 0 if empty */
+static int limit_take(struct responder_s *responder, struct peer_s *peer)
+{
+	struct limit_s *set, *bucket = 0;
+	uint32_t hash = 2166136261u, now = urest_clock(), max = responder->burst * 1000;
+	uint64_t tokens;
+	uint16_t i;
+	
+	for (i = 0; i < peer->len; i++)
+		hash = (hash ^ (uint8_t)peer->addr[i]) * 16777619;
+	
+	set = responder->limit + (hash & responder->limit_mask) * UREST_LIMIT_WAYS;
+	
+	for (i = 0; i < UREST_LIMIT_WAYS; i++) {
+		if (set[i].stamp && set[i].peer.len == peer->len && !memcmp(set[i].peer.addr, peer->addr, peer->len)) {
+			bucket = &set[i];
+			break;
+		}
+	
+		/* an unused bucket, or else the least recently seen */
+		if (!bucket || (bucket->stamp && (!set[i].stamp || (int32_t)(set[i].stamp - bucket->stamp) < 0)))
+			bucket = &set[i];
+	}
+	
+	/* a newcomer starts with a full bucket */
+	if (i == UREST_LIMIT_WAYS) {
+		bucket->peer = *peer;
+		bucket->tokens = max;
+		bucket->stamp = now ? now : 1;
+	}
+	
+	tokens = bucket->tokens + (uint64_t)(uint32_t)(now - bucket->stamp) * responder->rate;
+	bucket->tokens = tokens > max ? max : tokens;
+	bucket->stamp = now ? now : 1;
+	
+	if (bucket->tokens < 1000)
+		return 0;
+	
+	bucket->tokens -= 1000;
+	
+	return 1;
+}
+	
+/* count a new transaction refused with status, 5.03 or 4.29 */
+static int shed(struct responder_s *responder, int status)
+{
+	int busy = status / 100 == SERV_ERROR;
+	
+	/* read by urest_workers_shed() from another thread */
+	__atomic_fetch_add(busy ? &responder->shed.busy : &responder->shed.rate, 1, __ATOMIC_RELAXED);
+	
+	if (responder->stats)
+		stat_inc(busy ? &responder->stats->shed.busy : &responder->stats->shed.rate);
+	
+	return status;
+}
+	
+/* status 5.03 or 4.29 for a new transaction to be shed, 0 to take it */
+static int admit(struct responder_s *responder, struct peer_s *peer)
+{
+	if (responder->admit && responder->active - responder->waiting >= responder->admit)
+		return shed(responder, SERV_ERROR * 100 + SERVICE_UNAVAILABLE);
+	
+	if (responder->limit && !limit_take(responder, peer))
+		return shed(responder, CLNT_ERROR * 100 + TOO_MANY);
+	
+	return 0;
+}
+	
+/*
+ * the transaction opened by a first fragment with this hash, while its first ACK
+ * is the last one sent. past that the initiator has the token, and the same
+ * fragment opens a new request.
+ */
+static struct transaction_s *opening_find(struct responder_s *responder, struct peer_s *peer, uint32_t hash)
+{
+	struct transaction_s *tr;
+	uint16_t slot;
+	
+	slot = responder->opening[hash & ((1 << responder->slot_bits) - 1)];
+	
+	if (!slot)
+		return 0;
+	
+	tr = &responder->transaction[slot - 1];
+	
+	if (tr->state == TR_FREE || tr->hash != hash || !tr->ack_len || tr->ack_seq != 0)
+		return 0;
+	
+	if (tr->peer.len != peer->len || memcmp(tr->peer.addr, peer->addr, peer->len))
+		return 0;
+	
+	return tr;
+}
+	
+static int process_packet(struct responder_s *responder, char *packet, uint16_t size, struct peer_s *peer)
+{
+	struct urest_s *header = (struct urest_s *)packet;
+	struct transaction_s *tr;
+	struct options_s options;
+	uint16_t data_len, payload_size, room, seq, tkn;
+	uint32_t hash = 0;
+	char *data;
+	int status, len = 0;
+	
+	if (size < sizeof(struct urest_s))
+		return 0;
+		
+	/* jumbo fragments are as long as the first one of their transaction says */
+	payload_size = header->frag_size == FRAG_SIZE_JUMBO ? UREST_PACKET_SIZE - sizeof(struct urest_s) : frag_payload(header->frag_size);
+	
+	if (!payload_size)
+		return UNKNOWN_FRAGMENT_SIZE;
+	
+	seq = ntohs(header->seq);
+	tkn = ntohs(header->tkn);
+	
+	if (tkn && responder->shard_bits && tkn >> (16 - responder->shard_bits) != responder->shard) {
+		if (!responder->handoff)
+			return WRONG_TOKEN;
+		
+		responder->handoff(responder->handoff_arg, tkn >> (16 - responder->shard_bits), packet, size, peer);
+		
+		return 0;
+	}
+	
+	/* first fragments carry no token, one sent again is told apart by its content */
+	if (tkn == 0)
+		hash = opening_hash(peer, packet, size);
+	
+	size -= sizeof(struct urest_s);
+	
+	if (size > payload_size)
+		size = payload_size;
+	
+	data = packet + sizeof(struct urest_s);
+	options.present = 0;
+	
+	if (header->msg_type & EXT) {
+		len = urest_options_parse(data, size, &options);
+		
+		if (len < 0)
+			return BAD_OPTIONS;
+		
+		header->msg_type &= ~EXT;
+		data += len;
+		size -= len;
+	}
+	
+	if (tkn == 0) {
+		if (seq != 0)
+			return SEQUENCE_MISMATCH;
+	
+		tr = opening_find(responder, peer, hash);
+	
+		/* the first ACK got lost, or is on the way */
+		if (tr) {
+			replay(responder, tr, peer, packet);
+	
+			return 0;
+		}
+	
+		/* shed before a slab is taken, a refused first fragment sent again is charged again */
+		status = admit(responder, peer);
+	
+		if (status) {
+			reply(responder, peer, packet, status / 100, status % 100, 0, 0);
+	
+			return 0;
+		}
+	
+		/* status 415, packed with a dictionary not shared, or not framed with its length */
+		if ((options.present & (1 << OPT_COMPRESS)) &&
+			(!responder->dict || options.dict != responder->dict->id || !(options.present & (1 << OPT_LENGTH)))) {
+			reply(responder, peer, packet, CLNT_ERROR, UNSUPPORTED, 0, 0);
+	
+			return 0;
+		}
+	
+		/* status 413, jumbo fragments of a size not taken, the initiator steps down to 1024 bytes */
+		if (header->frag_size == FRAG_SIZE_JUMBO) {
+			if (!(options.present & (1 << OPT_JUMBO)) || options.jumbo <= 1024 || options.jumbo > UREST_PACKET_SIZE ||
+				(options.jumbo & (options.jumbo - 1))) {
+				reply(responder, peer, packet, CLNT_ERROR, TOO_LARGE, 0, 0);
+	
+				return 0;
+			}
+	
+			payload_size = options.jumbo - sizeof(struct urest_s);
+		}
+	
+		/* requests with options are copied, ACK options would overwrite them in place */
+		tr = transaction_new(responder, peer, packet, len == 0);
+		
+		/* status 503 */
+		if (!tr) {
+			shed(responder, SERV_ERROR * 100 + SERVICE_UNAVAILABLE);
+			reply(responder, peer, packet, SERV_ERROR, SERVICE_UNAVAILABLE, 0, 0);
+			
+			return 0;
+		}
+		
+		TRACE(TRACE_FIRST, tr->tkn, seq, 0);
+		tr->frag_size = header->frag_size;
+		tr->payload_size = payload_size;
+		tr->skew = len;
+		tr->hash = hash;
+		responder->opening[hash & ((1 << responder->slot_bits) - 1)] = tr - responder->transaction + 1;
+		
+		/* a window asked for in the first fragment is granted up to UREST_WINDOW */
+		if ((options.present & (1 << OPT_WINDOW)) && options.window)
+			tr->window = options.window < UREST_WINDOW ? options.window : UREST_WINDOW;
+	
+		/* a lease asked for, granted once the request is routed */
+		if (options.present & (1 << OPT_OBSERVE)) {
+			tr->flags |= TR_OBSERVE;
+			tr->lease = options.lease;
+		}
+	
+		/* a binary request, its length tells where it ends */
+		if (options.present & (1 << OPT_LENGTH)) {
+			tr->flags |= TR_LENGTH;
+			tr->length = options.length;
+		}
+	
+		if (options.present & (1 << OPT_COMPRESS))
+			tr->flags |= TR_COMPRESS;
+	} else {
+		/* an observer gives up its subscription */
+		if (header->msg_type == RST && responder->subscribed)
+			observe_cancel(responder, peer, tkn);
+	
+		tr = transaction_find(responder, peer, tkn);
+		
+		if (!tr)
+			return WRONG_TOKEN;
+	
+		TRACE(TRACE_FRAGMENT, tkn, seq, 0);
+	
+		if ((tr->flags & TR_OFFLOAD) && offload_poll(responder, tr, peer, packet, seq))
+			return 0;
+	
+		/* finished, only its last ACK is sent again */
+		if (tr->state == TR_WAIT) {
+			if (header->msg_type == RST) {
+				TRACE(TRACE_RESET, tkn, seq, 0);
+				transaction_release(responder, tr);
+			} else if (seq == tr->ack_seq && tr->ack_len) {
+				replay(responder, tr, peer, packet);
+			}
+	
+			return 0;
+		}
+	
+		if (header->frag_size != tr->frag_size) {
+			transaction_free(responder, tr, FRAGMENT_SIZE_MISMATCH);
+			
+			return FRAGMENT_SIZE_MISMATCH;
+		}
+		
+		/* the initiator closes windowed transactions, or gives up on any */
+		if (header->msg_type == RST) {
+			TRACE(TRACE_RESET, tkn, seq, 0);
+			transaction_free(responder, tr, SUCCESS * 100 + ((tr->flags & TR_DONE) ? OK : RESET));
+			
+			return 0;
+		}
+		
+		if (!tr->window && seq != tr->seq) {
+			/* sent again while its ACK was on the way, or the ACK was lost */
+			if (seq == (uint16_t)(tr->seq - 1)) {
+				if (seq == tr->ack_seq && tr->ack_len)
+					replay(responder, tr, peer, packet);
+	
+				return 0;
+			}
+	
+			if (++tr->retries >= UREST_RETRIES) {
+				transaction_free(responder, tr, SEQUENCE_MISMATCH);
+				
+				return SEQUENCE_MISMATCH;
+			}
+			
+			return 0;
+		}
+	
+		payload_size = tr->payload_size;
+	}
+	
+	if (size > payload_size - len)
+		size = payload_size - len;
+	
+	room = payload_size - len;
+	tr->last = urest_clock();
+	header->tkn = htons(tr->tkn);
+	
+	if (tr->state != TR_SEND) {
+		data_len = (tr->flags & TR_LENGTH) ? size : strnlen(data, size);
+		status = transaction_recv(responder, tr, peer, packet, seq, data, data_len, room);
+		
+		if (status) {
+			reply(responder, peer, packet, status / 100, status % 100, 0, 0);
+			replay_keep(tr, packet, 0, 0);
+			transaction_close(responder, tr, status);
+		}
+		
+		return 0;
+	}
+	
+	if (!tr->window)
+		return transaction_send(responder, tr, peer, packet, tr->frag, &options);
+	
+	/* a request fragment sent again, the 1.02 got lost */
+	if (!(tr->flags & TR_POLLED) && (int16_t)(seq - tr->resp_seq) < 0) {
+		reply_recv(responder, tr, peer, packet, INFO, PROCESSING);
+	
+		return 0;
+	}
+	
+	tr->flags |= TR_POLLED;
+	
+	return transaction_send(responder, tr, peer, packet, seq - tr->resp_seq, &options);
+}
+	
+/*
+ * process a single datagram and return immediately. the transaction is looked up
+ * by (peer, token), advanced by one step and the resulting ACK is sent through the
+ * driver sendto() handler. packet is reused to build the ACK, so it must be large
+ * enough for a full fragment.
+ */
+int urest_process_packet(struct responder_s *responder, char *packet, uint16_t size, struct peer_s *peer)
+{
+	int status;
+	
+	status = process_packet(responder, packet, size, peer);
+	
+	if (responder->stats && status >= UNKNOWN_FRAGMENT_SIZE && status <= BAD_OPTIONS)
+		stat_inc(&responder->stats->errors[status - UNKNOWN_FRAGMENT_SIZE]);
+	
+	return status;
+}
+
+/*
+ * process a vector of datagrams and flush all resulting ACKs with a single call
+ * to the driver send_batch() handler (or one sendto() per ACK without it). each
+ * ACK is built in place of the datagram it answers. datagrams received into
+ * slabs of responder->pool may be kept by a new transaction, dgram[i].data is
+ * then replaced by another slab. returns the number of ACKs sent.
+ */
+int urest_process_batch(struct responder_s *responder, struct datagram_s *dgram, int count)
+{
+	struct datagram_s out[UREST_BATCH];
+	int i, sent;
+	
+	if (count > UREST_BATCH)
+		count = UREST_BATCH;
+	
+	responder->out = out;
+	responder->out_count = 0;
+	
+	for (i = 0; i < count; i++) {
+		urest_process_packet(responder, dgram[i].data, dgram[i].size, &dgram[i].peer);
+		
+		if (responder->swap) {
+			dgram[i].data = responder->swap;
+			responder->swap = 0;
+		}
+	}
+	
+	responder->out = 0;
+	
+	if (responder->packet_drv->packet_handler_send_batch) {
+		sent = responder->packet_drv->packet_handler_send_batch(responder->packet_drv->packet_arg, out, responder->out_count);
+	} else {
+		for (i = 0, sent = 0; i < responder->out_count; i++, sent++) {
+			if (out[i].payload_size)
+				memcpy(out[i].data + out[i].size, out[i].payload, out[i].payload_size);
+			
+			responder->packet_drv->packet_handler_sendto(responder->packet_drv->packet_arg, &out[i].peer, out[i].data, out[i].size + out[i].payload_size);
+		}
+	}
+	
+	while (responder->retired_count)
+		urest_pool_put(responder->pool, responder->retired[--responder->retired_count]);
+	
+	return sent;
+}
+
+/*
+ * drop transactions that have been idle for longer than UREST_TRANSACTION_TIMEOUT,
+ * and finished ones after UREST_TIME_WAIT. returns the time (in ms) until the next
+ * transaction may expire, or -1 if there are no active transactions.
+ */
+int urest_expire(struct responder_s *responder)
+{
+	struct transaction_s *tr;
+	uint32_t now, idle, limit;
+	int i, next = -1;
+	
+	if (!responder->active)
+		return -1;
+	
+	now = urest_clock();
+	
+	for (i = 0; i < responder->transactions; i++) {
+		tr = &responder->transaction[i];
+		
+		if (tr->state == TR_FREE)
+			continue;
+	
+		/* the offload thread still has it */
+		if ((tr->flags & TR_OFFLOAD) && __atomic_load_n(&tr->running, __ATOMIC_ACQUIRE))
+			tr->last = now;
+	
+		idle = now - tr->last;
+		limit = tr->state == TR_WAIT ? UREST_TIME_WAIT : UREST_TRANSACTION_TIMEOUT;
+	
+		if (idle >= limit) {
+			if (tr->state == TR_WAIT)
+				transaction_release(responder, tr);
+			else
+				transaction_free(responder, tr, (tr->flags & TR_DONE) ? SUCCESS * 100 + OK : CLNT_ERROR * 100 + REQ_TIMEOUT);
+	
+			continue;
+		}
+	
+		if (next < 0 || (int)(limit - idle) < next)
+			next = limit - idle;
+	}
+	
+	return next;
+}
+
+
+
+struct server_s *urest_link(struct clnt_packet_s *clnt_packet, char *ip, uint16_t port, uint8_t frag_size)
+{
+	struct server_s *server;
+	
+	server = malloc(sizeof(struct server_s));
+	
+	if (!server)
+		return 0;
+		
+	server->ip = malloc(strlen(ip) + 2);
+	
+	if (!server->ip) {
+		free(server);
+		
+		return 0;
+	}
+
+	strcpy(server->ip, ip);
+	server->port = port;
+	server->packet_drv = clnt_packet;
+	server->frag_size = frag_size;
+	server->window = 0;
+	server->content = FLAT_ENC;
+	server->ring = 0;
+	server->dict = 0;
+	server->threshold = 0;
+	server->jumbo = 0;
+	server->frag_min = 0;
+	server->frag_max = 0;
+	server->lost = 0;
+	server->clean = 0;
+	urest_rtt_init(&server->rtt);
+	server->timeout = 0;
+	
+	return server;
+}
+
+/* free a server, its driver and dictionary are the application's */
+void urest_unlink(struct server_s *server)
+{
+	free(server->ring);
+	free(server->ip);
+	free(server);
+}
+
+
+/* size of the fragments the server is sent (bytes) */
+static uint16_t frag_bytes(struct server_s *server)
+{
+	return server->frag_size == FRAG_SIZE_JUMBO ? server->jumbo : 8 << server->frag_size;
+}
+	
+/* size is a power of two from 16 to UREST_PACKET_SIZE */
+static void frag_set(struct server_s *server, uint16_t size)
+{
+	uint8_t frag_size;
+	
+	for (frag_size = FRAG_SIZE_16; frag_size < FRAG_SIZE_1024 && (8 << frag_size) < size; frag_size++);
+	
+	server->frag_size = size > 1024 ? FRAG_SIZE_JUMBO : frag_size;
+	server->jumbo = size > 1024 ? size : 0;
+}
+	
+/* payload of the fragments the server is sent, 0 if their size is unknown */
+static uint16_t server_payload(struct server_s *server)
+{
+	if (server->frag_size == FRAG_SIZE_JUMBO)
+		return server->jumbo ? server->jumbo - sizeof(struct urest_s) : 0;
+	
+	return frag_payload(server->frag_size);
+}
+	
+/* options in the first fragment of a request sent with its length, packed with dict or not */
+static uint16_t length_options(struct server_s *server, uint16_t dict)
+{
+	uint16_t len = 6 + 1;				/* OPT_LENGTH and OPT_END */
+	
+	if (dict)
+		len += 4;
+	
+	if (server->window)
+		len += 3;
+	
+	if (server->frag_size == FRAG_SIZE_JUMBO)
+		len += 4;
+	
+	return len;
+}
+	
+
+/* a request or response kept in memory, read by buffer_source() or filled by buffer_sink() */
+struct buffer_s {
+	char *data;
+	uint32_t size;
+	uint32_t len;
+};
+	
+static int buffer_source(void *arg, char *data, uint16_t size)
+{
+	struct buffer_s *buffer = (struct buffer_s *)arg;
+	uint32_t len;
+	
+	len = buffer->size - buffer->len;
+	
+	if (len > size)
+		len = size;
+	
+	memcpy(data, buffer->data + buffer->len, len);
+	buffer->len += len;
+	
+	return len;
+}
+	
+/* responses that do not fit are truncated, the buffer is always null terminated */
+static int buffer_sink(void *arg, char *data, uint16_t len)
+{
+	struct buffer_s *buffer = (struct buffer_s *)arg;
+	
+	if (buffer->len + len >= buffer->size)
+		len = buffer->size - buffer->len - 1;
+	
+	memcpy(buffer->data + buffer->len, data, len);
+	buffer->len += len;
+	buffer->data[buffer->len] = '\0';
+	
+	return 0;
+}
+	
+/* tell the driver how long to wait for an ACK, it only hears about changes */
+static void ack_timeout(struct server_s *server, uint8_t retries)
+{
+	uint32_t timeout;
+	
+	if (!server->packet_drv->packet_timeout)
+		return;
+	
+	timeout = urest_rtt_timeout(&server->rtt, retries);
+	
+	if (timeout != server->timeout) {
+		server->packet_drv->packet_timeout(server->packet_drv->packet_arg, timeout);
+		server->timeout = timeout;
+	}
+}
+	
+/*
+ * send the fragment in the packet buffer and wait for its ACK. the wait is the
+ * RTO of the server if the driver can set it, and doubles each time the fragment
+ * is sent again. returns 0 or REQUEST_FAILED when UREST_RETRIES are used up.
+ */
+static int exchange_packet(struct server_s *server, uint16_t size, uint16_t *pkt_len)
+{
+	struct clnt_packet_s *drv = server->packet_drv;
+	char sent[UREST_PACKET_SIZE];
+	uint32_t start;
+	uint8_t retries = 0;
+	
+	/* drivers clear the buffer before receiving */
+	memcpy(sent, drv->packet, size);
+	
+	while (1) {
+		ack_timeout(server, retries);
+		start = urest_clock();
+		drv->packet_handler(drv->packet_arg, drv->packet, size, pkt_len);
+	
+		/* the responder answers a fragment sent again too, an ACK to the one before may come late */
+		while (*pkt_len && ((struct urest_s *)drv->packet)->seq != ((struct urest_s *)sent)->seq) {
+			*pkt_len = 0;
+	
+			if (!drv->packet_recv)
+				break;
+	
+			drv->packet_recv(drv->packet_arg, drv->packet, pkt_len);
+		}
+	
+		if (*pkt_len) {
+			/* an ACK to a fragment sent again may answer either one, no sample */
+			if (!retries)
+				urest_rtt_sample(&server->rtt, urest_clock() - start);
+	
+			return 0;
+		}
+	
+		if (retries++ == UREST_RETRIES)
+			return REQUEST_FAILED;
+	
+		server->lost++;
+		memcpy(drv->packet, sent, size);
+	}
+}
+	
+/*
+ * the payload of each request fragment is filled by source(), a fragment that is
+ * not full is the last one. a binary request (length not negative) goes with
+ * OPT_LENGTH in the first fragment and ends with length bytes, a packed one with
+ * OPT_COMPRESS too (dict is the id of the dictionary, or 0).
+ */
+static int send_data(struct server_s *server, uint8_t method, int (*source)(void *, char *, uint16_t), void *arg, int32_t length, uint16_t dict, uint16_t *seq_val, uint16_t *token)
+{
+	char buf[sizeof(struct urest_s)];
+	struct urest_s *header = (struct urest_s *)server->packet_drv->packet;
+	struct urest_s *request = (struct urest_s *)buf;
+	struct options_s options;
+	uint16_t seq = 0;
+	uint16_t pkt_len, payload_size, size;
+	uint32_t sent = 0;
+	int optlen;
+	
+	*token = 0;
+	
+	payload_size = server_payload(server);
+	
+	if (!payload_size)
+		return UNKNOWN_FRAGMENT_SIZE;
+	
+	do {
+		header->frag_size = server->frag_size;
+		header->msg_type = REQ;
+		header->cnt_type = server->content;
+		header->mtd_major = VERB;
+		header->mtd_minor = method;
+		header->seq = htons(seq);
+		optlen = 0;
+	
+		if (seq == 0) {
+			header->tkn = htons(0);
+			*request = *header;
+			options.present = 0;
+	
+			if (length >= 0) {
+				options.present = 1 << OPT_LENGTH;
+				options.length = length;
+				options.dict = dict;
+	
+				if (dict)
+					options.present |= 1 << OPT_COMPRESS;
+			}
+	
+			if (server->frag_size == FRAG_SIZE_JUMBO) {
+				options.present |= 1 << OPT_JUMBO;
+				options.jumbo = server->jumbo;
+			}
+	
+			if (options.present) {
+				optlen = urest_options_write(server->packet_drv->packet + sizeof(struct urest_s), payload_size, &options);
+				header->msg_type |= EXT;
+	
+				/* the options and at least a byte of the request go in the first fragment */
+				if (optlen < 0 || optlen >= payload_size)
+					return BAD_OPTIONS;
+			}
+		}
+	
+		if (seq == 1) {
+			request->tkn = header->tkn;
+		}
+	
+		size = source(arg, server->packet_drv->packet + sizeof(struct urest_s) + optlen, payload_size - optlen);
+		sent += size;
+	
+		/* send a REQ packet and wait for an ACK... */
+		if (exchange_packet(server, sizeof(struct urest_s) + optlen + size, &pkt_len))
+			return REQUEST_FAILED;
+
+		if (header->frag_size != request->frag_size)
+			return FRAGMENT_SIZE_MISMATCH;
+
+		if (ntohs(header->seq) != seq)
+			return SEQUENCE_MISMATCH;
+
+		if (seq > 0 && header->tkn != request->tkn)
+			return WRONG_TOKEN;
+
+		if (header->mtd_major == INFO) {
+/*			if (header->mtd_minor == CONTINUE)
+				printf("CONTINUE, token 0x%04x\n", ntohs(header->tkn));
+			else {
+				printf("PROCESSING, token 0x%04x\n", ntohs(header->tkn));
+				break;
+			}
+*/
+			if (header->mtd_minor == PROCESSING)
+				break;
+		} else {
+			return header->mtd_major * 100 + header->mtd_minor;
+		}
+
+		seq++;
+	} while (size == payload_size - optlen && (length < 0 || sent < (uint32_t)length));
+	
+	if (header->mtd_major == INFO) {
+		if (header->mtd_minor != PROCESSING)
+			return header->mtd_major * 100 + header->mtd_minor;
+	} else {
+		return header->mtd_major * 100 + header->mtd_minor;
+	}
+	
+	*seq_val = seq + 1;
+	*token = request->tkn;
+	
+	return 0;
+}
+
+/* a 2.02 without data, the response is not ready yet */
+static int accepted(struct urest_s *header, uint16_t pkt_len)
+{
+	return header->mtd_major == SUCCESS && header->mtd_minor == ACCEPTED && pkt_len == sizeof(struct urest_s);
+}
+	
+/* sleep before polling again, from an RTO doubling up to UREST_POLL_INTERVAL. returns the next wait */
+static uint32_t poll_wait(struct server_s *server, uint32_t wait)
+{
+	struct timespec ts;
+	
+	if (!wait)
+		wait = server->rtt.rto;
+	
+	if (wait > UREST_POLL_INTERVAL)
+		wait = UREST_POLL_INTERVAL;
+	
+	ts.tv_sec = wait / 1000;
+	ts.tv_nsec = (wait % 1000) * 1000000;
+	nanosleep(&ts, 0);
+	
+	return wait * 2;
+}
+	
+/* the payload of each response fragment is passed to sink(), a binary response ends with one not 1.00 */
+static int recv_data(struct server_s *server, uint8_t method, int (*sink)(void *, char *, uint16_t), void *arg, int32_t length, uint16_t *seq_val, uint16_t *token)
+{
+	struct urest_s *header = (struct urest_s *)server->packet_drv->packet;
+	uint16_t seq = *seq_val;
+	uint16_t pkt_len, payload_size;
+	uint32_t wait = 0;
+	
+	while (1) {
+		header->frag_size = server->frag_size;
+		header->msg_type = REQ;
+		header->cnt_type = server->content;
+		header->mtd_major = VERB;
+		header->mtd_minor = method;
+		header->seq = htons(seq);
 
 		/* send a REQ packet and wait for an ACK... */
-		server->packet_drv->packet_handler(server->packet_drv->packet_arg, server->packet_drv->packet, sizeof(struct urest_s) + size, &pkt_len);
+		if (exchange_packet(server, sizeof(struct urest_s), &pkt_len))
+			return REQUEST_FAILED;
+		
+		payload_size = server_payload(server);
+	
+		if (!payload_size)
+			return UNKNOWN_FRAGMENT_SIZE;
+		
+		if (pkt_len < sizeof(struct urest_s))
+			return REQUEST_FAILED;
+	
+		if (ntohs(header->seq) != seq)
+			return SEQUENCE_MISMATCH;
+	
+		/* accepted, the handler still runs: the same fragment is asked for again later */
+		if (accepted(header, pkt_len)) {
+			wait = poll_wait(server, wait);
+	
+			continue;
+		}
+	
+		if (pkt_len > sizeof(struct urest_s) && sink(arg, server->packet_drv->packet + sizeof(struct urest_s), pkt_len - sizeof(struct urest_s)))
+			return REQUEST_FAILED;
+
+/*		if (header->mtd_major == INFO) {
+			if (header->mtd_minor == CONTINUE)
+				printf("CONTINUE, token 0x%04x\n", ntohs(header->tkn));
+		}
+*/		
+		seq++;
+	
+		/* a full fragment is followed by more, for a binary response only while it is 1.00 */
+		if (pkt_len - sizeof(struct urest_s) != payload_size || (length >= 0 && (header->mtd_major != INFO || header->mtd_minor != CONTINUE)))
+			break;
+	}
+	
+	return header->mtd_major * 100 + header->mtd_minor;
+}
+	
+/* pass a datagram to the driver without waiting for an answer */
+static void window_send(struct server_s *server, char *data, uint16_t size)
+{
+	server->packet_drv->packet_send(server->packet_drv->packet_arg, data, size);
+}
+
+/* wait for an ACK of this transaction, returns its length or 0 on timeout */
+static uint16_t window_recv(struct server_s *server, uint16_t token, uint8_t retries, struct options_s *options, int *status)
+{
+	struct urest_s *header = (struct urest_s *)server->packet_drv->packet;
+	uint16_t pkt_len;
+	int len = 0;
+	
+	ack_timeout(server, retries);
+	
+	do {
+		server->packet_drv->packet_recv(server->packet_drv->packet_arg, server->packet_drv->packet, &pkt_len);
+		
+		if (pkt_len == 0)
+			return 0;
+	/* ACKs of earlier transactions are still around after retransmissions */
+	} while (pkt_len < sizeof(struct urest_s) || (header->msg_type & ~EXT) != ACK || (token && header->tkn != token));
+	
+	*status = 0;
+	options->present = 0;
+	
+	if (header->frag_size != server->frag_size)
+		*status = FRAGMENT_SIZE_MISMATCH;
+	else if (header->msg_type & EXT)
+		len = urest_options_parse(server->packet_drv->packet + sizeof(struct urest_s), pkt_len - sizeof(struct urest_s), options);
+	
+	if (len < 0)
+		*status = BAD_OPTIONS;
+	
+	return pkt_len;
+}
+
+/*
+ * send a request with up to server->window fragments in flight. the first one
+ * goes alone, it asks for the window and gets the token. fragments are kept in
+ * server->ring until acknowledged, the ones neither acknowledged nor selectively
+ * acknowledged are sent again on a timeout, and the first one missing after
+ * two duplicate ACKs. the window for the response is returned in *window.
+ */
+static int send_window(struct server_s *server, uint8_t method, int (*source)(void *, char *, uint16_t), void *arg, int32_t length, uint16_t dict,
+	uint16_t *seq_val, uint16_t *token, uint8_t *window)
+{
+	struct urest_s *header = (struct urest_s *)server->packet_drv->packet;
+	struct urest_s *frag_header;
+	struct options_s options;
+	uint16_t payload_size, frag_len, base = 0, next = 0, ack, tkn = 0, i;
+	uint16_t len[UREST_WINDOW];
+	uint32_t sacked = 0, start = 0, sent = 0;
+	uint8_t w = 1;
+	int status, optlen, size, done = 0, retries = 0, dups = 0;
+	char *frag;
+	
+	payload_size = server_payload(server);
+	
+	if (!payload_size)
+		return UNKNOWN_FRAGMENT_SIZE;
+	
+	frag_len = sizeof(struct urest_s) + payload_size;
+	
+	while (1) {
+		while (!done && (uint16_t)(next - base) < w) {
+			frag = server->ring + (next & (server->window - 1)) * frag_len;
+			frag_header = (struct urest_s *)frag;
+			frag_header->frag_size = server->frag_size;
+			frag_header->msg_type = REQ;
+			frag_header->cnt_type = server->content;
+			frag_header->mtd_major = VERB;
+			frag_header->mtd_minor = method;
+			frag_header->tkn = tkn;
+			frag_header->seq = htons(next);
+			optlen = 0;
+			
+			if (next == 0) {
+				options.present = 1 << OPT_WINDOW;
+				options.window = server->window;
+	
+				if (length >= 0) {
+					options.present |= 1 << OPT_LENGTH;
+					options.length = length;
+				}
+	
+				if (dict) {
+					options.present |= 1 << OPT_COMPRESS;
+					options.dict = dict;
+				}
+	
+				if (server->frag_size == FRAG_SIZE_JUMBO) {
+					options.present |= 1 << OPT_JUMBO;
+					options.jumbo = server->jumbo;
+				}
+	
+				optlen = urest_options_write(frag + sizeof(struct urest_s), payload_size, &options);
+				frag_header->msg_type |= EXT;
+	
+				/* nothing is in flight yet */
+				if (optlen < 0 || optlen >= payload_size)
+					return BAD_OPTIONS;
+			}
+			
+			size = source(arg, frag + sizeof(struct urest_s) + optlen, payload_size - optlen);
+			len[next & (server->window - 1)] = sizeof(struct urest_s) + optlen + size;
+			sent += size;
+	
+			if (size < payload_size - optlen || (length >= 0 && sent >= (uint32_t)length))
+				done = 1;
+			
+			if (next == 0)
+				start = urest_clock();
+	
+			window_send(server, frag, sizeof(struct urest_s) + optlen + size);
+			next++;
+		}
+		
+		if (!window_recv(server, tkn, retries, &options, &status)) {
+			if (++retries > UREST_RETRIES)
+				return REQUEST_FAILED;
+	
+			server->lost++;
+	
+			for (i = base; i != next; i++) {
+				if (!((sacked >> (uint16_t)(i - base)) & 1))
+					window_send(server, server->ring + (i & (server->window - 1)) * frag_len, len[i & (server->window - 1)]);
+			}
+			
+			continue;
+		}
+		
+		if (status)
+			return status;
+		
+		if (header->mtd_major != INFO)
+			return header->mtd_major * 100 + header->mtd_minor;
+		
+		ack = ntohs(header->seq);
+		
+		/* the first ACK has the token and the window granted, none on a plain responder */
+		if (!tkn) {
+			if (ack != 0)
+				continue;
+			
+			tkn = header->tkn;
+	
+			if (!retries)
+				urest_rtt_sample(&server->rtt, urest_clock() - start);
+			
+			if (options.present & (1 << OPT_WINDOW))
+				w = options.window < server->window ? options.window : server->window;
+			
+			if (!w)
+				w = 1;
+			
+			for (i = base; i != next; i++)
+				((struct urest_s *)(server->ring + (i & (server->window - 1)) * frag_len))->tkn = tkn;
+		}
 		
-		if (pkt_len == 0)
-			return REQUEST_FAILED;
-
-		if (header->frag_size != request->frag_size)
-			return FRAGMENT_SIZE_MISMATCH;
-
-		if (ntohs(header->seq) != seq)
-			return SEQUENCE_MISMATCH;
-
-		if (seq > 0 && header->tkn != request->tkn)
-			return WRONG_TOKEN;
-
-		if (header->mtd_major == INFO) {
-/*			if (header->mtd_minor == CONTINUE)
-				printf("CONTINUE, token 0x%04x\n", ntohs(header->tkn));
-			else {
-				printf("PROCESSING, token 0x%04x\n", ntohs(header->tkn));
-				break;
+		/* outside the window, a late duplicate */
+		if ((int16_t)(ack - base) < -1 || (int16_t)(ack - next) >= 0)
+			continue;
+		
+		if ((uint16_t)(ack + 1) == base) {
+			if (++dups == 2 && base != next) {
+				server->lost++;
+				window_send(server, server->ring + (base & (server->window - 1)) * frag_len, len[base & (server->window - 1)]);
 			}
-*/
-			if (header->mtd_minor == PROCESSING)
-				break;
 		} else {
-			return header->mtd_major * 100 + header->mtd_minor;
+			base = ack + 1;
+			dups = 0;
+			retries = 0;
+		}
+		
+		sacked = (options.present & (1 << OPT_SACK)) ? options.sack << 1 : 0;
+		
+		/* the responder has the whole request, it may end before the last fragment sent */
+		if (header->mtd_minor == PROCESSING) {
+			if (options.present & (1 << OPT_WINDOW) && options.window)
+				w = options.window < server->window ? options.window : server->window;
+			
+			*window = (options.present & (1 << OPT_WINDOW)) ? w : 0;
+			*seq_val = base;
+			*token = tkn;
+			
+			return 0;
 		}
-
-		seq++;
-	} while (seq - 1 < data_len / payload_size);
-	
-	if (header->mtd_major == INFO) {
-		if (header->mtd_minor != PROCESSING)
-			return header->mtd_major * 100 + header->mtd_minor;
-	} else {
-		return header->mtd_major * 100 + header->mtd_minor;
 	}
-	
-	*seq_val = seq + 1;
-	*token = request->tkn;
-	
-	return 0;
 }
 
-static int recv_data(struct server_s *server, uint8_t method, char *response, uint16_t buflen, uint16_t *seq_val, uint16_t *token)
+/*
+ * poll for a response with up to window fragments in flight. the first response
+ * fragment not received yet goes along in OPT_ACK, fragments received ahead of
+ * it wait in server->ring. the transaction is closed with RST.
+ */
+static int recv_window(struct server_s *server, uint8_t method, int (*sink)(void *, char *, uint16_t), void *arg, uint16_t *seq_val, uint16_t *token, uint8_t window)
 {
 	struct urest_s *header = (struct urest_s *)server->packet_drv->packet;
-	uint16_t seq = *seq_val, seq_ack = 0;
-	uint16_t pkt_len, payload_size;
+	struct urest_s poll;
+	struct options_s options;
+	char buf[sizeof(struct urest_s) + 8];
+	uint16_t payload_size, frag_len, first = *seq_val, base = 0, next = 0, end = 0, idx, pkt_len, i;
+	uint16_t len[UREST_WINDOW];
+	uint32_t have = 0, wait = 0;
+	int status, result = 0, ended = 0, retries = 0, dups = 0, optlen;
+	char *frag;
 	
-	do {
-		header->frag_size = server->frag_size;
-		header->msg_type = REQ;
-		header->cnt_type = FLAT_ENC;
-		header->mtd_major = VERB;
-		header->mtd_minor = method;
-		header->seq = htons(seq);
-
-		/* send a REQ packet and wait for an ACK... */
-		server->packet_drv->packet_handler(server->packet_drv->packet_arg, server->packet_drv->packet, sizeof(struct urest_s), &pkt_len);
-		
-		switch (server->frag_size) {
-		case FRAG_SIZE_16: payload_size = 16 - sizeof(struct urest_s); break;
-		case FRAG_SIZE_32: payload_size = 32 - sizeof(struct urest_s); break;
-		case FRAG_SIZE_64: payload_size = 64 - sizeof(struct urest_s); break;
-		case FRAG_SIZE_128: payload_size = 128 - sizeof(struct urest_s); break;
-		case FRAG_SIZE_256: payload_size = 256 - sizeof(struct urest_s); break;
-		case FRAG_SIZE_512: payload_size = 512 - sizeof(struct urest_s); break;
-		case FRAG_SIZE_1024: payload_size = 1024 - sizeof(struct urest_s); break;
-		default:
-			return UNKNOWN_FRAGMENT_SIZE;
+	payload_size = server_payload(server);
+	frag_len = sizeof(struct urest_s) + payload_size;
+	
+	poll.frag_size = server->frag_size;
+	poll.msg_type = REQ | EXT;
+	poll.cnt_type = server->content;
+	poll.mtd_major = VERB;
+	poll.mtd_minor = method;
+	poll.tkn = *token;
+	
+	while (1) {
+		options.present = 1 << OPT_ACK;
+		options.ack = first + base;
+		optlen = urest_options_write(buf + sizeof(struct urest_s), sizeof(buf) - sizeof(struct urest_s), &options);
+		
+		while ((uint16_t)(next - base) < window && (!ended || (int16_t)(next - end) <= 0)) {
+			poll.seq = htons(first + next);
+			memcpy(buf, &poll, sizeof(struct urest_s));
+			window_send(server, buf, sizeof(struct urest_s) + optlen);
+			next++;
 		}
 		
-		/* copy data to processing buffer */
-		if ((seq_ack + 1) * payload_size < buflen) {
-			memcpy(response + seq_ack * payload_size, server->packet_drv->packet + sizeof(struct urest_s), payload_size);	
+		pkt_len = window_recv(server, *token, retries, &options, &status);
+		
+		if (!pkt_len) {
+			if (++retries > UREST_RETRIES)
+				return REQUEST_FAILED;
+	
+			server->lost++;
+	
+			for (i = base; i != next; i++) {
+				if (!((have >> (uint16_t)(i - base)) & 1)) {
+					poll.seq = htons(first + i);
+					memcpy(buf, &poll, sizeof(struct urest_s));
+					window_send(server, buf, sizeof(struct urest_s) + optlen);
+				}
+			}
+			
+			continue;
 		}
-
-		if (ntohs(header->seq) != seq)
-			return SEQUENCE_MISMATCH;
-
-/*		if (header->mtd_major == INFO) {
-			if (header->mtd_minor == CONTINUE)
-				printf("CONTINUE, token 0x%04x\n", ntohs(header->tkn));
+		
+		if (status)
+			return status;
+		
+		if (header->mtd_major != INFO && header->mtd_major != SUCCESS)
+			return header->mtd_major * 100 + header->mtd_minor;
+		
+		idx = ntohs(header->seq) - first;
+		
+		if ((int16_t)(idx - base) < 0 || (int16_t)(idx - next) >= 0 || ((have >> (uint16_t)(idx - base)) & 1))
+			continue;
+	
+		retries = 0;
+	
+		/* accepted, the handler still runs: the polls in flight are sent again later */
+		if (accepted(header, pkt_len)) {
+			if (idx != base)
+				continue;
+	
+			wait = poll_wait(server, wait);
+	
+			for (i = base; i != next; i++) {
+				poll.seq = htons(first + i);
+				memcpy(buf, &poll, sizeof(struct urest_s));
+				window_send(server, buf, sizeof(struct urest_s) + optlen);
+			}
+	
+			continue;
 		}
-*/		
-		seq++;
-		seq_ack++;
-	} while (pkt_len - sizeof(struct urest_s) == payload_size);
+		
+		if (header->mtd_major == SUCCESS) {
+			ended = 1;
+			end = idx;
+			result = header->mtd_major * 100 + header->mtd_minor;
+		}
+		
+		/* keep it until the ones before it are in */
+		if (idx != base) {
+			frag = server->ring + (idx & (server->window - 1)) * frag_len;
+			memcpy(frag, server->packet_drv->packet, pkt_len);
+			len[idx & (server->window - 1)] = pkt_len;
+			have |= 1 << (uint16_t)(idx - base);
 	
-	return header->mtd_major * 100 + header->mtd_minor;
+			/* the ones after it keep coming, ask for it again without waiting for a timeout */
+			if (++dups == 2) {
+				poll.seq = htons(first + base);
+				memcpy(buf, &poll, sizeof(struct urest_s));
+				window_send(server, buf, sizeof(struct urest_s) + optlen);
+			}
+	
+			continue;
+		}
+		
+		if (pkt_len > sizeof(struct urest_s) && sink(arg, server->packet_drv->packet + sizeof(struct urest_s), pkt_len - sizeof(struct urest_s)))
+			break;
+		
+		base++;
+		have >>= 1;
+		dups = 0;
+	
+		while (have & 1) {
+			frag = server->ring + (base & (server->window - 1)) * frag_len;
+			
+			if (len[base & (server->window - 1)] > sizeof(struct urest_s) && sink(arg, frag + sizeof(struct urest_s), len[base & (server->window - 1)] - sizeof(struct urest_s))) {
+				result = REQUEST_FAILED;
+				break;
+			}
+			
+			base++;
+			have >>= 1;
+		}
+		
+		if (result == REQUEST_FAILED || (ended && (int16_t)(base - end) > 0))
+			break;
+	}
+	
+	/* done, or the sink gave up */
+	poll.msg_type = RST;
+	poll.seq = htons(first + base);
+	window_send(server, (char *)&poll, sizeof(struct urest_s));
+	
+	return ended && (int16_t)(base - end) > 0 ? result : REQUEST_FAILED;
 }
 
-
-int urest_get(struct server_s *server, char *data, char *response, uint16_t buflen)
+static int transfer(struct server_s *server, uint8_t method, int (*source)(void *, char *, uint16_t), void *source_arg, int32_t length, uint16_t dict,
+	int (*sink)(void *, char *, uint16_t), void *sink_arg)
 {
 	int status;
 	uint16_t seq = 0, token = 0;
+	uint8_t window = 0;
+	
+	if (server->window && server->packet_drv->packet_send && server->packet_drv->packet_recv) {
+		status = send_window(server, method, source, source_arg, length, dict, &seq, &token, &window);
+	
+		if (status)
+			return status;
+		
+		/* a responder without windows answers polls one at a time */
+		if (window)
+			return recv_window(server, method, sink, sink_arg, &seq, &token, window);
+	
+		return recv_data(server, method, sink, sink_arg, length, &seq, &token);
+	}
+	
+	status = send_data(server, method, source, source_arg, length, dict, &seq, &token);
 	
-	status = send_data(server, GET, data, &seq, &token);
-
 	if (status)	
 		return status;
-		
-	status = recv_data(server, GET, response, buflen, &seq, &token);
 	
-	return status;
+	return recv_data(server, method, sink, sink_arg, length, &seq, &token);
 }
-
-int urest_post(struct server_s *server, char *data, char *response, uint16_t buflen)
+	
+/*
+ * adapt the fragment size after an exchange: halved when fragments were lost
+ * (large datagrams are the first to go on a path with a smaller MTU), doubled
+ * after UREST_ADAPT_CLEAN exchanges without loss. a responder that does not take
+ * jumbo fragments is not sent any again.
+ */
+static void adapt(struct server_s *server, int status)
+{
+	uint16_t size = frag_bytes(server);
+	
+	if (!server->frag_max)
+		return;
+	
+	if (server->frag_size == FRAG_SIZE_JUMBO && status == CLNT_ERROR * 100 + TOO_LARGE) {
+		server->frag_max = 1024;
+	
+		if (server->frag_min > 1024)
+			server->frag_min = 1024;
+	
+		size = 1024;
+	} else if (server->lost) {
+		if (size > server->frag_min)
+			size /= 2;
+	
+		server->clean = 0;
+	} else if (++server->clean >= UREST_ADAPT_CLEAN) {
+		if (size < server->frag_max)
+			size *= 2;
+	
+		server->clean = 0;
+	}
+	
+	frag_set(server, size);
+}
+	
+/* length is that of a binary request or negative, dict the id of the dictionary it is packed with or 0 */
+static int exchange(struct server_s *server, uint8_t method, int (*source)(void *, char *, uint16_t), void *source_arg, int32_t length, uint16_t dict,
+	int (*sink)(void *, char *, uint16_t), void *sink_arg)
 {
+	uint8_t jumbo;
 	int status;
-	uint16_t seq = 0, token = 0;
 	
-	status = send_data(server, POST, data, &seq, &token);
+	while (1) {
+		jumbo = server->frag_size == FRAG_SIZE_JUMBO;
+		server->lost = 0;
+		status = transfer(server, method, source, source_arg, length, dict, sink, sink_arg);
+		adapt(server, status);
+	
+		/* a request kept in memory goes again in fragments the responder takes, a stream can not */
+		if (!jumbo || status != CLNT_ERROR * 100 + TOO_LARGE || source != buffer_source)
+			return status;
+	
+		((struct buffer_s *)source_arg)->len = 0;
+	}
+}
 
-	if (status)	
-		return status;
-		
-	status = recv_data(server, POST, response, buflen, &seq, &token);
+/*
+ * move up to window fragments per round trip, the driver must provide packet_send()
+ * and packet_recv(). the window is rounded down to a power of two, 0 goes back to
+ * stop-and-wait. returns 0 or -1 if out of memory.
+ */
+int urest_window(struct server_s *server, uint8_t window)
+{
+	uint8_t w;
 	
-	return status;
+	for (w = 1; w * 2 <= window && w * 2 <= UREST_WINDOW; w *= 2);
+	
+	free(server->ring);
+	server->ring = 0;
+	server->window = 0;
+	
+	if (!window)
+		return 0;
+	
+	/* room for the largest fragments adapted to */
+	server->ring = malloc(w * (server->frag_max > frag_bytes(server) ? server->frag_max : frag_bytes(server)));
+	
+	if (!server->ring)
+		return -1;
+	
+	server->window = w;
+	
+	return 0;
 }
 
-int urest_put(struct server_s *server, char *data, char *response, uint16_t buflen)
+/* the content type requests are sent with (FLAT_ENC by default, UREST_ENC or JSON_ENC) */
+int urest_content(struct server_s *server, uint8_t content)
 {
-	int status;
-	uint16_t seq = 0, token = 0;
+	if (content > FLAT_ENC)
+		return -1;
+	
+	server->content = content;
+	
+	return 0;
+}
+	
+/*
+ * adapt the fragment size to the link between min and max bytes, powers of two
+ * from 16 to UREST_PACKET_SIZE. sizes above 1024 are jumbo fragments, for LAN
+ * links with a large MTU, the packet buffer of the driver must then hold max
+ * bytes. a responder that does not take them answers 4.13 and the request is sent
+ * again in smaller fragments. returns 0 or -1 if the sizes are not valid or out
+ * of memory.
+ */
+int urest_adapt(struct server_s *server, uint16_t min, uint16_t max)
+{
+	uint16_t size = frag_bytes(server);
+	
+	if (min < 16 || max > UREST_PACKET_SIZE || min > max || (min & (min - 1)) || (max & (max - 1)))
+		return -1;
 	
-	status = send_data(server, PUT, data, &seq, &token);
+	server->frag_min = min;
+	server->frag_max = max;
+	server->clean = 0;
+	frag_set(server, size < min ? min : size > max ? max : size);
+	
+	if (server->window)
+		return urest_window(server, server->window);
+	
+	return 0;
+}
+	
+/*
+ * pack requests of threshold bytes and more with dict (null turns it off), the
+ * responder must have the same dictionary. responses come back packed too.
+ */
+void urest_compress(struct server_s *server, const struct dict_s *dict, uint16_t threshold)
+{
+	server->dict = dict;
+	server->threshold = threshold;
+}
 
-	if (status)	
+/*
+ * a request packed with the dictionary of the server, sent with its length. the
+ * response comes back packed (or stored) too.
+ */
+static int exchange_packed(struct server_s *server, uint8_t method, char *data, char *response, uint16_t buflen)
+{
+	char packed[UREST_REQ_BUF_SIZE], coded[UREST_REQ_BUF_SIZE + 1];
+	struct buffer_s request, reply;
+	int len, status;
+	
+	len = urest_lz_pack(server->dict, data, strlen(data), packed, sizeof(packed), 0);
+	
+	if (len < 0)
+		return REQUEST_FAILED;
+	
+	request.data = packed;
+	request.size = len;
+	request.len = 0;
+	reply.data = coded;
+	reply.size = sizeof(coded);
+	reply.len = 0;
+	
+	status = exchange(server, method, buffer_source, &request, len, server->dict->id, buffer_sink, &reply);
+	response[0] = '\0';
+	
+	/* error codes come without a payload */
+	if (!reply.len)
 		return status;
-		
-	status = recv_data(server, PUT, response, buflen, &seq, &token);
+	
+	len = urest_lz_unpack(server->dict, coded, reply.len, packed, sizeof(packed));
+	
+	if (len < 0)
+		return REQUEST_FAILED;
+	
+	if (len >= buflen)
+		len = buflen - 1;
+	
+	memcpy(response, packed, len);
+	response[len] = '\0';
 	
 	return status;
 }
+	
+static int exchange_buffer(struct server_s *server, uint8_t method, char *data, char *response, uint16_t buflen)
+{
+	struct buffer_s request, reply;
+	int status;
+	
+	if (buflen == 0)
+		return REQUEST_FAILED;
+	
+	/*
+	 * a responder without the dictionary takes the request as it is, and packing
+	 * is off from then on. fragments too small for the options and some data
+	 * carry the request as it is too.
+	 */
+	if (server->dict && strlen(data) >= server->threshold && server_payload(server) > length_options(server, server->dict->id)) {
+		status = exchange_packed(server, method, data, response, buflen);
+	
+		if (status != CLNT_ERROR * 100 + UNSUPPORTED)
+			return status;
+	
+		server->dict = 0;
+	}
+	
+	/* the terminating null goes out too, it marks the end of the request */
+	request.data = data;
+	request.size = strlen(data) + 1;
+	request.len = 0;
+	reply.data = response;
+	reply.size = buflen;
+	reply.len = 0;
+	
+	return exchange(server, method, buffer_source, &request, -1, 0, buffer_sink, &reply);
+}
+
+
+int urest_get(struct server_s *server, char *data, char *response, uint16_t buflen)
+{
+	return exchange_buffer(server, GET, data, response, buflen);
+}
+
+int urest_post(struct server_s *server, char *data, char *response, uint16_t buflen)
+{
+	return exchange_buffer(server, POST, data, response, buflen);
+}
+
+int urest_put(struct server_s *server, char *data, char *response, uint16_t buflen)
+{
+	return exchange_buffer(server, PUT, data, response, buflen);
+}
 
 int urest_delete(struct server_s *server, char *data, char *response, uint16_t buflen)
 {
+	return exchange_buffer(server, DELETE, data, response, buflen);
+}
+	
+/*
+ * a request of len bytes of any value (a uri, '?' and raw data), sent with its
+ * length instead of a terminating null. the response is stored in response, of
+ * *size bytes (kept null terminated, a longer one is truncated), and *size is
+ * set to its length.
+ */
+int urest_binary(struct server_s *server, uint8_t method, char *data, uint16_t len, char *response, uint16_t *size)
+{
+	struct buffer_s request, reply;
 	int status;
-	uint16_t seq = 0, token = 0;
 	
-	status = send_data(server, DELETE, data, &seq, &token);
+	if (*size == 0)
+		return REQUEST_FAILED;
+	
+	request.data = data;
+	request.size = len;
+	request.len = 0;
+	reply.data = response;
+	reply.size = *size;
+	reply.len = 0;
+	
+	status = exchange(server, method, buffer_source, &request, len, 0, buffer_sink, &reply);
+	*size = reply.len;
+	
+	return status;
+}
 
-	if (status)	
-		return status;
+struct stream_source_s {
+	char *uri;
+	uint16_t uri_len;
+	uint16_t pos;
+	int (*source)(void *, char *, uint16_t);
+	void *arg;
+	uint8_t done;
+};
+
+/* the uri and a '?' first, then the body as produced by the application */
+static int stream_source(void *arg, char *data, uint16_t size)
+{
+	struct stream_source_s *stream = (struct stream_source_s *)arg;
+	uint16_t len = 0;
+	int n;
+	
+	while (stream->pos <= stream->uri_len && len < size) {
+		data[len++] = stream->pos < stream->uri_len ? stream->uri[stream->pos] : '?';
+		stream->pos++;
+	}
+	
+	if (len < size && !stream->done) {
+		n = stream->source ? stream->source(stream->arg, data + len, size - len) : 0;
+		
+		if (n < 0)
+			n = 0;
 		
-	status = recv_data(server, DELETE, response, buflen, &seq, &token);
+		if (n < size - len)
+			stream->done = 1;
+		
+		len += n;
+	}
 	
-	return status;
+	/* a short fragment ends the request */
+	if (stream->done && len < size)
+		data[len++] = '\0';
+	
+	return len;
+}
+
+static int discard_sink(void *arg, char *data, uint16_t len)
+{
+	return 0;
+}
+
+/*
+ * run a transaction of any length in constant memory. the request body is pulled
+ * from source(arg, data, size), which returns the number of bytes written (less
+ * than size once the body is complete), and sent after "uri?". the response is
+ * passed to sink(arg, data, len) as it arrives, a non zero return aborts. source
+ * and sink may be null. the body must not contain null bytes. returns the status.
+ */
+int urest_stream(struct server_s *server, uint8_t method, char *uri, int (*source)(void *, char *, uint16_t), int (*sink)(void *, char *, uint16_t), void *arg)
+{
+	struct stream_source_s stream;
+	
+	stream.uri = uri;
+	stream.uri_len = strlen(uri);
+	stream.pos = 0;
+	stream.source = source;
+	stream.arg = arg;
+	stream.done = 0;
+	
+	return exchange(server, method, stream_source, &stream, -1, 0, sink ? sink : discard_sink, arg);
+}
+
+/*
+ * time (in ms) an event loop may sleep before calling urest_expire(), or -1 to
+ * sleep until the next datagram when there are no active transactions and no
+ * observers. expiry scans only run once the oldest transaction may have timed
+ * out. changes to observed resources are pushed from here.
+ */
+int urest_timeout(struct responder_s *responder)
+{
+	uint32_t now;
+	int next, push = -1;
+	
+	if (!responder->active && !responder->subscribed) {
+		responder->deadline = 0;
+	
+		return -1;
+	}
+	
+	now = urest_clock();
+	
+	/* resources change on other threads too, they are checked for every UREST_NOTIFY_INTERVAL at most */
+	if (responder->subscribed) {
+		if ((int32_t)(responder->push_at - now) <= 0)
+			responder->push_at = now + observe_push(responder, now);
+	
+		if (responder->subscribed)
+			push = responder->push_at - now;
+	}
+	
+	if (!responder->active) {
+		responder->deadline = 0;
+	
+		return push;
+	}
+	
+	if (responder->deadline == 0)
+		responder->deadline = now + UREST_TRANSACTION_TIMEOUT;
+	
+	if ((int32_t)(responder->deadline - now) <= 0) {
+		next = urest_expire(responder);
+	
+		if (next < 0) {
+			responder->deadline = 0;
+	
+			return push;
+		}
+	
+		responder->deadline = now + next;
+	}
+	
+	next = responder->deadline - now;
+	
+	return push >= 0 && push < next ? push : next;
 }
@@ -1,9 +1,27 @@
+#include <pthread.h>
+#include <stddef.h>
+
 #define UREST_DEFAULT_PORT	4677
 #define UREST_REQ_BUF_SIZE	4096
 #define UREST_RETRIES		3
+#define UREST_TRANSACTIONS	16			/* default responder transaction table size */
+#define UREST_TRANSACTION_TIMEOUT	8000		/* idle transaction lifetime (in ms) */
+#define UREST_TIME_WAIT		4000			/* finished transactions answer retransmissions this long (in ms) */
+#define UREST_PEER_SIZE		28			/* room for a sockaddr_in6 or a link address */
+#define UREST_BATCH		32			/* datagrams moved per batched driver call */
+#define UREST_MAX_PARAMS	8			/* path parameters captured per request */
+#define UREST_WINDOW		32			/* largest window of fragments in flight */
+#define UREST_POLL_INTERVAL	1000			/* longest wait between polls answered with 2.02 (in ms) */
+#define UREST_SUBSCRIPTIONS	64			/* observers per responder */
+#define UREST_OBSERVE_URI	64			/* longest uri (and parameters) that may be observed */
+#define UREST_NOTIFY_INTERVAL	100			/* shortest time between pushes to an observer, updates in between are coalesced (in ms) */
+#define UREST_LEASE_MAX		3600			/* longest observation granted (in s) */
+#define UREST_ADAPT_CLEAN	8			/* exchanges without loss before adapted fragments grow */
+#define UREST_LIMIT_WAYS	4			/* peers per set of the rate limit table */
 
 enum fragment_size {
-	FRAG_SIZE_16 = 1,
+	FRAG_SIZE_JUMBO = 0,				/* larger than 1024, the size goes in OPT_JUMBO */
+	FRAG_SIZE_16,
 	FRAG_SIZE_32,
 	FRAG_SIZE_64,
 	FRAG_SIZE_128,
@@ -16,7 +34,19 @@ enum message_type {
 	UNS = 0,
 	REQ,
 	ACK,
-	RST
+	RST,
+	EXT = 4						/* flag, options follow the header */
+};
+	
+enum option_type {
+	OPT_END = 0,
+	OPT_WINDOW,					/* fragments in flight (1 byte) */
+	OPT_SACK,					/* fragments received past the acknowledged one (32 bit map) */
+	OPT_ACK,					/* initiator: first response fragment not received (seq) */
+	OPT_OBSERVE,					/* GET: lease of a subscription to changes (s), 0 to cancel */
+	OPT_LENGTH,					/* first fragment: payload length (32 bit), the payload is binary */
+	OPT_COMPRESS,					/* first fragment: id of the dictionary payloads are packed with */
+	OPT_JUMBO					/* first fragment: size of FRAG_SIZE_JUMBO fragments (bytes) */
 };
 
 enum content_type {
@@ -65,7 +95,9 @@ enum method_minor_clnt_error {
 	NOT_ACCEPTABLE = 6,
 	REQ_TIMEOUT = 8,
 	CONFLICT = 9,
+	TOO_LARGE = 13,
 	TOO_LONG = 14,
+	UNSUPPORTED = 15,
 	TEAPOT = 18,
 	UNPROCESSABLE = 22,
 	LOCKED = 23,
@@ -85,7 +117,8 @@ enum error_code {
 	FRAGMENT_SIZE_MISMATCH,
 	SEQUENCE_MISMATCH,
 	WRONG_TOKEN,
-	REQUEST_FAILED
+	REQUEST_FAILED,
+	BAD_OPTIONS
 };
 
 
@@ -102,11 +135,42 @@ struct urest_s {
 
 /* server side */
 
+struct options_s {
+	uint32_t present;				/* a bit per option type */
+	uint8_t window;
+	uint32_t sack;
+	uint16_t ack;
+	uint16_t lease;
+	uint32_t length;
+	uint16_t dict;
+	uint16_t jumbo;
+};
+	
+int urest_options_parse(char *data, uint16_t size, struct options_s *options);
+int urest_options_write(char *data, uint16_t size, struct options_s *options);
+	
+struct peer_s {
+	int32_t link;					/* local endpoint (socket, interface) */
+	uint8_t len;
+	uint8_t addr[UREST_PEER_SIZE];			/* opaque peer address, compared bytewise */
+};
+
+struct datagram_s {
+	struct peer_s peer;
+	char *data;
+	uint16_t size;
+	char *payload;					/* sent after data when payload_size is not 0 */
+	uint16_t payload_size;
+};
+
 struct serv_packet_s {
 	void *packet_arg;
 	char *packet;
 	void (*packet_handler_recv)(void *, char *, uint16_t *);
 	void (*packet_handler_send)(void *, char *, uint16_t);
+	void (*packet_handler_sendto)(void *, struct peer_s *, char *, uint16_t);
+	int (*packet_handler_recv_batch)(void *, struct datagram_s *, int);
+	int (*packet_handler_send_batch)(void *, struct datagram_s *, int);
 };
 
 struct resource_s {
@@ -116,40 +180,783 @@ struct resource_s {
 	void (*handler_post)(void *);
 	void (*handler_put)(void *);
 	void (*handler_delete)(void *);
+	struct stream_s *stream_get;
+	struct stream_s *stream_post;
+	struct stream_s *stream_put;
+	struct stream_s *stream_delete;
+	uint8_t slow;					/* a bit per method, handlers run off the I/O thread */
+	uint32_t version;				/* bumped by urest_notify() */
+	uint32_t count[4];				/* transactions ended by method, GET to DELETE (with stats) */
+	uint32_t failed;				/* of them without a 2.xx */
 };
 
 struct resource_list_s {
 	struct resource_list_s *next;
 	struct resource_s *resource;
+	struct router_s *router;
+};
+
+struct param_s {
+	char *name;
+	char *value;					/* points into the request, not terminated */
+	uint16_t len;
+};
+
+struct request_s {
+	struct resource_s *resource;
+	uint8_t method;
+	uint8_t content;				/* content type of the request, and of the response */
+	uint8_t params;
+	struct param_s param[UREST_MAX_PARAMS];
+	void *ctx;					/* free for use by stream handlers */
+	uint32_t offset;				/* body bytes streamed so far */
+	uint32_t length;				/* of the request, set by the handler of a binary one to that of its response */
+	uint8_t binary;					/* framed with OPT_LENGTH, null bytes are data */
+};
+	
+/*
+ * streaming handlers move a transaction of any length in constant memory. the
+ * request body (what follows '?' in the payload) is passed to recv() as it
+ * arrives, a chunk per fragment, and recv() returns 0 or a status to abort with.
+ * once it is complete the response is pulled a fragment at a time from send(),
+ * which fills at most size bytes and returns their count (less than size ends
+ * the response, a negative value aborts it with 5.00). end() is always called
+ * last with 200 or the status / error code the transaction ended with.
+ */
+struct stream_s {
+	int (*recv)(struct request_s *request, char *data, uint16_t len);
+	int (*send)(struct request_s *request, char *data, uint16_t size);
+	void (*end)(struct request_s *request, int status);
+};
+
+struct route_node_s {
+	char *segment;					/* literal segment, or parameter name */
+	uint16_t len;
+	uint32_t hash;
+	struct route_node_s *param;
+	struct route_table_s *children;
+	struct resource_s *resource;
+};
+
+struct route_table_s {
+	struct route_table_s *retired;
+	uint32_t size;
+	uint32_t count;
+	struct route_node_s *slot[];
+};
+
+struct router_s {
+	struct route_node_s root;
 };
 
 struct resource_list_s *urest_resource_list(void);
+void urest_resource_list_free(struct resource_list_s *resource_list);
 struct resource_s *urest_resource_endpoint(char *name, char *uri);
 int urest_resource_handler(struct resource_s *resource, void (*handler)(void *), uint8_t method);
+int urest_resource_stream(struct resource_s *resource, struct stream_s *stream, uint8_t method);
+int urest_resource_slow(struct resource_s *resource, uint8_t method);
+void urest_notify(struct resource_s *resource);
 int urest_register_resource(struct resource_list_s *resource_list, struct resource_s *resource);
 int urest_handle_request(struct serv_packet_s *serv_packet, struct resource_list_s *resource_list);
+struct request_s *urest_request(void);
+int urest_param(char *name, char *value, uint16_t size);
+
+/* flat encoding (type 3), fields are views into the body */
+struct flat_field_s {
+	char *data;					/* not terminated, escapes not decoded */
+	uint16_t len;
+	uint8_t escaped;				/* has escapes */
+};
+	
+struct flat_s {
+	char *p;
+	char *end;
+};
+	
+struct flat_writer_s {
+	char *buf;
+	uint16_t size;
+	uint16_t len;
+};
+	
+void urest_flat(struct flat_s *flat, char *data, uint16_t len);
+int urest_flat_next(struct flat_s *flat, struct flat_field_s *key, struct flat_field_s *value);
+int urest_flat_match(struct flat_field_s *field, char *s);
+int urest_flat_copy(struct flat_field_s *field, char *out, uint16_t size);
+int urest_flat_get(char *data, char *key, char *value, uint16_t size);
+void urest_flat_writer(struct flat_writer_s *writer, char *buf, uint16_t size);
+int urest_flat_put(struct flat_writer_s *writer, char *key, char *value);
+int urest_flat_put_int(struct flat_writer_s *writer, char *key, long value);
+	
+/* uREST encoding (type 1) of C structures, described by a table of fields */
+enum field_type {
+	FIELD_INT = 0,
+	FIELD_UINT,
+	FIELD_FLOAT,
+	FIELD_STRING,
+	FIELD_BLOB,
+	FIELD_STRUCT
+};
+	
+struct field_s {
+	uint8_t type;
+	uint8_t size;					/* of an integer or float */
+	uint16_t count;					/* array length, 1 for a single value */
+	uint32_t offset;				/* in the structure */
+	uint32_t length;				/* of a string (with its terminator), blob or structure */
+	const struct schema_s *schema;			/* of a nested structure */
+};
+	
+struct schema_s {
+	const struct field_s *field;
+	uint16_t fields;
+};
+	
+#define UREST_MEMBER(s, m)		(((s *)0)->m)
+#define UREST_COUNT(s, m)		(sizeof(UREST_MEMBER(s, m)) / sizeof(UREST_MEMBER(s, m)[0]))
+	
+#define UREST_INT(s, m)			{FIELD_INT, sizeof(UREST_MEMBER(s, m)), 1, offsetof(s, m), 0, 0}
+#define UREST_INTS(s, m)		{FIELD_INT, sizeof(UREST_MEMBER(s, m)[0]), UREST_COUNT(s, m), offsetof(s, m), 0, 0}
+#define UREST_UINT(s, m)		{FIELD_UINT, sizeof(UREST_MEMBER(s, m)), 1, offsetof(s, m), 0, 0}
+#define UREST_UINTS(s, m)		{FIELD_UINT, sizeof(UREST_MEMBER(s, m)[0]), UREST_COUNT(s, m), offsetof(s, m), 0, 0}
+#define UREST_FLOAT(s, m)		{FIELD_FLOAT, sizeof(UREST_MEMBER(s, m)), 1, offsetof(s, m), 0, 0}
+#define UREST_FLOATS(s, m)		{FIELD_FLOAT, sizeof(UREST_MEMBER(s, m)[0]), UREST_COUNT(s, m), offsetof(s, m), 0, 0}
+#define UREST_STRING(s, m)		{FIELD_STRING, 0, 1, offsetof(s, m), sizeof(UREST_MEMBER(s, m)), 0}
+#define UREST_STRINGS(s, m)		{FIELD_STRING, 0, UREST_COUNT(s, m), offsetof(s, m), sizeof(UREST_MEMBER(s, m)[0]), 0}
+#define UREST_BLOB(s, m)		{FIELD_BLOB, 0, 1, offsetof(s, m), sizeof(UREST_MEMBER(s, m)), 0}
+#define UREST_STRUCT(s, m, schema)	{FIELD_STRUCT, 0, 1, offsetof(s, m), sizeof(UREST_MEMBER(s, m)), &schema}
+#define UREST_STRUCTS(s, m, schema)	{FIELD_STRUCT, 0, UREST_COUNT(s, m), offsetof(s, m), sizeof(UREST_MEMBER(s, m)[0]), &schema}
+#define UREST_SCHEMA(fields)		{fields, sizeof(fields) / sizeof(fields[0])}
+	
+int urest_encode(const struct schema_s *schema, const void *in, char *out, uint16_t size);
+int urest_decode(const struct schema_s *schema, char *data, uint16_t len, void *out);
+	
+/* streaming JSON (type 0), events as the document is parsed */
+enum json_event {
+	JSON_OBJECT = 1,
+	JSON_OBJECT_END,
+	JSON_ARRAY,
+	JSON_ARRAY_END,
+	JSON_KEY,
+	JSON_STRING,
+	JSON_NUMBER,
+	JSON_TRUE,
+	JSON_FALSE,
+	JSON_NULL,
+	JSON_BLOB
+};
+	
+#define JSON_PART		0x80			/* more of the key, string, number or blob follows */
+	
+struct json_s {
+	int (*event)(void *arg, uint8_t event, char *data, uint16_t len);
+	void *arg;
+	uint32_t stack;					/* a bit per level, set for objects */
+	uint32_t bits;					/* of a \u escape or a base32 group */
+	uint32_t offset;				/* bytes parsed */
+	uint8_t depth;
+	uint8_t state;
+	uint8_t count;
+	uint8_t flags;
+};
+	
+void urest_json(struct json_s *json, int (*event)(void *, uint8_t, char *, uint16_t), void *arg);
+void urest_json_blob(struct json_s *json);
+int urest_json_parse(struct json_s *json, char *data, uint16_t len);
+int urest_json_end(struct json_s *json);
+	
+struct router_s *urest_router(void);
+void urest_router_free(struct router_s *router);
+int urest_route_add(struct router_s *router, char *uri, struct resource_s *resource);
+struct resource_s *urest_route(struct router_s *router, char *uri, struct request_s *request);
+
+/* slab pool */
+
+#define UREST_SLAB_SIZE		((sizeof(struct urest_s) + UREST_REQ_BUF_SIZE + 63) & ~63)
+
+struct pool_s {
+	char *arena;
+	char **free_slab;
+	uint32_t slabs;
+	uint32_t slab_size;
+	uint32_t free;
+	uint32_t peak;
+	uint32_t exhausted;
+};
+
+struct pool_stats_s {
+	uint32_t slabs;
+	uint32_t in_use;
+	uint32_t peak;					/* most slabs ever in use */
+	uint32_t exhausted;				/* requests for a slab that failed */
+};
+
+struct pool_s *urest_pool(uint32_t slabs, uint32_t slab_size);
+char *urest_pool_get(struct pool_s *pool);
+void urest_pool_put(struct pool_s *pool, char *slab);
+int urest_pool_owns(struct pool_s *pool, char *ptr);
+void urest_pool_free(struct pool_s *pool);
+void urest_pool_stats(struct pool_s *pool, struct pool_stats_s *stats);
+
+enum transaction_state {
+	TR_FREE = 0,
+	TR_RECV,					/* receiving the uri */
+	TR_BODY,					/* routed, receiving the body */
+	TR_SEND,
+	TR_WAIT						/* finished, the last ACK is kept for retransmissions */
+};
+	
+enum transaction_flags {
+	TR_LAST = 1,					/* last_frag is known */
+	TR_DONE = 2,					/* the last response fragment was sent */
+	TR_POLLED = 4,					/* response fragments were asked for */
+	TR_OFFLOAD = 8,					/* the handler was passed to the offload pool */
+	TR_OBSERVE = 16,				/* the first fragment had OPT_OBSERVE */
+	TR_LENGTH = 32,					/* the first fragment had OPT_LENGTH */
+	TR_COMPRESS = 64,				/* the first fragment had OPT_COMPRESS */
+	TR_STATS = 128					/* a GET of UREST_STATS_URI, answered by the responder */
+};
+
+/* finds the "uri" member of a JSON request as the document streams in */
+struct json_uri_s {
+	struct json_s json;
+	char *doc;
+	uint16_t uri;					/* offset of the uri in doc */
+	uint16_t len;					/* of the uri so far */
+	uint8_t match;					/* bytes of the key matched, or a JU_* state */
+};
+	
+struct transaction_s {
+	struct peer_s peer;
+	uint32_t last;
+	uint16_t tkn;
+	uint16_t seq;
+	uint16_t frag;
+	uint16_t payload_size;
+	uint16_t data_len;
+	uint8_t frag_size;
+	uint8_t state;
+	uint8_t retries;
+	struct urest_s header;
+	char *buf;					/* UREST_SLAB_SIZE bytes from the responder pool */
+	struct request_s request;
+	void (*handler)(void *);
+	struct stream_s *stream;
+	uint8_t window;					/* 0 for stop-and-wait */
+	uint8_t skew;					/* option bytes in the first request fragment */
+	uint8_t flags;
+	uint16_t last_frag;				/* the short fragment, once received or generated */
+	uint16_t last_len;
+	uint32_t sack;					/* fragments received past tr->seq */
+	uint16_t resp_seq;				/* seq of the first response fragment */
+	uint16_t ring;					/* streamed response fragments kept from here */
+	uint32_t hash;					/* of the first fragment, to spot it sent again */
+	uint16_t ack_seq;				/* the last ACK, replayed on retransmissions */
+	uint8_t ack_len;				/* header and inline bytes in ack, 0 if not kept */
+	char ack[sizeof(struct urest_s) + 16];
+	char *ack_data;					/* gathered from the slab */
+	uint16_t ack_size;
+	uint8_t running;				/* cleared by the offload thread when the handler returns */
+	uint16_t lease;					/* asked for with OPT_OBSERVE, then granted */
+	struct json_uri_s json;				/* of a JSON request, until routed */
+	uint32_t length;				/* of a binary request */
+	uint32_t stamp;					/* start of the phase in progress (us), with stats */
+	uint32_t handled;				/* time the offloaded handler ran (us) */
+};
+	
+/* an initiator told about changes of a resource with UNS messages */
+struct subscription_s {
+	struct peer_s peer;
+	struct resource_s *resource;
+	uint32_t version;				/* of the resource when last pushed */
+	uint32_t expires;
+	uint32_t sent;
+	uint16_t tkn;					/* of the GET that subscribed */
+	uint16_t seq;					/* of the last UNS */
+	uint8_t frag_size;
+	uint8_t content;
+	char uri[UREST_OBSERVE_URI];
+};
+	
+/* a token bucket of new transactions, per peer */
+struct limit_s {
+	struct peer_s peer;
+	uint32_t tokens;				/* in thousandths */
+	uint32_t stamp;					/* last refill, 0 if unused */
+};
+	
+/* new transactions refused before they take a slab */
+struct shed_s {
+	uint32_t busy;					/* 5.03, too many transactions in progress or no slot */
+	uint32_t rate;					/* 4.29, the peer is over its rate */
+};
+	
+/* metrics shared by responders, served flat encoded to a GET of UREST_STATS_URI */
+#define UREST_STATS_URI		"/.well-known/stats"
+#define UREST_ERRORS		6			/* error codes counted, UNKNOWN_FRAGMENT_SIZE to BAD_OPTIONS */
+#define UREST_HIST_BUCKETS	64			/* log-linear, two per power of two (us) */
+	
+enum stats_phase {
+	PHASE_REASSEMBLY = 0,				/* first request fragment to the last one */
+	PHASE_HANDLER,					/* on its thread when offloaded */
+	PHASE_RESPONSE,					/* handler done to the end of the transaction */
+	PHASES
+};
+	
+struct stats_s {
+	uint32_t transactions;				/* ended */
+	uint32_t failed;				/* ended without a 2.xx */
+	uint32_t retries;				/* fragments sent again, answered with the ACK kept */
+	uint32_t errors[UREST_ERRORS];			/* returned by urest_process_packet() */
+	struct shed_s shed;
+	uint32_t hist[PHASES][UREST_HIST_BUCKETS];
+};
+	
+struct stats_s *urest_stats(void);
+uint32_t urest_stats_clock(void);
+void urest_stats_time(struct stats_s *stats, uint8_t phase, uint32_t us);
+int urest_stats_write(struct stats_s *stats, struct resource_list_s *resource_list, char *buf, uint16_t size);
+	
+/* transaction events, recorded only when built with -DUREST_TRACE (make TRACE=1) */
+#define UREST_TRACE_EVENTS	16384			/* kept per thread, the oldest are overwritten (a power of two) */
+#define UREST_TRACE_MAGIC	"UTRC"
+	
+enum trace_type {
+	TRACE_FIRST = 1,				/* first request fragment, a new transaction */
+	TRACE_FRAGMENT,					/* any later fragment of it */
+	TRACE_ACK,					/* code is the status sent */
+	TRACE_RETRY,					/* the last ACK sent again */
+	TRACE_HANDLER,					/* handler start */
+	TRACE_HANDLER_END,
+	TRACE_RESET,					/* RST from the initiator */
+	TRACE_END					/* code is the status it ended with */
+};
+	
+struct trace_event_s {
+	uint32_t time;					/* us, urest_stats_clock() */
+	uint16_t tkn;
+	uint16_t seq;
+	int16_t code;					/* major * 100 + minor, or an error code */
+	uint8_t type;
+	uint8_t thread;					/* the ring it was recorded into */
+};
+	
+/* a dump is this header followed by the events of each ring, oldest first */
+struct trace_dump_s {
+	char magic[4];
+	uint16_t event_size;
+	uint16_t threads;
+	uint32_t events;
+};
+	
+#ifdef UREST_TRACE
+#define TRACE(type, tkn, seq, code)	urest_trace(type, tkn, seq, code)
+#else
+#define TRACE(type, tkn, seq, code)
+#endif
+	
+void urest_trace(uint8_t type, uint16_t tkn, uint16_t seq, int16_t code);
+int urest_trace_dump(int fd);
+	
+struct responder_s {
+	struct serv_packet_s *packet_drv;
+	struct resource_list_s *resource_list;
+	struct transaction_s *transaction;
+	uint16_t *free_slot;
+	uint16_t *opening;				/* last transaction opened, by first fragment hash (slot + 1) */
+	struct pool_s *pool;
+	struct offload_s *offload;			/* for handlers of slow resources, or null */
+	const struct dict_s *dict;			/* for packed payloads, or null */
+	uint16_t threshold;				/* shortest response packed */
+	struct datagram_s *out;
+	int out_count;
+	char *retired[UREST_BATCH];
+	int retired_count;
+	char *swap;
+	uint16_t transactions;
+	uint16_t active;
+	uint16_t reap;					/* where to look for a finished transaction to evict */
+	uint32_t deadline;
+	struct subscription_s *subscription;
+	uint16_t subscribed;
+	uint32_t push_at;				/* next check for changes to push */
+	uint8_t slot_bits;
+	uint8_t shard;
+	uint8_t shard_bits;
+	void (*handoff)(void *, uint8_t, char *, uint16_t, struct peer_s *);
+	void *handoff_arg;
+	struct limit_s *limit;				/* UREST_LIMIT_WAYS buckets per set, or null */
+	uint16_t limit_mask;				/* sets - 1 */
+	uint16_t rate;					/* new transactions per second and peer */
+	uint16_t burst;
+	uint16_t admit;					/* transactions in progress at most, 0 for no cap */
+	uint16_t waiting;				/* finished transactions in UREST_TIME_WAIT */
+	struct shed_s shed;				/* updated atomically, read by other threads */
+	struct stats_s *stats;				/* or null */
+};
+
+struct responder_s *urest_responder(struct serv_packet_s *serv_packet, struct resource_list_s *resource_list, uint16_t transactions);
+void urest_responder_free(struct responder_s *responder);
+int urest_process_packet(struct responder_s *responder, char *packet, uint16_t size, struct peer_s *peer);
+int urest_process_batch(struct responder_s *responder, struct datagram_s *dgram, int count);
+int urest_expire(struct responder_s *responder);
+int urest_timeout(struct responder_s *responder);
+int urest_responder_shard(struct responder_s *responder, uint8_t shard, uint8_t shard_bits, void (*handoff)(void *, uint8_t, char *, uint16_t, struct peer_s *), void *arg);
+void urest_responder_offload(struct responder_s *responder, struct offload_s *offload);
+void urest_responder_compress(struct responder_s *responder, const struct dict_s *dict, uint16_t threshold);
+int urest_responder_limit(struct responder_s *responder, uint16_t peers, uint16_t rate, uint16_t burst, uint16_t admit);
+void urest_responder_stats(struct responder_s *responder, struct stats_s *stats);
+uint32_t urest_clock(void);
+
+
+/* event loop (epoll) */
+
+#define UREST_EVENTS		64			/* events handled per wakeup */
+#define UREST_PACKET_SIZE	4096			/* largest fragment, jumbo ones included */
+
+struct event_fd_s {
+	struct event_fd_s *next;
+	int fd;
+	void (*handler)(void *, int, uint32_t);
+	void *arg;
+};
+
+struct event_loop_s {
+	int epfd;
+	int running;
+	struct event_fd_s *fds;
+	struct responder_s *responder;
+	struct serv_packet_s packet_drv;
+	struct datagram_s dgram[UREST_BATCH];		/* receive buffers are slabs of the responder pool */
+};
+
+struct event_loop_s *urest_event_loop(struct resource_list_s *resource_list, uint16_t transactions);
+int urest_event_listen(struct event_loop_s *loop, char *ip, uint16_t port);
+int urest_event_attach(struct event_loop_s *loop, int s);
+int urest_event_add(struct event_loop_s *loop, int fd, uint32_t events, void (*handler)(void *, int, uint32_t), void *arg);
+int urest_event_del(struct event_loop_s *loop, int fd);
+int urest_event_run(struct event_loop_s *loop);
+void urest_event_stop(struct event_loop_s *loop);
+void urest_event_free(struct event_loop_s *loop);
+
+
+/* sharded responder (one event loop per worker thread) */
+
+#define UREST_HANDOFF_QUEUE	256			/* misrouted fragments queued per worker, power of 2 */
+
+struct handoff_s {
+	uint32_t seq;
+	uint16_t size;
+	struct peer_s peer;
+	char packet[UREST_PACKET_SIZE];
+};
+
+struct worker_s {
+	struct workers_s *workers;
+	struct event_loop_s *loop;
+	pthread_t thread;
+	int s;
+	int wake;
+	uint32_t head;
+	uint32_t tail;
+	struct handoff_s *queue;
+	uint8_t id;
+};
+
+struct workers_s {
+	struct worker_s *worker;
+	uint8_t count;
+	uint8_t shard_bits;
+};
+
+struct workers_s *urest_workers(struct resource_list_s *resource_list, uint16_t transactions, uint8_t count);
+int urest_workers_listen(struct workers_s *workers, char *ip, uint16_t port);
+int urest_workers_run(struct workers_s *workers);
+void urest_workers_stop(struct workers_s *workers);
+void urest_workers_offload(struct workers_s *workers, struct offload_s *offload);
+void urest_workers_compress(struct workers_s *workers, const struct dict_s *dict, uint16_t threshold);
+int urest_workers_limit(struct workers_s *workers, uint16_t peers, uint16_t rate, uint16_t burst, uint16_t admit);
+void urest_workers_shed(struct workers_s *workers, struct shed_s *shed);
+void urest_workers_stats(struct workers_s *workers, struct stats_s *stats);
+	
+
+/* handler offload (worker thread pool) */
+	
+#define UREST_OFFLOAD_QUEUE	64			/* default jobs waiting for a thread */
+	
+struct offload_job_s {
+	void (*run)(void *);
+	void *arg;
+};
+	
+struct offload_s {
+	pthread_t *thread;
+	int threads;
+	struct offload_job_s *job;			/* ring of queued jobs */
+	uint16_t size;
+	uint16_t head;
+	uint16_t count;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+};
+	
+struct offload_s *urest_offload(uint8_t threads, uint16_t queue);
+int urest_offload_submit(struct offload_s *offload, void (*run)(void *), void *arg);
+void urest_offload_stop(struct offload_s *offload);
+
+
+/* batched UDP I/O (recvmmsg / sendmmsg) */
+
+int urest_udp_recv_batch(int s, struct datagram_s *dgram, int count);
+int urest_udp_send_batch(struct datagram_s *dgram, int count);
+
 
+/* retransmission timing (RTT estimation, timer wheel) */
+	
+#define UREST_RTO_INITIAL	2000			/* ACK timeout before an RTT sample (in ms) */
+#define UREST_RTO_MIN		20
+#define UREST_RTO_MAX		16000
+#define UREST_WHEEL_SLOTS	256			/* one per ms, power of 2 */
+	
+struct rtt_s {
+	uint32_t srtt;					/* smoothed RTT (in 1/8 ms), 0 before a sample */
+	uint32_t rttvar;				/* RTT variation (in 1/4 ms) */
+	uint32_t rto;					/* in ms */
+};
+	
+struct timer_s {
+	struct timer_s *next;				/* null if not pending */
+	struct timer_s *prev;
+	uint32_t expires;
+};
+	
+struct wheel_s {
+	struct timer_s slot[UREST_WHEEL_SLOTS];		/* list heads */
+	uint32_t now;					/* the slot of now is not handled yet */
+	uint32_t pending;
+};
+	
+void urest_rtt_init(struct rtt_s *rtt);
+void urest_rtt_sample(struct rtt_s *rtt, uint32_t sample);
+uint32_t urest_rtt_timeout(struct rtt_s *rtt, uint8_t retries);
+void urest_wheel_init(struct wheel_s *wheel, uint32_t now);
+void urest_timer_set(struct wheel_s *wheel, struct timer_s *timer, uint32_t expires);
+void urest_timer_cancel(struct wheel_s *wheel, struct timer_s *timer);
+int urest_wheel_advance(struct wheel_s *wheel, uint32_t now, void (*handler)(void *, struct timer_s *), void *arg);
+int urest_wheel_next(struct wheel_s *wheel, uint32_t now);
+	
 
 /* client side */
 
 struct clnt_packet_s {
 	void *packet_arg;
-	char *packet;
+	char *packet;					/* at least UREST_PACKET_SIZE bytes, jumbo fragments included */
 	void (*packet_handler)(void *, char *, uint16_t, uint16_t *);
+	void (*packet_send)(void *, char *, uint16_t);		/* windowed transfers only */
+	void (*packet_recv)(void *, char *, uint16_t *);	/* windowed transfers only, size 0 on timeout */
+	void (*packet_timeout)(void *, uint32_t);		/* set the ACK wait (in ms), optional */
 };
-
+	
 struct server_s {
 	struct clnt_packet_s *packet_drv;
 	char *ip;
 	uint16_t port;
 	uint8_t frag_size;
+	uint8_t window;
+	uint8_t content;				/* content type of requests */
+	char *ring;					/* fragments kept for retransmission */
+	const struct dict_s *dict;			/* requests are packed with, or null */
+	uint16_t threshold;				/* shortest request packed */
+	uint16_t jumbo;					/* size of FRAG_SIZE_JUMBO fragments (bytes) */
+	uint16_t frag_min;				/* fragment sizes adapted between (bytes), frag_max 0 if fixed */
+	uint16_t frag_max;
+	uint8_t lost;					/* fragments sent again during the exchange */
+	uint8_t clean;					/* exchanges in a row without loss */
+	struct rtt_s rtt;
+	uint32_t timeout;				/* ACK wait last set in the driver */
 };
 
 struct server_s *urest_link(struct clnt_packet_s *clnt_packet, char *ip, uint16_t port, uint8_t frag_size);
+void urest_unlink(struct server_s *server);
 int urest_get(struct server_s *server, char *data, char *response, uint16_t buflen);
 int urest_post(struct server_s *server, char *data, char *response, uint16_t buflen);
 int urest_put(struct server_s *server, char *data, char *response, uint16_t buflen);
 int urest_delete(struct server_s *server, char *data, char *response, uint16_t buflen);
+int urest_window(struct server_s *server, uint8_t window);
+int urest_content(struct server_s *server, uint8_t content);
+int urest_binary(struct server_s *server, uint8_t method, char *data, uint16_t len, char *response, uint16_t *size);
+void urest_compress(struct server_s *server, const struct dict_s *dict, uint16_t threshold);
+int urest_adapt(struct server_s *server, uint16_t min, uint16_t max);
+int urest_stream(struct server_s *server, uint8_t method, char *uri, int (*source)(void *, char *, uint16_t), int (*sink)(void *, char *, uint16_t), void *arg);
+
+/* base32 (RFC 4648, no padding) */
+#define BASE32_ENCODED(len)	((uint32_t)(((uint64_t)(len) * 8 + 4) / 5) + 1)	/* room for encoding len bytes */
+#define BASE32_DECODED(len)	((uint32_t)((uint64_t)(len) * 5 / 8) + 1)	/* room for decoding len characters */
+	
+enum base32_kernel {
+	BASE32_SCALAR = 0,
+	BASE32_SSSE3,
+	BASE32_AVX2
+};
+	
+int base32_isa(int want);
+int base32_encode(char *in, uint32_t len, char *out, uint32_t size);
+int base32_decode(char *in, uint32_t len, char *out, uint32_t size);
+	
+/* LZ packed payloads, with a preset dictionary shared by both ends */
+enum lz_coding {
+	LZ_STORED = 0,
+	LZ_PACKED
+};
+	
+struct dict_s {
+	const char *data;
+	uint16_t len;
+	uint16_t id;					/* sent in OPT_COMPRESS */
+};
+	
+void urest_dict(struct dict_s *dict, const char *data, uint16_t len);
+int urest_lz_pack(const struct dict_s *dict, char *in, uint16_t len, char *out, uint16_t size, uint16_t threshold);
+int urest_lz_unpack(const struct dict_s *dict, char *in, uint16_t len, char *out, uint16_t size);
+	
+
+/* asynchronous initiator (many transactions in flight on one socket) */
+	
+enum call_state {
+	CALL_FREE,
+	CALL_WAIT,					/* another call to the peer is getting its token */
+	CALL_SEND,
+	CALL_RECV,
+	CALL_POLL					/* answered with 2.02, asks again when the timer expires */
+};
+	
+#define UREST_OPTIONS_ROOM	8			/* options sent by an initiator with a first fragment */
+	
+struct call_s {
+	struct timer_s timer;				/* the ACK wait */
+	struct peer_s peer;
+	struct urest_s header;				/* of the fragment in flight */
+	char options[UREST_OPTIONS_ROOM];		/* sent right after the header with the first fragment */
+	uint8_t skew;					/* option bytes taken from the first fragment */
+	char *data;					/* request, kept by the application */
+	char *response;
+	uint16_t data_len;
+	uint16_t buflen;
+	uint16_t resp_len;
+	uint16_t payload_size;
+	uint16_t seq;
+	uint16_t tkn;					/* network byte order, 0 until the first ACK */
+	uint16_t next;					/* hash chain (slot + 1) */
+	uint16_t wait;					/* next call waiting for the peer (slot + 1) */
+	uint32_t sent;
+	uint16_t poll;					/* wait before asking again after 2.02 (in ms) */
+	uint8_t state;
+	uint8_t retries;
+	uint16_t observe;				/* observation renewed (slot + 1), or 0 */
+	uint16_t lease;					/* granted in the 1.02 */
+	void (*done)(void *, int);
+	void *arg;
+};
+	
+/* a resource observed by an initiator, renewed with a GET every half lease */
+struct observe_s {
+	struct timer_s timer;				/* the next renewal */
+	struct peer_s peer;
+	char *uri;					/* kept by the application */
+	char *value;					/* the last value, kept by the application */
+	uint16_t buflen;
+	uint16_t lease;					/* asked for (in s) */
+	uint16_t tkn;					/* network byte order, of the subscription */
+	uint16_t seq;					/* of the last UNS taken */
+	uint16_t call;					/* renewal in flight (slot + 1), or 0 */
+	uint8_t frag_size;
+	void (*notify)(void *, int, char *, uint16_t);
+	void *arg;
+};
+	
+struct peer_rtt_s {
+	struct peer_s peer;
+	struct rtt_s rtt;
+};
+	
+struct initiator_s {
+	int s;
+	struct call_s *call;
+	uint16_t *free_slot;
+	uint16_t *bucket;				/* (peer, token) hash, slot + 1 */
+	struct peer_rtt_s *rtt;				/* RTT estimates, by peer hash */
+	uint16_t calls;
+	uint16_t active;
+	uint16_t mask;
+	uint16_t completed;
+	int out_count;
+	struct datagram_s in[UREST_BATCH];
+	struct datagram_s out[UREST_BATCH];
+	struct wheel_s wheel;
+	struct observe_s *observe;			/* as many as calls */
+};
+	
+struct initiator_s *urest_initiator(int s, uint16_t calls);
+int urest_peer(struct peer_s *peer, int s, char *ip, uint16_t port);
+int urest_submit(struct initiator_s *initiator, struct peer_s *peer, uint8_t frag_size, uint8_t method, char *data, char *response, uint16_t buflen, void (*done)(void *, int), void *arg);
+int urest_cancel(struct initiator_s *initiator, int call);
+int urest_initiator_poll(struct initiator_s *initiator, int timeout);
+int urest_initiator_timeout(struct initiator_s *initiator);
+int urest_observe(struct initiator_s *initiator, struct peer_s *peer, uint8_t frag_size, char *uri, uint16_t lease, char *value, uint16_t buflen, void (*notify)(void *, int, char *, uint16_t), void *arg);
+int urest_unobserve(struct initiator_s *initiator, int observe);
+
+
+/* io_uring transport (multishot recvmsg, provided buffers, batched sends) */
+
+#define UREST_URING_ENTRIES	256			/* submission queue entries */
+#define UREST_URING_BUFFERS	256			/* pre-posted receive buffers, power of 2 */
+#define UREST_URING_SOCKETS	8			/* sockets served by one loop */
+
+struct uring_loop_s;
 
-int base32_encode(char *in, uint16_t len, char *out);
-int base32_decode(char *in, uint16_t len, char *out);
+struct uring_loop_s *urest_uring_loop(struct resource_list_s *resource_list, uint16_t transactions);
+int urest_uring_listen(struct uring_loop_s *loop, char *ip, uint16_t port);
+int urest_uring_run(struct uring_loop_s *loop);
+void urest_uring_stop(struct uring_loop_s *loop);
+int urest_uring_client(struct clnt_packet_s *clnt_packet, uint16_t size, int s, void *addr, uint8_t addrlen, uint32_t timeout);
+
+
+/* in-memory transport: an initiator and a responder in one process, joined by a SPSC ring each way */
+
+#define UREST_LOOPBACK_SLOTS	64			/* datagrams queued each way, power of 2 */
+
+struct loopback_slot_s {
+	uint32_t due;					/* delivered from then on (us), with a delay */
+	uint16_t size;
+	char data[UREST_PACKET_SIZE];
+};
+	
+struct loopback_ring_s {
+	struct loopback_slot_s *slot;
+	uint32_t head;					/* pushed, by the sending side */
+	uint32_t tail;					/* popped, by the receiving side */
+	uint32_t seed[2];				/* loss on the sending side, reordering on the receiving one */
+	uint32_t sent;					/* datagrams pushed, lost ones included */
+	uint32_t lost;					/* dropped, by the fault or a full ring */
+};
+	
+struct loopback_s {
+	struct loopback_ring_s ring[2];			/* to the responder, to the initiator */
+	struct peer_s peer;				/* the initiator, as the responder sees it */
+	struct responder_s *responder;			/* run by the initiator while it waits, or null */
+	char packet[UREST_PACKET_SIZE];			/* the responder builds ACKs in place */
+	uint16_t loss;					/* per mille */
+	uint16_t reorder;				/* per mille, a datagram swapped with the next one */
+	uint32_t delay;					/* us */
+	uint32_t timeout;				/* ACK wait of the initiator (ms) */
+	uint32_t expired;				/* last urest_expire() of the responder (ms) */
+};
+	
+struct loopback_s *urest_loopback(void);
+void urest_loopback_free(struct loopback_s *lb);
+void urest_loopback_faults(struct loopback_s *lb, uint16_t loss, uint16_t reorder, uint32_t delay);
+int urest_loopback_client(struct clnt_packet_s *clnt_packet, struct loopback_s *lb, uint32_t timeout);
+void urest_loopback_server(struct serv_packet_s *serv_packet, struct loopback_s *lb);
+void urest_loopback_inline(struct loopback_s *lb, struct responder_s *responder);
+int urest_loopback_poll(struct loopback_s *lb, struct responder_s *responder);
@@ -0,0 +1,609 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "urest.h"
+
+#define URING_RECV		1
+#define URING_SEND		2
+#define URING_TAG(op, idx)	(((uint64_t)(op) << 32) | (idx))
+
+/* receive buffer layout: recvmsg_out header, peer address, fragment */
+#define URING_BUF_SIZE		(sizeof(struct io_uring_recvmsg_out) + UREST_PEER_SIZE + UREST_PACKET_SIZE)
+#define URING_PAYLOAD(buf)	((buf) + sizeof(struct io_uring_recvmsg_out) + UREST_PEER_SIZE)
+
+struct uring_s {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned sq_local, sq_submitted, sq_entries;
+	void *sq_ring, *cq_ring;
+	size_t sq_ring_size, cq_ring_size;
+};
+
+struct uring_send_s {
+	struct msghdr msg;
+	struct iovec iov;
+	struct peer_s peer;
+};
+
+struct uring_loop_s {
+	struct uring_s ring;
+	int running;
+	int s[UREST_URING_SOCKETS];
+	int sockets;
+	struct msghdr recv_msg;
+	struct io_uring_buf_ring *br;
+	uint16_t br_tail;
+	char *bufs;
+	uint8_t *pending;
+	struct uring_send_s *send;
+	struct responder_s *responder;
+	struct serv_packet_s packet_drv;
+};
+
+struct uring_clnt_s {
+	struct uring_s ring;
+	int s;
+	struct sockaddr_in6 addr;
+	uint8_t addrlen;
+	uint16_t size;					/* of the packet buffer */
+	struct msghdr msg;
+	struct iovec iov;
+	struct __kernel_timespec ts;
+};
+
+
+/* unmap what uring_init() mapped and close the ring */
+static void uring_exit(struct uring_s *ring)
+{
+	if (ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+	
+	if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	
+	if (ring->sq_ring != MAP_FAILED)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	
+	close(ring->fd);
+}
+
+static int uring_init(struct uring_s *ring, unsigned entries)
+{
+	struct io_uring_params p;
+	
+	memset(&p, 0, sizeof(p));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+	
+	if (ring->fd < 0)
+		return -1;
+	
+	ring->sq_ring = MAP_FAILED;
+	ring->cq_ring = MAP_FAILED;
+	ring->sqes = MAP_FAILED;
+	ring->sq_entries = p.sq_entries;
+	ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+	
+	ring->sq_ring = mmap(0, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	
+	if (ring->sq_ring == MAP_FAILED)
+		goto fail;
+	
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(0, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	
+		if (ring->cq_ring == MAP_FAILED)
+			goto fail;
+	}
+	
+	ring->sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	
+	if (ring->sqes == MAP_FAILED)
+		goto fail;
+	
+	ring->sq_head = (unsigned *)((char *)ring->sq_ring + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ring + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ring + p.sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ring + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + p.cq_off.cqes);
+	ring->sq_local = *ring->sq_tail;
+	ring->sq_submitted = ring->sq_local;
+	
+	return 0;
+	
+fail:
+	uring_exit(ring);
+	
+	return -1;
+}
+
+/* submit queued entries and wait for at least min_complete completions */
+static int uring_enter(struct uring_s *ring, unsigned min_complete, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned submit;
+	int ret;
+	
+	__atomic_store_n(ring->sq_tail, ring->sq_local, __ATOMIC_RELEASE);
+	submit = ring->sq_local - ring->sq_submitted;
+	
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask_sz = _NSIG / 8;
+	
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+	
+	ret = syscall(__NR_io_uring_enter, ring->fd, submit, min_complete,
+		(min_complete ? IORING_ENTER_GETEVENTS : 0) | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	
+	if (ret > 0)
+		ring->sq_submitted += ret;
+	else if (ret < 0 && errno != ETIME && errno != EINTR)
+		return -1;
+	
+	return 0;
+}
+
+static struct io_uring_sqe *uring_sqe(struct uring_s *ring)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+	
+	/* ring full, push what is queued to the kernel first */
+	if (ring->sq_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+		uring_enter(ring, 0, 0);
+	
+	if (ring->sq_local - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+		return 0;
+	
+	idx = ring->sq_local & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	ring->sq_array[idx] = idx;
+	ring->sq_local++;
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	
+	return sqe;
+}
+
+
+/* server side */
+
+static void loop_recycle(struct uring_loop_s *loop, uint16_t bid)
+{
+	struct io_uring_buf *buf;
+	
+	buf = &loop->br->bufs[loop->br_tail & (UREST_URING_BUFFERS - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(loop->bufs + bid * URING_BUF_SIZE);
+	buf->len = URING_BUF_SIZE;
+	buf->bid = bid;
+	loop->br_tail++;
+}
+
+static int loop_arm(struct uring_loop_s *loop, int idx)
+{
+	struct io_uring_sqe *sqe;
+	
+	sqe = uring_sqe(&loop->ring);
+	
+	if (!sqe)
+		return -1;
+	
+	/* one multishot recvmsg keeps posting fragments until the buffers run out */
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = loop->s[idx];
+	sqe->addr = (uint64_t)(uintptr_t)&loop->recv_msg;
+	sqe->len = 1;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->user_data = URING_TAG(URING_RECV, idx);
+	
+	return 0;
+}
+
+/* responder ACKs are queued as sendmsg entries, submitted with the next wait */
+static int loop_send_batch(void *arg, struct datagram_s *dgram, int count)
+{
+	struct uring_loop_s *loop = (struct uring_loop_s *)arg;
+	struct io_uring_sqe *sqe;
+	struct uring_send_s *send;
+	uint32_t bid;
+	int i;
+	
+	for (i = 0; i < count; i++) {
+		bid = (dgram[i].data - loop->bufs) / URING_BUF_SIZE;
+	
+		/* sends complete later, the payload slab may be reused by then */
+		if (dgram[i].payload_size) {
+			memcpy(dgram[i].data + dgram[i].size, dgram[i].payload, dgram[i].payload_size);
+			dgram[i].size += dgram[i].payload_size;
+			dgram[i].payload_size = 0;
+		}
+	
+		if (dgram[i].data < loop->bufs || bid >= UREST_URING_BUFFERS || !(sqe = uring_sqe(&loop->ring))) {
+			sendto(dgram[i].peer.link, dgram[i].data, dgram[i].size, 0, (struct sockaddr *)dgram[i].peer.addr, dgram[i].peer.len);
+	
+			continue;
+		}
+	
+		send = &loop->send[bid];
+		send->peer = dgram[i].peer;
+		send->iov.iov_base = dgram[i].data;
+		send->iov.iov_len = dgram[i].size;
+		send->msg.msg_name = send->peer.addr;
+		send->msg.msg_namelen = send->peer.len;
+		send->msg.msg_iov = &send->iov;
+		send->msg.msg_iovlen = 1;
+	
+		sqe->opcode = IORING_OP_SENDMSG;
+		sqe->fd = dgram[i].peer.link;
+		sqe->addr = (uint64_t)(uintptr_t)&send->msg;
+		sqe->len = 1;
+		sqe->user_data = URING_TAG(URING_SEND, bid);
+	
+		/* the ACK lives in the receive buffer until the send completes */
+		loop->pending[bid] = 1;
+	}
+	
+	return count;
+}
+
+static void loop_sendto(void *arg, struct peer_s *peer, char *data, uint16_t size)
+{
+	sendto(peer->link, data, size, 0, (struct sockaddr *)peer->addr, peer->len);
+}
+
+struct uring_loop_s *urest_uring_loop(struct resource_list_s *resource_list, uint16_t transactions)
+{
+	struct uring_loop_s *loop;
+	struct io_uring_buf_reg reg;
+	size_t size;
+	int i;
+	
+	loop = calloc(1, sizeof(struct uring_loop_s));
+	
+	if (!loop)
+		return 0;
+	
+	if (uring_init(&loop->ring, UREST_URING_ENTRIES) < 0) {
+		free(loop);
+	
+		return 0;
+	}
+	
+	/* pre-posted receive buffers, registered with the kernel as buffer group 0 */
+	size = (UREST_URING_BUFFERS * sizeof(struct io_uring_buf) + 4095) & ~4095;
+	loop->br = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	loop->bufs = malloc(UREST_URING_BUFFERS * URING_BUF_SIZE);
+	loop->pending = calloc(UREST_URING_BUFFERS, 1);
+	loop->send = calloc(UREST_URING_BUFFERS, sizeof(struct uring_send_s));
+	
+	if (loop->br == MAP_FAILED || !loop->bufs || !loop->pending || !loop->send)
+		goto fail;
+	
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)loop->br;
+	reg.ring_entries = UREST_URING_BUFFERS;
+	reg.bgid = 0;
+	
+	if (syscall(__NR_io_uring_register, loop->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		goto fail;
+	
+	loop->br_tail = 0;
+	
+	for (i = 0; i < UREST_URING_BUFFERS; i++)
+		loop_recycle(loop, i);
+	
+	__atomic_store_n(&loop->br->tail, loop->br_tail, __ATOMIC_RELEASE);
+	
+	loop->recv_msg.msg_namelen = UREST_PEER_SIZE;
+	loop->recv_msg.msg_controllen = 0;
+	
+	loop->packet_drv.packet_arg = loop;
+	loop->packet_drv.packet = 0;
+	loop->packet_drv.packet_handler_recv = 0;
+	loop->packet_drv.packet_handler_send = 0;
+	loop->packet_drv.packet_handler_sendto = loop_sendto;
+	loop->packet_drv.packet_handler_recv_batch = 0;
+	loop->packet_drv.packet_handler_send_batch = loop_send_batch;
+	
+	loop->responder = urest_responder(&loop->packet_drv, resource_list, transactions);
+	
+	if (!loop->responder)
+		goto fail;
+	
+	return loop;
+	
+fail:
+	free(loop->send);
+	free(loop->pending);
+	free(loop->bufs);
+	
+	if (loop->br != MAP_FAILED)
+		munmap(loop->br, size);
+	
+	/* the buffer ring is unregistered with the ring */
+	uring_exit(&loop->ring);
+	free(loop);
+	
+	return 0;
+}
+
+/*
+ * create a UDP socket bound to ip:port (any address if ip is null) and serve
+ * uREST requests on it. returns the socket or -1 on failure.
+ */
+int urest_uring_listen(struct uring_loop_s *loop, char *ip, uint16_t port)
+{
+	struct sockaddr_in addr;
+	int s;
+	
+	if (loop->sockets == UREST_URING_SOCKETS)
+		return -1;
+	
+	memset((char *)&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	
+	if (ip && inet_aton(ip, &addr.sin_addr) == 0)
+		return -1;
+	
+	s = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+	
+	if (s < 0)
+		return -1;
+	
+	if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(s);
+	
+		return -1;
+	}
+	
+	loop->s[loop->sockets] = s;
+	
+	if (loop_arm(loop, loop->sockets) < 0) {
+		close(s);
+	
+		return -1;
+	}
+	
+	loop->sockets++;
+	
+	return s;
+}
+
+/*
+ * run the responder on io_uring. each wakeup reaps every completed receive,
+ * processes them as one batch and queues the ACKs, which are submitted by the
+ * same io_uring_enter() call that waits for more fragments.
+ */
+int urest_uring_run(struct uring_loop_s *loop)
+{
+	struct uring_s *ring = &loop->ring;
+	struct datagram_s dgram[UREST_BATCH];
+	uint16_t bids[UREST_BATCH];
+	struct io_uring_recvmsg_out *out;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	uint32_t op, idx;
+	char *buf;
+	int i, n, rearm;
+	
+	loop->running = 1;
+	
+	while (__atomic_load_n(&loop->running, __ATOMIC_RELAXED)) {
+		if (uring_enter(ring, 1, urest_timeout(loop->responder)) < 0)
+			return -1;
+	
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		n = 0;
+		rearm = 0;
+	
+		while (head != tail) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			op = cqe->user_data >> 32;
+			idx = cqe->user_data & 0xffffffff;
+	
+			if (op == URING_SEND) {
+				loop->pending[idx] = 0;
+				loop_recycle(loop, idx);
+			} else if (op == URING_RECV) {
+				if (!(cqe->flags & IORING_CQE_F_MORE))
+					rearm |= 1 << idx;
+	
+				if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+					bids[n] = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+					buf = loop->bufs + bids[n] * URING_BUF_SIZE;
+					out = (struct io_uring_recvmsg_out *)buf;
+	
+					dgram[n].data = URING_PAYLOAD(buf);
+					dgram[n].size = out->payloadlen;
+					dgram[n].peer.link = loop->s[idx];
+					dgram[n].peer.len = out->namelen > UREST_PEER_SIZE ? UREST_PEER_SIZE : out->namelen;
+					memcpy(dgram[n].peer.addr, buf + sizeof(struct io_uring_recvmsg_out), dgram[n].peer.len);
+					n++;
+				}
+			}
+	
+			head++;
+	
+			/* process a full batch before reaping more */
+			if (n == UREST_BATCH || (head == tail && n)) {
+				__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+				urest_process_batch(loop->responder, dgram, n);
+	
+				for (i = 0; i < n; i++)
+					if (!loop->pending[bids[i]])
+						loop_recycle(loop, bids[i]);
+	
+				n = 0;
+			}
+		}
+	
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+		__atomic_store_n(&loop->br->tail, loop->br_tail, __ATOMIC_RELEASE);
+	
+		/* multishot receives stop when buffers run out, post them again */
+		for (i = 0; i < loop->sockets; i++)
+			if (rearm & (1 << i))
+				loop_arm(loop, i);
+	}
+	
+	return 0;
+}
+
+/* stop the loop, takes effect after the next completion or timeout */
+void urest_uring_stop(struct uring_loop_s *loop)
+{
+	__atomic_store_n(&loop->running, 0, __ATOMIC_RELAXED);
+}
+
+
+/* client side */
+
+/*
+ * one exchange is a linked send -> recv -> timeout chain, submitted and reaped
+ * with a single io_uring_enter() instead of a sendto() and a recvfrom().
+ */
+static void uring_clnt_handler(void *arg, char *data, uint16_t send_size, uint16_t *recv_size)
+{
+	struct uring_clnt_s *clnt = (struct uring_clnt_s *)arg;
+	struct uring_s *ring = &clnt->ring;
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail, done = 0;
+	int res = 0;
+	
+	clnt->iov.iov_base = data;
+	clnt->iov.iov_len = send_size;
+	clnt->msg.msg_name = &clnt->addr;
+	clnt->msg.msg_namelen = clnt->addrlen;
+	clnt->msg.msg_iov = &clnt->iov;
+	clnt->msg.msg_iovlen = 1;
+	
+	sqe = uring_sqe(ring);
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = clnt->s;
+	sqe->addr = (uint64_t)(uintptr_t)&clnt->msg;
+	sqe->len = 1;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = URING_SEND;
+	
+	sqe = uring_sqe(ring);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = clnt->s;
+	sqe->addr = (uint64_t)(uintptr_t)data;
+	sqe->len = clnt->size;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = URING_RECV;
+	
+	sqe = uring_sqe(ring);
+	sqe->opcode = IORING_OP_LINK_TIMEOUT;
+	sqe->addr = (uint64_t)(uintptr_t)&clnt->ts;
+	sqe->len = 1;
+	sqe->user_data = 0;
+	
+	while (done < 3) {
+		if (uring_enter(ring, 3 - done, -1) < 0)
+			break;
+	
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	
+		while (head != tail) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+	
+			if (cqe->user_data == URING_RECV)
+				res = cqe->res;
+	
+			head++;
+			done++;
+		}
+	
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+	
+	if (res <= 0) {
+		*recv_size = 0;
+	
+		return;
+	}
+	
+	/* same as a driver clearing its buffer before recvfrom() */
+	memset(data + res, 0, clnt->size - res);
+	*recv_size = res;
+}
+
+static void uring_clnt_timeout(void *arg, uint32_t timeout)
+{
+	struct uring_clnt_s *clnt = (struct uring_clnt_s *)arg;
+	
+	clnt->ts.tv_sec = timeout / 1000;
+	clnt->ts.tv_nsec = (timeout % 1000) * 1000000;
+}
+	
+/*
+ * set up clnt_packet to exchange fragments with the responder at addr through
+ * io_uring on socket s, into clnt_packet->packet of size bytes (UREST_PACKET_SIZE
+ * for jumbo fragments). timeout is the ACK wait (in ms) until the library sets
+ * it from the RTT.
+ */
+int urest_uring_client(struct clnt_packet_s *clnt_packet, uint16_t size, int s, void *addr, uint8_t addrlen, uint32_t timeout)
+{
+	struct uring_clnt_s *clnt;
+	
+	if (addrlen > sizeof(struct sockaddr_in6) || size < 16)
+		return -1;
+	
+	clnt = calloc(1, sizeof(struct uring_clnt_s));
+	
+	if (!clnt)
+		return -1;
+	
+	if (uring_init(&clnt->ring, 8) < 0) {
+		free(clnt);
+	
+		return -1;
+	}
+	
+	clnt->s = s;
+	memcpy(&clnt->addr, addr, addrlen);
+	clnt->addrlen = addrlen;
+	clnt->size = size;
+	uring_clnt_timeout(clnt, timeout);
+	
+	clnt_packet->packet_arg = clnt;
+	clnt_packet->packet_handler = uring_clnt_handler;
+	clnt_packet->packet_timeout = uring_clnt_timeout;
+	
+	return 0;
+}
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "urest.h"
+
+
+/*
+ * misrouted fragments are passed between workers through a bounded lock-free
+ * queue per worker (many producers, the owning worker as single consumer). each
+ * cell carries a sequence number telling whether it is free or filled for the
+ * current lap around the ring.
+ */
+static int handoff_push(struct worker_s *worker, char *packet, uint16_t size, struct peer_s *peer)
+{
+	struct handoff_s *cell;
+	uint32_t pos, seq;
+	int32_t diff;
+	
+	pos = __atomic_load_n(&worker->tail, __ATOMIC_RELAXED);
+	
+	while (1) {
+		cell = &worker->queue[pos & (UREST_HANDOFF_QUEUE - 1)];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t)(seq - pos);
+	
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&worker->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* queue full, the fragment is dropped and the initiator retransmits */
+			return -1;
+		} else {
+			pos = __atomic_load_n(&worker->tail, __ATOMIC_RELAXED);
+		}
+	}
+	
+	cell->size = size;
+	cell->peer = *peer;
+	memcpy(cell->packet, packet, size);
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	
+	return 0;
+}
+
+static struct handoff_s *handoff_pop(struct worker_s *worker)
+{
+	struct handoff_s *cell;
+	
+	cell = &worker->queue[worker->head & (UREST_HANDOFF_QUEUE - 1)];
+	
+	if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != worker->head + 1)
+		return 0;
+	
+	return cell;
+}
+
+static void handoff_release(struct worker_s *worker, struct handoff_s *cell)
+{
+	__atomic_store_n(&cell->seq, worker->head + UREST_HANDOFF_QUEUE, __ATOMIC_RELEASE);
+	worker->head++;
+}
+
+/* responder callback: the token belongs to another shard */
+static void worker_handoff(void *arg, uint8_t shard, char *packet, uint16_t size, struct peer_s *peer)
+{
+	struct worker_s *worker = (struct worker_s *)arg;
+	struct worker_s *owner;
+	uint64_t one = 1;
+	
+	if (shard >= worker->workers->count)
+		return;
+	
+	owner = &worker->workers->worker[shard];
+	
+	if (handoff_push(owner, packet, size, peer) == 0)
+		write(owner->wake, &one, sizeof(one));
+}
+
+/* drain fragments handed over by other workers, a batch at a time */
+static void worker_wake(void *arg, int fd, uint32_t events)
+{
+	struct worker_s *worker = (struct worker_s *)arg;
+	struct event_loop_s *loop = worker->loop;
+	struct handoff_s *cell;
+	uint64_t count;
+	int n;
+	
+	read(fd, &count, sizeof(count));
+	
+	do {
+		for (n = 0; n < UREST_BATCH && (cell = handoff_pop(worker)); n++) {
+			memcpy(loop->dgram[n].data, cell->packet, cell->size);
+			loop->dgram[n].size = cell->size;
+			loop->dgram[n].peer = cell->peer;
+			
+			/* answer from our own socket, it is bound to the same address */
+			loop->dgram[n].peer.link = worker->s;
+			handoff_release(worker, cell);
+		}
+		
+		if (n)
+			urest_process_batch(loop->responder, loop->dgram, n);
+	} while (n == UREST_BATCH);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker_s *worker = (struct worker_s *)arg;
+	
+	urest_event_run(worker->loop);
+	
+	return 0;
+}
+
+/* tear down the first count workers, the last one may be partly built */
+static void workers_free(struct workers_s *workers, int count)
+{
+	struct worker_s *worker;
+	int i;
+	
+	for (i = 0; i < count; i++) {
+		worker = &workers->worker[i];
+	
+		if (worker->wake >= 0)
+			close(worker->wake);
+	
+		free(worker->queue);
+	
+		if (worker->loop)
+			urest_event_free(worker->loop);
+	}
+	
+	free(workers->worker);
+	free(workers);
+}
+
+/*
+ * create count workers, each one with its own event loop, transaction table and
+ * socket. the resource list is shared by all workers and must not change after
+ * the workers are running.
+ */
+struct workers_s *urest_workers(struct resource_list_s *resource_list, uint16_t transactions, uint8_t count)
+{
+	struct workers_s *workers;
+	struct worker_s *worker;
+	int i, j;
+	
+	if (count == 0)
+		return 0;
+	
+	workers = malloc(sizeof(struct workers_s));
+	
+	if (!workers)
+		return 0;
+	
+	workers->worker = calloc(count, sizeof(struct worker_s));
+	
+	if (!workers->worker) {
+		free(workers);
+	
+		return 0;
+	}
+	
+	workers->count = count;
+	
+	for (workers->shard_bits = 0; (1 << workers->shard_bits) < count; workers->shard_bits++);
+	
+	for (i = 0; i < count; i++) {
+		worker = &workers->worker[i];
+		worker->workers = workers;
+		worker->id = i;
+		worker->s = -1;
+		worker->loop = urest_event_loop(resource_list, transactions);
+		worker->queue = malloc(UREST_HANDOFF_QUEUE * sizeof(struct handoff_s));
+		worker->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	
+		if (!worker->loop || !worker->queue || worker->wake < 0) {
+			workers_free(workers, i + 1);
+	
+			return 0;
+		}
+	
+		for (j = 0; j < UREST_HANDOFF_QUEUE; j++)
+			worker->queue[j].seq = j;
+	
+		worker->head = 0;
+		worker->tail = 0;
+	
+		if (urest_responder_shard(worker->loop->responder, i, workers->shard_bits, worker_handoff, worker) < 0 ||
+			urest_event_add(worker->loop, worker->wake, EPOLLIN, worker_wake, worker) < 0) {
+			workers_free(workers, i + 1);
+	
+			return 0;
+		}
+	}
+	
+	return workers;
+}
+
+/* close the sockets of the first count workers */
+static void workers_unlisten(struct workers_s *workers, int count)
+{
+	int i;
+	
+	for (i = 0; i < count; i++) {
+		urest_event_del(workers->worker[i].loop, workers->worker[i].s);
+		close(workers->worker[i].s);
+		workers->worker[i].s = -1;
+	}
+}
+
+/*
+ * bind one SO_REUSEPORT socket per worker to ip:port (any address if ip is null),
+ * the kernel spreads initiators across them.
+ */
+int urest_workers_listen(struct workers_s *workers, char *ip, uint16_t port)
+{
+	struct sockaddr_in addr;
+	int i, s, on = 1;
+	
+	memset((char *)&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	
+	if (ip && inet_aton(ip, &addr.sin_addr) == 0)
+		return -1;
+	
+	for (i = 0; i < workers->count; i++) {
+		s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+	
+		if (s < 0) {
+			workers_unlisten(workers, i);
+	
+			return -1;
+		}
+	
+		if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+			bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			urest_event_attach(workers->worker[i].loop, s) < 0) {
+			close(s);
+			workers_unlisten(workers, i);
+	
+			return -1;
+		}
+	
+		workers->worker[i].s = s;
+	}
+	
+	return 0;
+}
+
+/* run all workers and wait for them to stop */
+int urest_workers_run(struct workers_s *workers)
+{
+	int i;
+	
+	for (i = 0; i < workers->count; i++) {
+		if (pthread_create(&workers->worker[i].thread, 0, worker_thread, &workers->worker[i])) {
+			urest_workers_stop(workers);
+	
+			while (i--)
+				pthread_join(workers->worker[i].thread, 0);
+	
+			return -1;
+		}
+	}
+	
+	for (i = 0; i < workers->count; i++)
+		pthread_join(workers->worker[i].thread, 0);
+	
+	return 0;
+}
+
+void urest_workers_stop(struct workers_s *workers)
+{
+	uint64_t one = 1;
+	int i;
+	
+	for (i = 0; i < workers->count; i++) {
+		urest_event_stop(workers->worker[i].loop);
+		write(workers->worker[i].wake, &one, sizeof(one));
+	}
+}
+
+/* the workers share one offload pool for handlers of slow resources */
+void urest_workers_offload(struct workers_s *workers, struct offload_s *offload)
+{
+	int i;
+	
+	for (i = 0; i < workers->count; i++)
+		urest_responder_offload(workers->worker[i].loop->responder, offload);
+}
+	
+/* and one dictionary for packed payloads */
+void urest_workers_compress(struct workers_s *workers, const struct dict_s *dict, uint16_t threshold)
+{
+	int i;
+	
+	for (i = 0; i < workers->count; i++)
+		urest_responder_compress(workers->worker[i].loop->responder, dict, threshold);
+}
+	
+/* rate limits and the cap apply per worker, a peer is mostly served by the same one */
+int urest_workers_limit(struct workers_s *workers, uint16_t peers, uint16_t rate, uint16_t burst, uint16_t admit)
+{
+	int i;
+	
+	for (i = 0; i < workers->count; i++)
+		if (urest_responder_limit(workers->worker[i].loop->responder, peers, rate, burst, admit) < 0)
+			return -1;
+	
+	return 0;
+}
+	
+/* and one set of metrics */
+void urest_workers_stats(struct workers_s *workers, struct stats_s *stats)
+{
+	int i;
+	
+	for (i = 0; i < workers->count; i++)
+		urest_responder_stats(workers->worker[i].loop->responder, stats);
+}
+	
+/* the load shed by all workers so far */
+void urest_workers_shed(struct workers_s *workers, struct shed_s *shed)
+{
+	int i;
+	
+	shed->busy = 0;
+	shed->rate = 0;
+	
+	for (i = 0; i < workers->count; i++) {
+		shed->busy += __atomic_load_n(&workers->worker[i].loop->responder->shed.busy, __ATOMIC_RELAXED);
+		shed->rate += __atomic_load_n(&workers->worker[i].loop->responder->shed.rate, __ATOMIC_RELAXED);
+	}
+}